@@ -0,0 +1,118 @@
+"""
+Thin ctypes binding of libjabberook.so (build it with "make lib" in src/).
+
+The library is looked up in $JABBEROOK_LIB, engines/ and ../bin/all/.
+"""
+
+import ctypes
+import os
+
+_here = os.path.dirname(os.path.abspath(__file__))
+_library_paths = [os.environ.get("JABBEROOK_LIB", ""),
+                  os.path.join(_here, "engines", "libjabberook.so"),
+                  os.path.join(_here, "..", "bin", "all", "libjabberook.so")]
+
+
+class Limits(ctypes.Structure):
+    _fields_ = [("depth", ctypes.c_int),
+                ("movetime", ctypes.c_int),
+                ("wtime", ctypes.c_int),
+                ("btime", ctypes.c_int),
+                ("winc", ctypes.c_int),
+                ("binc", ctypes.c_int),
+                ("movestogo", ctypes.c_int),
+                ("nodes", ctypes.c_longlong),
+                ("searchmoves", ctypes.c_char_p)]
+
+
+InfoCallback = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int,
+                                ctypes.c_longlong, ctypes.c_int, ctypes.c_char_p)
+BestmoveCallback = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p)
+
+_library = None
+
+
+def load_library():
+    global _library
+    if _library is None:
+        path = next((path for path in _library_paths if path and os.path.isfile(path)), None)
+        if path is None:
+            raise OSError("libjabberook.so not found, build it with \"make lib\" or set JABBEROOK_LIB")
+        library = ctypes.CDLL(path)
+        library.jabberook_create.restype = ctypes.c_void_p
+        library.jabberook_create.argtypes = []
+        library.jabberook_destroy.argtypes = [ctypes.c_void_p]
+        library.jabberook_new_game.argtypes = [ctypes.c_void_p]
+        library.jabberook_set_position.restype = ctypes.c_int
+        library.jabberook_set_position.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p]
+        library.jabberook_set_option.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p]
+        library.jabberook_set_callbacks.argtypes = [ctypes.c_void_p, InfoCallback, BestmoveCallback, ctypes.c_void_p]
+        library.jabberook_search.restype = ctypes.c_int
+        library.jabberook_search.argtypes = [ctypes.c_void_p, ctypes.POINTER(Limits), ctypes.c_char_p,
+                                             ctypes.POINTER(ctypes.c_int)]
+        library.jabberook_stop.argtypes = [ctypes.c_void_p]
+        _library = library
+    return _library
+
+
+class Engine:
+    """
+    One engine instance (one game). Scores are centipawns from the side to move,
+    mates are reported as +-(49000 - plies to mate).
+    """
+    def __init__(self, info=None):
+        self.library = load_library()
+        self.handle = self.library.jabberook_create()
+        if not self.handle:
+            raise MemoryError("jabberook_create failed")
+        # info(depth, seldepth, multipv, score, nodes, time, pv list) after every iteration
+        self.info = info
+        self.pv = []
+        # keep references to the callbacks alive as long as the instance
+        self._info_callback = InfoCallback(self._on_info)
+        self._bestmove_callback = BestmoveCallback(self._on_bestmove)
+        self.library.jabberook_set_callbacks(self.handle, self._info_callback, self._bestmove_callback, None)
+
+    def _on_info(self, user_data, depth, seldepth, multipv, score, nodes, time, pv):
+        if self.info:
+            self.info(depth, seldepth, multipv, score, nodes, time, pv.decode().split())
+
+    def _on_bestmove(self, user_data, move, score, pv):
+        self.pv = pv.decode().split()
+
+    def new_game(self):
+        self.library.jabberook_new_game(self.handle)
+
+    def set_position(self, fen=None, moves=()):
+        if not self.library.jabberook_set_position(self.handle, fen.encode() if fen else None,
+                                                   " ".join(moves).encode()):
+            raise ValueError("position too long")
+
+    def set_option(self, name, value):
+        self.library.jabberook_set_option(self.handle, str(name).encode(), str(value).encode())
+
+    def search(self, depth=0, movetime=0, wtime=0, btime=0, winc=0, binc=0, movestogo=0, nodes=0, searchmoves=()):
+        """
+        Search the current position (times in ms, no limits = until stop()),
+        optionally only among the UCI moves in searchmoves.
+        Returns (best move or None, score, pv).
+        """
+        limits = Limits(depth, movetime, wtime, btime, winc, binc, movestogo, nodes,
+                        " ".join(searchmoves).encode() if searchmoves else None)
+        move = ctypes.create_string_buffer(6)
+        score = ctypes.c_int(0)
+        self.pv = []
+        found = self.library.jabberook_search(self.handle, ctypes.byref(limits), move, ctypes.byref(score))
+        return (move.value.decode() if found else None), score.value, self.pv
+
+    def stop(self):
+        """Stop a search running in another thread."""
+        self.library.jabberook_stop(self.handle)
+
+    def close(self):
+        if self.handle:
+            self.library.jabberook_destroy(self.handle)
+            self.handle = None
+
+    def __del__(self):
+        self.close()
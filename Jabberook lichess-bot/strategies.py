@@ -4,6 +4,8 @@ And some handy classes to extend
 """
 
 from chess.engine import PlayResult
+import chess
+import chess.engine
 import random
 from engine_wrapper import EngineWrapper
 
@@ -81,6 +83,62 @@ class ExampleEngine(MinimalEngine):
     pass
 
 
+class Jabberook(MinimalEngine):
+    """
+    Jabberook loaded in process from libjabberook.so (see jabberook.py).
+
+    Options under "homemade_options" in config.yml are passed on as UCI options.
+    """
+    def __init__(self, commands, options, stderr, draw_or_resign, name=None, **popen_args):
+        super().__init__(commands, options, stderr, draw_or_resign, name, **popen_args)
+        import jabberook
+        self.jabberook = jabberook.Engine()
+        for option, value in options.items():
+            self.jabberook.set_option(option, value)
+
+    def search(self, board, time_limit, ponder, draw_offered, root_moves):
+        # movetime / depth / nodes caps from "go_commands" in config.yml
+        time_limit = self.add_go_commands(time_limit)
+
+        root = board.root()
+        fen = None if root.fen() == chess.STARTING_FEN else root.fen()
+        self.jabberook.set_position(fen, [move.uci() for move in board.move_stack])
+
+        def ms(seconds):
+            return int(seconds * 1000) if seconds else 0
+
+        searchmoves = [move.uci() for move in root_moves] if isinstance(root_moves, list) else ()
+
+        move, score, pv = self.jabberook.search(depth=int(time_limit.depth or 0),
+                                                movetime=ms(time_limit.time),
+                                                wtime=ms(time_limit.white_clock),
+                                                btime=ms(time_limit.black_clock),
+                                                winc=ms(time_limit.white_inc),
+                                                binc=ms(time_limit.black_inc),
+                                                nodes=int(time_limit.nodes or 0),
+                                                searchmoves=searchmoves)
+
+        # mate scores are 49000 - plies to mate
+        if abs(score) > 48000:
+            moves_to_mate = (49000 - abs(score) + 1) // 2
+            relative = chess.engine.Mate(moves_to_mate if score > 0 else -moves_to_mate)
+        else:
+            relative = chess.engine.Cp(score)
+
+        info = {"score": chess.engine.PovScore(relative, board.turn),
+                "pv": [chess.Move.from_uci(pv_move) for pv_move in pv]}
+        info["ponderpv"] = board.variation_san(info["pv"])
+        self.scores.append(info["score"])
+        result = PlayResult(chess.Move.from_uci(move) if move else None, None, info)
+        return self.offer_draw_or_resign(result, board)
+
+    def stop(self):
+        self.jabberook.stop()
+
+    def quit(self):
+        self.jabberook.close()
+
+
 # Strategy names and ideas from tom7's excellent eloWorld video
 
 class RandomMove(ExampleEngine):
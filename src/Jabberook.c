@@ -13,12 +13,31 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <math.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #ifdef __MINGW32__
     #include <windows.h>
 #else
     #include <sys/time.h>
+    #include <time.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <dirent.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+#endif
+
+// time stamp counter for cycle counts (x86 only)
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define HAS_RDTSC 1
+#else
+    #define HAS_RDTSC 0
 #endif
 
 
@@ -26,6 +45,12 @@
 
 #define U64 unsigned long long
 
+// per thread storage for board and search state (attack tables stay shared)
+#define THREAD_LOCAL __thread
+
+// max number of worker threads
+#define MAX_THREADS 64
+
 // board squares
 
 enum {
@@ -63,22 +88,28 @@ const char* square_to_coordinates[] = {
 };
 
 // piece bitboards (kings, knights, etc.)
-U64 bitboards[12];
+THREAD_LOCAL U64 bitboards[12];
 
 // occupancy bitboards (all white pieces, all black pieces, all pieces)
-U64 occupancies[3];
+THREAD_LOCAL U64 occupancies[3];
 
 // side to move
-int side;
+THREAD_LOCAL int side;
 
 // holy hell
-int enpassant = no_sq;
+THREAD_LOCAL int enpassant = no_sq;
 
 // castling possibilities representation
 enum { WKC = 1, WQC = 2, BKC = 4, BQC = 8 }; // 4 bits to represent 4 independent states
 
 // castling rights
-int castle = 0;
+THREAD_LOCAL int castle = 0;
+
+// "almost" unique position identifier aka hash key or position key
+THREAD_LOCAL U64 hash_key;
+
+// number of worker threads (UCI "Threads" option)
+int threads = 1;
 
 // piece repr
 
@@ -117,31 +148,42 @@ int char_pieces [] =
 int quit = 0;
 
 // UCI "movestogo" command moves counter
-int movestogo = 30;
+THREAD_LOCAL int movestogo = 30;
 
 // UCI "movetime" command time counter
-int movetime = -1;
+THREAD_LOCAL int movetime = -1;
 
 // UCI "time" command holder (ms)
-int ucitime = -1;
+THREAD_LOCAL int ucitime = -1;
 
 // UCI "inc" command's time increment holder
-int inc = 0;
+THREAD_LOCAL int inc = 0;
 
 // UCI "starttime" command time holder
-int starttime = 0;
+THREAD_LOCAL int starttime = 0;
 
 // UCI "stoptime" command time holder
-int stoptime = 0;
+THREAD_LOCAL int stoptime = 0;
 
 // variable to flag time control availability
-int timeset = 0;
+THREAD_LOCAL int timeset = 0;
 
 // variable to flag when the time is up
-int stopped = 0;
+THREAD_LOCAL int stopped = 0;
+
+// stop request from another thread (server and library searches)
+THREAD_LOCAL volatile int *stop_signal = NULL;
+
+THREAD_LOCAL long nodes = 0; // number of nodes traversed by search
+
+// stop the search after this many nodes (0 = no limit, checked every 2048 nodes)
+THREAD_LOCAL long node_limit = 0;
 
 // check if first move
-int first_move = 1;
+THREAD_LOCAL int first_move = 1;
+
+// listen to GUI input during search (off for benchmarks and worker threads)
+THREAD_LOCAL int poll_input = 1;
 
 /**************************************************
 *       
@@ -163,6 +205,31 @@ int get_time_ms()
     #endif
 }
 
+// get monotonic time in nanoseconds (for micro benchmarks)
+U64 get_time_ns()
+{
+    #ifdef __MINGW32__
+        LARGE_INTEGER counter, frequency;
+        QueryPerformanceCounter(&counter);
+        QueryPerformanceFrequency(&frequency);
+        return (U64)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+    #else
+        struct timespec time_value;
+        clock_gettime(CLOCK_MONOTONIC, &time_value);
+        return (U64)time_value.tv_sec * 1000000000ULL + time_value.tv_nsec;
+    #endif
+}
+
+// read CPU time stamp counter (0 where not available)
+static inline U64 read_cycles()
+{
+    #if HAS_RDTSC
+        return __rdtsc();
+    #else
+        return 0;
+    #endif
+}
+
 /*
   Function to "listen" to GUI's input during search.
   It's waiting for the user input from STDIN.
@@ -273,9 +340,18 @@ static void communicate() {
         // tell engine to stop calculating
         stopped = 1;
     }
+
+    // stop requested from another thread
+    if(stop_signal && *stop_signal)
+        stopped = 1;
+
+    // node budget used up
+    if(node_limit && nodes >= node_limit)
+        stopped = 1;
     
     // read GUI input
-    read_input();
+    if(poll_input)
+        read_input();
 }
 
 
@@ -384,6 +460,93 @@ static inline int get_ls1b_index(U64 bitboard)
         return -1; // return illegal index
 }
 
+/****************************************************************
+ * 
+ * 
+ * 
+ *                  ZOBRIST HASHING
+ * 
+ * 
+ * 
+ * **************************************************************/
+
+// random piece keys [piece][square]
+U64 piece_keys[12][64];
+
+// random enpassant keys [square]
+U64 enpassant_keys[64];
+
+// random castling keys [castling rights]
+U64 castle_keys[16];
+
+// random side key (hashed in when black is to move)
+U64 side_key;
+
+// hash key random state
+U64 key_random_state = 1070372ULL;
+
+// generate 64 bit hash key (xorshift64*, the plain xorshift above is linear
+// and its keys XOR to zero in small sets, which breaks hash tables)
+U64 get_random_key()
+{
+    key_random_state ^= key_random_state >> 12;
+    key_random_state ^= key_random_state << 25;
+    key_random_state ^= key_random_state >> 27;
+
+    return key_random_state * 2685821657736338717ULL;
+}
+
+// init random hash keys
+void init_random_keys()
+{
+    // reset random state so that keys are the same on every run
+    key_random_state = 1070372ULL;
+
+    for (int piece = 0; piece < 12; piece++)
+    {
+        for (int square = 0; square < 64; square++)
+            piece_keys[piece][square] = get_random_key();
+    }
+
+    for (int square = 0; square < 64; square++)
+        enpassant_keys[square] = get_random_key();
+
+    for (int index = 0; index < 16; index++)
+        castle_keys[index] = get_random_key();
+
+    side_key = get_random_key();
+}
+
+// generate "almost" unique position identifier from scratch
+U64 generate_hash_key()
+{
+    U64 final_key = 0ULL;
+
+    for (int piece = 0; piece < 12; piece++)
+    {
+        U64 bitboard = bitboards[piece];
+
+        while (bitboard)
+        {
+            int square = get_ls1b_index(bitboard);
+
+            final_key ^= piece_keys[piece][square];
+
+            pop_bit(bitboard, square);
+        }
+    }
+
+    if (enpassant != no_sq)
+        final_key ^= enpassant_keys[enpassant];
+
+    final_key ^= castle_keys[castle];
+
+    if (side) // black to move
+        final_key ^= side_key;
+
+    return final_key;
+}
+
 /****************************************************************
  * 
  * 
@@ -575,6 +738,60 @@ void parse_fen(char *fen)
     }
 
     occupancies[both] = occupancies[white] | occupancies[black];
+
+    // init hash key
+    hash_key = generate_hash_key();
+}
+
+// write the four EPD fields of the current position into buffer (at least 90 bytes)
+void board_to_fen(char *buffer)
+{
+    int length = 0;
+
+    for (int rank = 0; rank < 8; rank++)
+    {
+        int empty = 0;
+
+        for (int file = 0; file < 8; file++)
+        {
+            int square = rank * 8 + file;
+            int piece = -1;
+
+            for (int bb_piece = P; bb_piece <= k; bb_piece++)
+            {
+                if (get_bit(bitboards[bb_piece], square))
+                    piece = bb_piece;
+            }
+
+            if (piece == -1)
+                empty++;
+
+            else
+            {
+                if (empty)
+                    buffer[length++] = '0' + empty;
+
+                buffer[length++] = ascii_pieces[piece];
+                empty = 0;
+            }
+        }
+
+        if (empty)
+            buffer[length++] = '0' + empty;
+
+        if (rank < 7)
+            buffer[length++] = '/';
+    }
+
+    length += sprintf(buffer + length, " %c ", (side == white) ? 'w' : 'b');
+
+    if (castle & WKC) buffer[length++] = 'K';
+    if (castle & WQC) buffer[length++] = 'Q';
+    if (castle & BKC) buffer[length++] = 'k';
+    if (castle & BQC) buffer[length++] = 'q';
+    if (castle == 0) buffer[length++] = '-';
+
+    sprintf(buffer + length, " %s", (enpassant != no_sq) ? square_to_coordinates[enpassant] : "-");
 }
 
 
@@ -1276,58 +1493,75 @@ void print_attacked_squares(int side)
 }
 
 /*
-          binary move bits                               hexidecimal constants
-    
-    0000 0000 0000 0000 0011 1111    source square       0x3f
-    0000 0000 0000 1111 1100 0000    target square       0xfc0
-    0000 0000 1111 0000 0000 0000    piece               0xf000
-    0000 1111 0000 0000 0000 0000    promoted piece      0xf0000
-    0001 0000 0000 0000 0000 0000    capture flag        0x100000
-    0010 0000 0000 0000 0000 0000    double push flag    0x200000
-    0100 0000 0000 0000 0000 0000    enpassant flag      0x400000
-    1000 0000 0000 0000 0000 0000    castling flag       0x800000
+          binary move bits                  hexidecimal constants
+
+    0000 0000 0011 1111    source square       0x3f
+    0000 1111 1100 0000    dest square         0xfc0
+    1111 0000 0000 0000    move flag           0xf000
+
+    flags: 0 quiet, 1 double push, 2 castling, 4 capture, 5 en passant,
+           8-11 promotion to knight-queen, 12-15 capture with promotion
+
+    The moving piece isn't stored, it is looked up on the board (before the
+    move is made). Promotion colors follow from the dest rank.
 */
 
+// move flags
+enum { MOVE_QUIET = 0, MOVE_DOUBLE_PUSH = 1, MOVE_CASTLING = 2, MOVE_CAPTURE = 4, MOVE_ENPASSANT = 5, MOVE_PROMOTION = 8 };
+
 // encode move
-#define encode_move(source, dest, piece, promoted, capture, double_push, enpassant, castling) \
-    (source) |          \
-    (dest << 6) |     \
-    (piece << 12) |     \
-    (promoted << 16) |  \
-    (capture << 20) |   \
-    (double_push << 21) |    \
-    (enpassant << 22) | \
-    (castling << 23)    \
-    
+#define encode_move(source, dest, flag) ((source) | ((dest) << 6) | ((flag) << 12))
+
 // extract source square
-#define get_move_source(move) (move & 0x3f)
+#define get_move_source(move) ((move) & 0x3f)
 
 // extract dest square
-#define get_move_dest(move) ((move & 0xfc0) >> 6)
+#define get_move_dest(move) (((move) & 0xfc0) >> 6)
 
-// extract piece
-#define get_move_piece(move) ((move & 0xf000) >> 12)
+// extract move flag
+#define get_move_flag(move) (((move) & 0xf000) >> 12)
 
-// extract promoted piece
-#define get_move_promoted(move) ((move & 0xf0000) >> 16)
+// extract promoted piece (black promotes on rank 1, dest squares 56-63)
+#define get_move_promoted(move) (((move) & 0x8000) ? (((move) >> 12) & 3) + N + (((move) & 0xe00) ? 6 : 0) : 0)
 
 // extract capture flag
-#define get_move_capture(move) (move & 0x100000)
+#define get_move_capture(move) ((move) & 0x4000)
 
 // extract double pawn push flag
-#define get_move_double_push(move) (move & 0x200000)
+#define get_move_double_push(move) (((move) & 0xf000) == 0x1000)
 
 // extract enpassant flag
-#define get_move_enpassant(move) (move & 0x400000)
+#define get_move_enpassant(move) (((move) & 0xf000) == 0x5000)
 
 // extract castling flag
-#define get_move_castling(move) (move & 0x800000)
+#define get_move_castling(move) (((move) & 0xf000) == 0x2000)
+
+// piece of the side to move on a square (-1 if none)
+static inline int piece_on(int square)
+{
+    int start_piece = (side == white) ? P : p;
+
+    for (int piece = start_piece; piece <= start_piece + K; piece++)
+    {
+        if (get_bit(bitboards[piece], square))
+            return piece;
+    }
 
+    return -1;
+}
+
+// extract piece (from the board, valid before the move is made)
+#define get_move_piece(move) piece_on(get_move_source(move))
+
+// move list, sort_moves() packs the ordering score above each 16 bit move
 typedef struct {
     int moves[256];
     int count;
 } moves;
 
+// move of a (possibly scored) move list entry
+#define get_list_move(entry) ((entry) & 0xffff)
+
 char promoted_pieces[] = {
     [N] = 'n',
     [B] = 'b',
@@ -1350,6 +1584,19 @@ void print_move(int move)
         printf("%s%s", square_to_coordinates[get_move_source(move)], square_to_coordinates[get_move_dest(move)]);
 }
 
+// write UCI move into buffer (at least 6 bytes, "0000" for no move)
+void move_to_string(int move, char *buffer)
+{
+    if (move == 0)
+        strcpy(buffer, "0000");
+
+    else if (get_move_promoted(move))
+        sprintf(buffer, "%s%s%c", square_to_coordinates[get_move_source(move)], square_to_coordinates[get_move_dest(move)],
+                                  promoted_pieces[get_move_promoted(move)]);
+    else
+        sprintf(buffer, "%s%s", square_to_coordinates[get_move_source(move)], square_to_coordinates[get_move_dest(move)]);
+}
+
 //for debug
 void print_move_list(moves *move_list)
 {
@@ -1381,6 +1628,41 @@ static inline void add_move(moves *move_list, int move)
     move_list->count++;
 }
 
+// ranks as bitboards (a8 is bit 0)
+#define RANK_8 0x00000000000000FFULL
+#define RANK_6 0x0000000000FF0000ULL
+#define RANK_3 0x0000FF0000000000ULL
+#define RANK_1 0xFF00000000000000ULL
+
+// add pawn moves to a set of dest squares, each from dest + offset
+static inline void add_pawn_moves(moves *move_list, U64 dests, int offset, int flag)
+{
+    while (dests)
+    {
+        int dest_square = __builtin_ctzll(dests);
+
+        add_move(move_list, encode_move(dest_square + offset, dest_square, flag));
+
+        dests &= dests - 1;
+    }
+}
+
+// add all four promotions to a set of dest squares (flag is MOVE_QUIET or MOVE_CAPTURE)
+static inline void add_promotions(moves *move_list, U64 dests, int offset, int flag)
+{
+    while (dests)
+    {
+        int dest_square = __builtin_ctzll(dests);
+        int source_square = dest_square + offset;
+
+        // knight, bishop, rook, queen
+        for (int promotion = 0; promotion < 4; promotion++)
+            add_move(move_list, encode_move(source_square, dest_square, MOVE_PROMOTION | flag | promotion));
+
+        dests &= dests - 1;
+    }
+}
+
 // preserve board state
 #define copy_board()                                                      \
     U64 bitboards_copy[12], occupancies_copy[3];                          \
@@ -1388,17 +1670,45 @@ static inline void add_move(moves *move_list, int move)
     memcpy(bitboards_copy, bitboards, 96);                                \
     memcpy(occupancies_copy, occupancies, 24);                            \
     side_copy = side, enpassant_copy = enpassant, castle_copy = castle;   \
+    U64 hash_key_copy = hash_key;                                         \
 
 // restore board state
 #define take_back()                                                       \
     memcpy(bitboards, bitboards_copy, 96);                                \
     memcpy(occupancies, occupancies_copy, 24);                            \
     side = side_copy, enpassant = enpassant_copy, castle = castle_copy;   \
+    hash_key = hash_key_copy;                                             \
 
 //NOTE:   
 //sizeof(bitboards) = 96
 //sizeof(occupancies) = 24
 
+// board state snapshot, used to hand a position over to another thread
+typedef struct {
+    U64 bitboards[12];
+    U64 occupancies[3];
+    int side, enpassant, castle;
+    U64 hash_key;
+} board_state;
+
+// store current (thread local) board into snapshot
+void store_board_state(board_state *state)
+{
+    memcpy(state->bitboards, bitboards, 96);
+    memcpy(state->occupancies, occupancies, 24);
+    state->side = side, state->enpassant = enpassant, state->castle = castle;
+    state->hash_key = hash_key;
+}
+
+// load snapshot into current (thread local) board
+void load_board_state(const board_state *state)
+{
+    memcpy(bitboards, state->bitboards, 96);
+    memcpy(occupancies, state->occupancies, 24);
+    side = state->side, enpassant = state->enpassant, castle = state->castle;
+    hash_key = state->hash_key;
+}
+
 /*
 
     WKC - 1 (0001) , WQC - 2 (0010) , BKC - 4 (0100) , BQC - 8 (1000)
@@ -1431,596 +1741,493 @@ const int castling_rights[64] = {
 
 enum move_type {all_moves, captures_only};
 
-static inline int make_move(int move, int move_flag)
+/*
+    make_move() and generate_moves() dispatch on the side to move once and then
+    run a body specialized for that color: the color is a constant inside the
+    always inlined bodies, so the per piece and per move side checks fold away.
+*/
+
+// make move for a constant color, returns 0 (board restored) if it leaves the king in check
+static inline __attribute__((always_inline)) int make_move_for(int move, const int color)
 {
-    if(move_flag == all_moves) // if we are going over all moves
-    {
-        copy_board();
+    copy_board();
 
+    // own and enemy piece offsets (P or p)
+    const int own = (color == white) ? P : p;
+    const int enemy = (color == white) ? p : P;
 
-        // parse move
-        int source_square = get_move_source(move);
-        int dest_square = get_move_dest(move);
-        int piece = get_move_piece(move);
-        int promoted = get_move_promoted(move);
-        int capture = get_move_capture(move);
-        int double_push = get_move_double_push(move);
-        int enpass = get_move_enpassant(move);
-        int castling = get_move_castling(move);
+    // parse move
+    int source_square = get_move_source(move);
+    int dest_square = get_move_dest(move);
+    int promoted = get_move_promoted(move);
 
-        pop_bit(bitboards[piece], source_square);
-        set_bit(bitboards[piece], dest_square);
+    // moving piece from the board
+    int piece = own;
 
-        if(capture)
-        {
-            int start_piece = side == white ? p : P;
-            int end_piece = side == white ? k : K;
+    while(!get_bit(bitboards[piece], source_square))
+        piece++;
+
+    pop_bit(bitboards[piece], source_square);
+    set_bit(bitboards[piece], dest_square);
+
+    // hash piece (remove from source and add to dest square)
+    hash_key ^= piece_keys[piece][source_square];
+    hash_key ^= piece_keys[piece][dest_square];
 
-            for(int bb_piece = start_piece; bb_piece <= end_piece; bb_piece++)
+    if(get_move_capture(move))
+    {
+        for(int bb_piece = enemy; bb_piece <= enemy + K; bb_piece++)
+        {
+            if(get_bit(bitboards[bb_piece], dest_square))
             {
-                if(get_bit(bitboards[bb_piece], dest_square))
-                    pop_bit(bitboards[bb_piece], dest_square);
+                pop_bit(bitboards[bb_piece], dest_square);
+
+                // remove captured piece from hash key
+                hash_key ^= piece_keys[bb_piece][dest_square];
+                break;
             }
         }
+    }
 
-        if(promoted)
-        {
-            pop_bit(bitboards[piece], dest_square);
-            set_bit(bitboards[promoted], dest_square);
-        }
+    if(promoted)
+    {
+        pop_bit(bitboards[piece], dest_square);
+        set_bit(bitboards[promoted], dest_square);
 
-        if(enpass)
-        {
-            (side == white) ? pop_bit(bitboards[p], dest_square + 8)
-                            : pop_bit(bitboards[P], dest_square - 8);
-        }
+        // swap pawn for promoted piece in hash key
+        hash_key ^= piece_keys[piece][dest_square];
+        hash_key ^= piece_keys[promoted][dest_square];
+    }
 
-        enpassant = no_sq;
+    // square behind the pawn's dest (captured en passant pawn, or the en passant square after a double push)
+    const int behind = (color == white) ? 8 : -8;
 
-        if(double_push)
-        {
-            (side == white) ? (enpassant = dest_square + 8)
-                            : (enpassant = dest_square - 8);
-        }
+    if(get_move_enpassant(move))
+    {
+        pop_bit(bitboards[enemy], dest_square + behind);
+        hash_key ^= piece_keys[enemy][dest_square + behind];
+    }
 
-        if (castling)
-        {
-            switch(dest_square)
-            {
-                case c1:
-                pop_bit(bitboards[R], a1);
-                set_bit(bitboards[R], d1);
-                break;
+    // hash enpassant out (if available)
+    if(enpassant != no_sq)
+        hash_key ^= enpassant_keys[enpassant];
 
-                case g1:
-                pop_bit(bitboards[R], h1);
-                set_bit(bitboards[R], f1);
-                break;
+    enpassant = no_sq;
 
-                case c8:
-                pop_bit(bitboards[r], a8);
-                set_bit(bitboards[r], d8);
-                break;
+    if(get_move_double_push(move))
+    {
+        enpassant = dest_square + behind;
 
-                case g8:
-                pop_bit(bitboards[r], h8);
-                set_bit(bitboards[r], f8);
-                break;
-            }
-        }
+        // hash new enpassant square
+        hash_key ^= enpassant_keys[enpassant];
+    }
 
-        castle &= castling_rights[source_square]; //if piece on a1,h1,e1,a8,h8,e8 move
-        castle &= castling_rights[dest_square];   //if one of the rooks end up getting captured
+    if(get_move_castling(move))
+    {
+        // rook squares on the color's back rank
+        const int rank = (color == white) ? 56 : 0;
 
-        memset(occupancies, 0ULL, 24); // sizeof(occupancies) = 24
+        // king side: h -> f, queen side: a -> d
+        int rook_source = (dest_square == g1 || dest_square == g8) ? rank + 7 : rank;
+        int rook_dest = (dest_square == g1 || dest_square == g8) ? rank + 5 : rank + 3;
 
-        for(int bb_piece = P; bb_piece <= K; bb_piece++)
-            occupancies[white] |= bitboards[bb_piece];
+        pop_bit(bitboards[own + R], rook_source);
+        set_bit(bitboards[own + R], rook_dest);
+        hash_key ^= piece_keys[own + R][rook_source] ^ piece_keys[own + R][rook_dest];
+    }
 
-        for(int bb_piece = p; bb_piece <= k; bb_piece++)
-            occupancies[black] |= bitboards[bb_piece];
+    // hash old castling rights out
+    hash_key ^= castle_keys[castle];
 
-        occupancies[both] = occupancies[white] | occupancies[black];
+    castle &= castling_rights[source_square]; //if piece on a1,h1,e1,a8,h8,e8 move
+    castle &= castling_rights[dest_square];   //if one of the rooks end up getting captured
 
-        side ^= 1;
+    // hash new castling rights in
+    hash_key ^= castle_keys[castle];
 
-        // Check if move is legal, note that side just changed above so the bitboard passed is swapped for the current side
-        if(is_square_attacked((side == white) ? get_ls1b_index(bitboards[k]) : get_ls1b_index(bitboards[K]), side))
-        {
-            //restore board state and return illegal move
-            take_back();
-            return 0;
-        }
-        else //return legal move
-            return 1;
+    occupancies[white] = bitboards[P] | bitboards[N] | bitboards[B] | bitboards[R] | bitboards[Q] | bitboards[K];
+    occupancies[black] = bitboards[p] | bitboards[n] | bitboards[b] | bitboards[r] | bitboards[q] | bitboards[k];
+    occupancies[both] = occupancies[white] | occupancies[black];
+
+    side = color ^ 1;
+
+    // hash side
+    hash_key ^= side_key;
+
+    // the mover's king must not be left in check
+    if(is_square_attacked(__builtin_ctzll(bitboards[own + K]), color ^ 1))
+    {
+        //restore board state and return illegal move
+        take_back();
+        return 0;
     }
 
-    else // if we are going over only captures
+    //return legal move
+    return 1;
+}
+
+static inline int make_move(int move, int move_flag)
+{
+    // only captures requested: quiet moves are skipped
+    if(move_flag == captures_only && !get_move_capture(move))
+        return 0;
+
+    return (side == white) ? make_move_for(move, white) : make_move_for(move, black);
+}
+
+// add moves of a piece from its attack set (own pieces already masked out)
+static inline __attribute__((always_inline)) void add_piece_moves(moves *move_list, int source_square, U64 attacks, U64 enemy_pieces)
+{
+    while(attacks)
     {
-        // if move is capture make the move (recursive call to make the move go through the move parser above)
-        if (get_move_capture(move)) 
-        {
-            make_move(move, all_moves);
-        }
+        int dest_square = __builtin_ctzll(attacks);
 
-        else
-            return 0;
+        // capture flag straight from the enemy occupancy
+        add_move(move_list, encode_move(source_square, dest_square, ((enemy_pieces >> dest_square) & 1) ? MOVE_CAPTURE : MOVE_QUIET));
+
+        attacks &= attacks - 1;
     }
 }
 
-
-static inline void generate_moves(moves *move_list)
+// generate pseudo legal moves for a constant color
+static inline __attribute__((always_inline)) void generate_moves_for(moves *move_list, const int color)
 {
     //init count to 0 to avoid seg faults
     move_list->count = 0;
 
-    int source_square, dest_square;
+    // own piece offset (P or p)
+    const int own = (color == white) ? P : p;
+
+    U64 own_pieces = occupancies[color];
+    U64 enemy_pieces = occupancies[color ^ 1];
+    U64 empty = ~occupancies[both];
 
-    // variables to store current piece bitboards and its attack bitboard
     U64 bitboard, attacks;
 
-    for(int piece = P; piece <= k; piece++)
-    {
-        bitboard = bitboards[piece];
+    int source_square;
 
-        // generate white pawn and white king castling moves
-        if(side == white)
-        {
-            if (piece == P)
-            {
-                while(bitboard)
-                {
-                    source_square = get_ls1b_index(bitboard);
+    // pawns: whole pawn set at once, a white pawn on square s moves to s - 8 and a black one to s + 8
+    bitboard = bitboards[own + P];
 
-                    dest_square = source_square - 8;
+    {
+        const U64 promotion_rank = (color == white) ? RANK_8 : RANK_1;
 
-                    // Check if destination on board and not occupied by some piece
-                    if (dest_square >= a8 && !get_bit(occupancies[both], dest_square))
-                    {
-                        // Check for promotion
-                        if (source_square >= a7 && source_square <= h7)
-                        {
-                            //printf("%s-%sn Generated pawn move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            //printf("%s-%sb Generated pawn move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            //printf("%s-%sr Generated pawn move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            //printf("%s-%sq Generated pawn move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            add_move(move_list, encode_move(source_square, dest_square, P, N, 0, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, dest_square, P, B, 0, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, dest_square, P, R, 0, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, dest_square, P, Q, 0, 0, 0, 0));
-                        }
+        U64 pushes = ((color == white) ? bitboard >> 8 : bitboard << 8) & empty;
+        U64 double_pushes = ((color == white) ? (pushes & RANK_3) >> 8 : (pushes & RANK_6) << 8) & empty;
+        U64 left_captures = ((color == white) ? bitboard >> 9 : bitboard << 7) & not_H_file & enemy_pieces;
+        U64 right_captures = ((color == white) ? bitboard >> 7 : bitboard << 9) & not_A_file & enemy_pieces;
 
-                        // Check for double push
-                        else
-                        {
-                            // Normal move
-                            //printf("%s-%s  Generated pawn move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            add_move(move_list, encode_move(source_square, dest_square, P, 0, 0, 0, 0, 0));
-
-                            // Double push
-                            if((source_square >= a2 && source_square <= h2) && !get_bit(occupancies[both], dest_square - 8))
-                            {
-                                //printf("%s-%s  Generated pawn move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square - 8]);
-                                add_move(move_list, encode_move(source_square, dest_square - 8, P, 0, 0, 1, 0, 0));
-                            }
-                        }
-                    }
+        // source = dest + offset
+        const int push = (color == white) ? 8 : -8;
+        const int left = (color == white) ? 9 : -7;
+        const int right = (color == white) ? 7 : -9;
 
-                    U64 attacks = pawn_attacks[white][source_square] & occupancies[black];
+        add_promotions(move_list, pushes & promotion_rank, push, MOVE_QUIET);
+        add_promotions(move_list, left_captures & promotion_rank, left, MOVE_CAPTURE);
+        add_promotions(move_list, right_captures & promotion_rank, right, MOVE_CAPTURE);
 
-                    while(attacks)
-                    {
-                        dest_square = get_ls1b_index(attacks);
+        add_pawn_moves(move_list, pushes & ~promotion_rank, push, MOVE_QUIET);
+        add_pawn_moves(move_list, double_pushes, 2 * push, MOVE_DOUBLE_PUSH);
+        add_pawn_moves(move_list, left_captures & ~promotion_rank, left, MOVE_CAPTURE);
+        add_pawn_moves(move_list, right_captures & ~promotion_rank, right, MOVE_CAPTURE);
 
-                        // Check if promotion after capture
-                        if (source_square >= a7 && source_square <= h7)
-                        {
-                            //printf("%sx%sn Generated pawn capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            //printf("%sx%sb Generated pawn capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            //printf("%sx%sr Generated pawn capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            //printf("%sx%sq Generated pawn capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            add_move(move_list, encode_move(source_square, dest_square, P, N, 1, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, dest_square, P, B, 1, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, dest_square, P, R, 1, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, dest_square, P, Q, 1, 0, 0, 0));
-                        }
+        if (enpassant != no_sq)
+        {
+            // pawns attacking the en passant square are the ones an enemy pawn there would attack
+            attacks = pawn_attacks[color ^ 1][enpassant] & bitboard;
 
-                        else
-                        {
-                            // Normal capture
-                            //printf("%sx%s Generated pawn capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            add_move(move_list, encode_move(source_square, dest_square, P, 0, 1, 0, 0, 0));
-                        }
+            while (attacks)
+            {
+                source_square = __builtin_ctzll(attacks);
+                add_move(move_list, encode_move(source_square, enpassant, MOVE_ENPASSANT));
+                attacks &= attacks - 1;
+            }
+        }
+    }
 
-                        pop_bit(attacks, dest_square);
-                    }
+    // knight moves
+    for(bitboard = bitboards[own + N]; bitboard; bitboard &= bitboard - 1)
+    {
+        source_square = __builtin_ctzll(bitboard);
+        add_piece_moves(move_list, source_square, knight_attacks[source_square] & ~own_pieces, enemy_pieces);
+    }
 
-                    if (enpassant != no_sq)
-                    {
-                        dest_square = enpassant;
+    // bishop moves
+    for(bitboard = bitboards[own + B]; bitboard; bitboard &= bitboard - 1)
+    {
+        source_square = __builtin_ctzll(bitboard);
+        add_piece_moves(move_list, source_square, get_bishop_attacks(source_square, occupancies[both]) & ~own_pieces, enemy_pieces);
+    }
 
-                        if(pawn_attacks[white][source_square] & (1ULL<<enpassant))
-                        {
-                            //printf("%sx%s  Generated pawn capture (enpassant)\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            add_move(move_list, encode_move(source_square, dest_square, P, 0, 0, 0, 1, 0));
-                        }
-                    }
+    // rook moves
+    for(bitboard = bitboards[own + R]; bitboard; bitboard &= bitboard - 1)
+    {
+        source_square = __builtin_ctzll(bitboard);
+        add_piece_moves(move_list, source_square, get_rook_attacks(source_square, occupancies[both]) & ~own_pieces, enemy_pieces);
+    }
 
-                    pop_bit(bitboard, source_square);
-                }
-            }
+    // queen moves
+    for(bitboard = bitboards[own + Q]; bitboard; bitboard &= bitboard - 1)
+    {
+        source_square = __builtin_ctzll(bitboard);
+        add_piece_moves(move_list, source_square, get_queen_attacks(source_square, occupancies[both]) & ~own_pieces, enemy_pieces);
+    }
 
-            if (piece == K)
-            {
-                if(castle & WKC)
-                {
-                    if(!get_bit(occupancies[both], f1) && !get_bit(occupancies[both], g1))
-                    {
-                        if(!is_square_attacked(e1, black) && !is_square_attacked(f1, black))
-                        {
-                            //printf("e1-g1  Kingside Castle (O-O)\n");
-                            add_move(move_list, encode_move(e1, g1, K, 0, 0, 0, 0, 1));
-                        }
-                    }
-                }
+    // castling: empty squares between king and rook, king not passing through check
+    if(color == white)
+    {
+        if((castle & WKC) && !get_bit(occupancies[both], f1) && !get_bit(occupancies[both], g1) &&
+           !is_square_attacked(e1, black) && !is_square_attacked(f1, black))
+            add_move(move_list, encode_move(e1, g1, MOVE_CASTLING));
 
-                if(castle & WQC)
-                {
-                    if(!get_bit(occupancies[both], d1) && !get_bit(occupancies[both], c1) && !get_bit(occupancies[both], b1))
-                    {
-                        if(!is_square_attacked(e1, black) && !is_square_attacked(d1, black) && !is_square_attacked(c1, black))
-                        {
-                            //printf("e1-c1  Queenside Castle (O-O-O)\n");
-                            add_move(move_list, encode_move(e1, c1, K, 0, 0, 0, 0, 1));
-                        }
-                    }
-                }
-            }
-        }
-
-        // generate black pawn and black king castling moves
-        else
-        {
-            if (piece == p)
-            {
-                 while(bitboard)
-                {
-                    source_square = get_ls1b_index(bitboard);
+        if((castle & WQC) && !get_bit(occupancies[both], d1) && !get_bit(occupancies[both], c1) && !get_bit(occupancies[both], b1) &&
+           !is_square_attacked(e1, black) && !is_square_attacked(d1, black) && !is_square_attacked(c1, black))
+            add_move(move_list, encode_move(e1, c1, MOVE_CASTLING));
+    }
+    else
+    {
+        if((castle & BKC) && !get_bit(occupancies[both], f8) && !get_bit(occupancies[both], g8) &&
+           !is_square_attacked(e8, white) && !is_square_attacked(f8, white))
+            add_move(move_list, encode_move(e8, g8, MOVE_CASTLING));
 
-                    dest_square = source_square + 8;
+        if((castle & BQC) && !get_bit(occupancies[both], d8) && !get_bit(occupancies[both], c8) && !get_bit(occupancies[both], b8) &&
+           !is_square_attacked(e8, white) && !is_square_attacked(d8, white) && !is_square_attacked(c8, white))
+            add_move(move_list, encode_move(e8, c8, MOVE_CASTLING));
+    }
 
-                    // Check if destination on board and not occupied by some piece
-                    if (dest_square <= h1 && !get_bit(occupancies[both], dest_square))
-                    {
-                        // Check for promotion
-                        if (source_square >= a2 && source_square <= h2)
-                        {
-                            //printf("%s-%sn Generated pawn move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            //printf("%s-%sb Generated pawn move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            //printf("%s-%sr Generated pawn move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            //printf("%s-%sq Generated pawn move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            add_move(move_list, encode_move(source_square, dest_square, p, n, 0, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, dest_square, p, b, 0, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, dest_square, p, r, 0, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, dest_square, p, q, 0, 0, 0, 0));
-                        }
+    // king moves
+    for(bitboard = bitboards[own + K]; bitboard; bitboard &= bitboard - 1)
+    {
+        source_square = __builtin_ctzll(bitboard);
+        add_piece_moves(move_list, source_square, king_attacks[source_square] & ~own_pieces, enemy_pieces);
+    }
+}
 
-                        // Check for double push
-                        else
-                        {
-                            // Normal move
-                            //printf("%s-%s  Generated pawn move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            add_move(move_list, encode_move(source_square, dest_square, p, 0, 0, 0, 0, 0));
-
-                            // Double push
-                            if((source_square >= a7 && source_square <= h7) && !get_bit(occupancies[both], dest_square + 8))
-                            {
-                                //printf("%s-%s  Generated pawn move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square + 8]);
-                                add_move(move_list, encode_move(source_square, dest_square + 8, p, 0, 0, 1, 0, 0));
-                            }
-                        }
-                    }
+static inline void generate_moves(moves *move_list)
+{
+    if(side == white)
+        generate_moves_for(move_list, white);
+    else
+        generate_moves_for(move_list, black);
+}
 
-                    U64 attacks = pawn_attacks[black][source_square] & occupancies[white];
+/****************************************************************
+ * 
+ * 
+ * 
+ *                          PERFT TEST                                
+ * 
+ * 
+ *
+ * **************************************************************/
 
-                    while(attacks)
-                    {
-                        dest_square = get_ls1b_index(attacks);
+int get_time_in_ms()
+{
+    #ifdef __MINGW32__
+        return GetTickCount();
+    #else
+        struct timeval time_value;
+        gettimeofday(&time_value, NULL);
+        return time_value.tv_sec * 1000 + time_value.tv_usec / 1000;
+    #endif
+}
 
-                        // Check if promotion after capture
-                        if (source_square >= a2 && source_square <= h2)
-                        {
-                            //printf("%sx%sn Generated pawn capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            //printf("%sx%sb Generated pawn capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            //printf("%sx%sr Generated pawn capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            //printf("%sx%sq Generated pawn capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            add_move(move_list, encode_move(source_square, dest_square, p, n, 1, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, dest_square, p, b, 1, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, dest_square, p, r, 1, 0, 0, 0));
-                            add_move(move_list, encode_move(source_square, dest_square, p, q, 1, 0, 0, 0));
-                        }
+// check if pseudo legal move leaves own king in check without making it (perft bulk counting)
+static inline int is_move_legal(int move)
+{
+    int source_square = get_move_source(move);
+    int dest_square = get_move_dest(move);
+    int piece = get_move_piece(move);
 
-                        else
-                        {
-                            // Normal capture
-                            //printf("%sx%s  Generated pawn capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            add_move(move_list, encode_move(source_square, dest_square, p, 0, 1, 0, 0, 0));
-                        }
+    // opponent piece offset (e.g. opponent + N is the enemy knight)
+    int opponent = (side == white) ? p : P;
 
-                        pop_bit(attacks, dest_square);
-                    }
+    // square our king stands on after the move
+    int king_square = (piece == K || piece == k) ? dest_square
+                                                  : get_ls1b_index(bitboards[(side == white) ? K : k]);
 
-                    if (enpassant != no_sq)
-                    {
-                        dest_square = enpassant;
+    // occupancy after the move
+    U64 occupancy = (occupancies[both] & ~(1ULL << source_square)) | (1ULL << dest_square);
 
-                        if(pawn_attacks[black][source_square] & (1ULL<<enpassant))
-                        {
-                            //printf("%sx%s  Generated pawn capture (enpassant)\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                            add_move(move_list, encode_move(source_square, dest_square, p, 0, 1, 0, 1, 0));
-                        }
-                    }
+    // enemy pieces surviving the move
+    U64 survivors = ~(1ULL << dest_square);
 
-                    pop_bit(bitboard, source_square);
-                }
-            }
+    if (get_move_enpassant(move))
+    {
+        int victim_square = (side == white) ? dest_square + 8 : dest_square - 8;
 
-            if (piece == k)
-            {
-                if(castle & BKC)
-                {
-                    if(!get_bit(occupancies[both], f8) && !get_bit(occupancies[both], g8))
-                    {
-                        if(!is_square_attacked(e8, white) && !is_square_attacked(f8, white))
-                        {
-                            //printf("e8-g8  Kingside Castle (O-O)\n");
-                            add_move(move_list, encode_move(e8, g8, k, 0, 0, 0, 0, 1));
-                        }
-                    }
-                }
+        pop_bit(occupancy, victim_square);
+        pop_bit(survivors, victim_square);
+    }
 
-                if(castle & BQC)
-                {
-                    if(!get_bit(occupancies[both], d8) && !get_bit(occupancies[both], c8) && !get_bit(occupancies[both], b8))
-                    {
-                        if(!is_square_attacked(e8, white) && !is_square_attacked(d8, white) && !is_square_attacked(c8, white))
-                        {
-                            //printf("e8-c8  Queenside Castle (O-O-O)\n");
-                            add_move(move_list, encode_move(e8, c8, k, 0, 0, 0, 0, 1));
-                        }
-                    }
-                }
-            }
-        }
+    // rook lands next to the king when castling
+    if (get_move_castling(move))
+        set_bit(occupancy, (source_square + dest_square) / 2);
 
-        // generate knight moves
+    if (pawn_attacks[side][king_square] & bitboards[opponent + P] & survivors) return 0;
 
-        if((side == white) ? piece == N : piece == n)
-        {
-            while(bitboard)
-            {
-                source_square = get_ls1b_index(bitboard);
+    if (knight_attacks[king_square] & bitboards[opponent + N] & survivors) return 0;
 
-                attacks = knight_attacks[source_square] & ((side == white) ? ~occupancies[white] : ~occupancies[black]);
+    if (get_bishop_attacks(king_square, occupancy) & (bitboards[opponent + B] | bitboards[opponent + Q]) & survivors) return 0;
 
-                while(attacks)
-                {
-                    dest_square = get_ls1b_index(attacks);
+    if (get_rook_attacks(king_square, occupancy) & (bitboards[opponent + R] | bitboards[opponent + Q]) & survivors) return 0;
 
-                    // quiet move
-                    if(!get_bit(occupancies[both], dest_square))
-                    {
-                        //printf("%s-%s  Knight move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                        add_move(move_list, encode_move(source_square, dest_square, piece, 0, 0, 0, 0, 0));
-                    }
-                    // capture
-                    else
-                    {
-                        //printf("%sx%s  Knight capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                        add_move(move_list, encode_move(source_square, dest_square, piece, 0, 1, 0, 0, 0));
-                    }
-                    pop_bit(attacks, dest_square);
-                }
+    if (king_attacks[king_square] & bitboards[opponent + K]) return 0;
 
-                pop_bit(bitboard, source_square);
-            }
-        }
+    return 1;
+}
 
-        // generate bishop moves
+// perft hash table entry (key is stored XORed with data so threads can share entries without locks)
+typedef struct {
+    U64 key;
+    U64 data; // nodes << 8 | depth
+} perft_entry;
 
-        if((side == white) ? piece == B : piece == b)
-        {
-            while(bitboard)
-            {
-                source_square = get_ls1b_index(bitboard);
+// perft hash table (UCI "PerftHash" option in MB, 0 to disable)
+perft_entry *perft_table = NULL;
 
-                attacks = get_bishop_attacks(source_square, occupancies[both]) & ((side == white) ? ~occupancies[white] : ~occupancies[black]);
+// number of perft hash table entries
+U64 perft_entries = 0;
 
-                while(attacks)
-                {
-                    dest_square = get_ls1b_index(attacks);
+// default perft hash size in MB
+#define PERFT_HASH_MB 16
 
-                    // quiet move
-                    if(!get_bit(occupancies[both], dest_square))
-                    {
-                        //printf("%s-%s  Bishop move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                        add_move(move_list, encode_move(source_square, dest_square, piece, 0, 0, 0, 0, 0));
-                    }
-                    // capture
-                    else
-                    {
-                        //printf("%sx%s  Bishop capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                        add_move(move_list, encode_move(source_square, dest_square, piece, 0, 1, 0, 0, 0));
-                    }
-                    pop_bit(attacks, dest_square);
-                }
+// (re)allocate perft hash table
+void init_perft_table(int mb)
+{
+    free(perft_table);
 
-                pop_bit(bitboard, source_square);
-            }
-        }
+    perft_table = NULL;
+    perft_entries = 0;
 
-        // generate rook moves
+    if (mb <= 0)
+        return;
 
-        if((side == white) ? piece == R : piece == r)
-        {
-            while(bitboard)
-            {
-                source_square = get_ls1b_index(bitboard);
+    perft_entries = (U64)mb * 0x100000 / sizeof(perft_entry);
 
-                attacks = get_rook_attacks(source_square, occupancies[both]) & ((side == white) ? ~occupancies[white] : ~occupancies[black]);
+    perft_table = calloc(perft_entries, sizeof(perft_entry));
 
-                while(attacks)
-                {
-                    dest_square = get_ls1b_index(attacks);
+    if (perft_table == NULL)
+    {
+        printf("info string failed to allocate %d MB perft hash\n", mb);
+        perft_entries = 0;
+    }
+}
 
-                    // quiet move
-                    if(!get_bit(occupancies[both], dest_square))
-                    {
-                        //printf("%s-%s  Rook move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                        add_move(move_list, encode_move(source_square, dest_square, piece, 0, 0, 0, 0, 0));
-                    }
-                    // capture
-                    else
-                    {
-                        //printf("%sx%s  Rook capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                        add_move(move_list, encode_move(source_square, dest_square, piece, 0, 1, 0, 0, 0));
-                    }
-                    pop_bit(attacks, dest_square);
-                }
+// clear perft hash table (counts are position only so they stay valid, but keep runs independent)
+void clear_perft_table()
+{
+    if (perft_table)
+        memset(perft_table, 0, perft_entries * sizeof(perft_entry));
+}
 
-                pop_bit(bitboard, source_square);
-            }
-        }
+static inline U64 perft_driver(int depth)
+{
+    if (depth == 0)
+        return 1;
 
-        // generate queen moves
+    moves move_list[1];
 
-        if((side == white) ? piece == Q : piece == q)
-        {
-            while(bitboard)
-            {
-                source_square = get_ls1b_index(bitboard);
+    generate_moves(move_list);
 
-                attacks = get_queen_attacks(source_square, occupancies[both]) & ((side == white) ? ~occupancies[white] : ~occupancies[black]);
+    U64 leaf_nodes = 0;
 
-                while(attacks)
-                {
-                    dest_square = get_ls1b_index(attacks);
+    // bulk counting: the last ply only needs the number of legal moves
+    if (depth == 1)
+    {
+        for(int move_count = 0; move_count < move_list->count; move_count++)
+            leaf_nodes += is_move_legal(move_list->moves[move_count]);
 
-                    // quiet move
-                    if(!get_bit(occupancies[both], dest_square))
-                    {
-                        //printf("%s-%s  Queen move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                        add_move(move_list, encode_move(source_square, dest_square, piece, 0, 0, 0, 0, 0));
-                    }
-                    // capture
-                    else
-                    {
-                        //printf("%sx%s  Queen capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                        add_move(move_list, encode_move(source_square, dest_square, piece, 0, 1, 0, 0, 0));
-                    }
-                    pop_bit(attacks, dest_square);
-                }
+        return leaf_nodes;
+    }
 
-                pop_bit(bitboard, source_square);
-            }
-        }
+    perft_entry *entry = NULL;
 
-        // generate king moves
+    if (perft_entries)
+    {
+        entry = &perft_table[hash_key % perft_entries];
 
-        if((side == white) ? piece == K : piece == k)
-        {
-            while(bitboard)
-            {
-                source_square = get_ls1b_index(bitboard);
+        U64 data = entry->data;
 
-                attacks = king_attacks[source_square] & ((side == white) ? ~occupancies[white] : ~occupancies[black]);
+        // cached subtree count of this position at this depth
+        if ((entry->key ^ data) == hash_key && (int)(data & 0xff) == depth)
+            return data >> 8;
+    }
 
-                while(attacks)
-                {
-                    dest_square = get_ls1b_index(attacks);
+    for(int move_count = 0; move_count < move_list->count; move_count++)
+    {
+        int move = move_list->moves[move_count];
 
-                    // quiet move
-                    if(!get_bit(occupancies[both], dest_square))
-                    {
-                        //printf("%s-%s  King move\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                        add_move(move_list, encode_move(source_square, dest_square, piece, 0, 0, 0, 0, 0));
-                    }
-                    // capture
-                    else
-                    {
-                        //printf("%sx%s  King capture\n", square_to_coordinates[source_square], square_to_coordinates[dest_square]);
-                        add_move(move_list, encode_move(source_square, dest_square, piece, 0, 1, 0, 0, 0));
-                    }
-                    pop_bit(attacks, dest_square);
-                }
+        copy_board();
 
-                pop_bit(bitboard, source_square);
-            }
+        if(!make_move(move, all_moves))
+        {
+            //skip over illegal moves
+            continue;
         }
+
+        leaf_nodes += perft_driver(depth - 1);
+
+        take_back();
     }
-}
 
-/****************************************************************
- * 
- * 
- * 
- *                          PERFT TEST                                
- * 
- * 
- *
- * **************************************************************/
+    if (entry)
+    {
+        U64 data = (leaf_nodes << 8) | depth;
 
-int get_time_in_ms()
-{
-    #ifdef __MINGW32__
-        return GetTickCount();
-    #else
-        struct timeval time_value;
-        gettimeofday(&time_value, NULL);
-        return time_value.tv_sec * 1000 + time_value.tv_usec / 1000;
-    #endif
-}
+        entry->key = hash_key ^ data;
+        entry->data = data;
+    }
 
-long nodes = 0; // number of nodes traversed by perft
+    return leaf_nodes;
+}
 
-static inline void perft_driver(int depth)
+// work shared between perft threads (root moves are handed out one at a time)
+typedef struct {
+    board_state root;
+    moves root_moves;
+    U64 move_nodes[256];
+    int depth;
+    int next_move;
+} perft_job;
+
+void *perft_worker(void *arg)
 {
-    if (depth == 0)
-    {
-        nodes++;
-        return;
-    }
+    perft_job *job = (perft_job *)arg;
 
-    moves move_list[1];
+    // each thread walks the tree on its own copy of the root position
+    load_board_state(&job->root);
 
-    generate_moves(move_list);
+    int move_count;
 
-    for(int move_count = 0; move_count < move_list->count; move_count++)
+    while ((move_count = __sync_fetch_and_add(&job->next_move, 1)) < job->root_moves.count)
     {
-        int move = move_list->moves[move_count];
+        int move = job->root_moves.moves[move_count];
 
         copy_board();
 
-        if(!make_move(move, all_moves))
-        {
-            //skip over illegal moves
-            continue;
-        }
+        make_move(move, all_moves);
 
-        
-        perft_driver(depth - 1);
-        
+        job->move_nodes[move_count] = perft_driver(job->depth - 1);
 
         take_back();
     }
+
+    return NULL;
 }
 
-void perft_test(int depth)
+// count leaf nodes under each root move in parallel, returns total node count
+U64 perft_divide(int depth, perft_job *job)
 {
     moves move_list[1];
 
     generate_moves(move_list);
 
+    job->root_moves.count = 0;
+    job->depth = depth;
+    job->next_move = 0;
+
+    // keep legal root moves only
     for(int move_count = 0; move_count < move_list->count; move_count++)
     {
         int move = move_list->moves[move_count];
@@ -2028,990 +2235,8120 @@ void perft_test(int depth)
         copy_board();
 
         if(!make_move(move, all_moves))
-        {
-            //skip over illegal moves
             continue;
-        }
-
-        long old_nodes = nodes;
-        
-        perft_driver(depth - 1);
-
-        printf(" Move: ");
-        print_move(move);
 
-        printf("   Nodes: %ld\n", nodes - old_nodes); // prints the nodes traversed by the current move only
-        
         take_back();
+
+        add_move(&job->root_moves, move);
     }
-}
 
-/****************************************************************
- * 
- * 
- * 
- *                          EVALUATION                                
- * 
- * 
- *
- * **************************************************************/
+    store_board_state(&job->root);
 
-const int piece_values[12] = {
-    100,
-    300,
-    350,
-    500,
-    1000,
-    10000,
-    -100,
-    -300,
-    -350,
-    -500,
-    -1000,
-    -10000
-};
+    pthread_t workers[MAX_THREADS];
 
-// pawn positional score
-const int pawn_score[64] = 
-{
-    90,  90,  90,  90,  90,  90,  90,  90,
-    30,  30,  30,  40,  40,  30,  30,  30,
-    20,  20,  20,  30,  30,  30,  20,  20,
-    10,  10,  10,  20,  20,  10,  10,  10,
-     5,   5,  10,  20,  20,   5,   5,   5,
-     0,   0,   0,   5,   5,   0,   0,   0,
-     0,   0,   0, -10, -10,   0,   0,   0,
-     0,   0,   0,   0,   0,   0,   0,   0
-};
+    int worker_count = threads < job->root_moves.count ? threads : job->root_moves.count;
 
-// knight positional score
-const int knight_score[64] = 
-{
-    -10,   0,   0,   0,   0,   0,   0,  -10,
-    -5,    0,   0,  10,  10,   0,   0,   -5,
-    -5,    5,  20,  20,  20,  20,   5,   -5,
-    -5,   10,  20,  30,  30,  20,  10,   -5,
-    -5,   10,  20,  30,  30,  20,  10,   -5,
-    -5,    5,  20,  10,  10,  20,   5,   -5,
-    -5,    0,   0,   0,   0,   0,   0,   -5,
-    -10, -10,   0,   0,   0,   0, -10,  -10
-};
+    // the calling thread is a worker too
+    for (int index = 1; index < worker_count; index++)
+        pthread_create(&workers[index], NULL, perft_worker, job);
 
-// bishop positional score
-const int bishop_score[64] = 
-{
-     0,   0,   0,   0,   0,   0,   0,   0,
-     0,   0,   0,   0,   0,   0,   0,   0,
-     0,   0,   0,  10,  10,   0,   0,   0,
-     0,   0,  10,  20,  20,  10,   0,   0,
-     0,   0,  10,  20,  20,  10,   0,   0,
-     0,  10,   5,   0,   0,   5,  10,   0,
-     0,  30,   0,   0,   0,   0,  30,   0,
-     0,   0, -10,   0,   0, -10,   0,   0
+    perft_worker(job);
 
-};
+    for (int index = 1; index < worker_count; index++)
+        pthread_join(workers[index], NULL);
 
-// rook positional score
-const int rook_score[64] =
-{
-    50,  50,  50,  50,  50,  50,  50,  50,
-    50,  50,  50,  50,  50,  50,  50,  50,
-     0,   0,  10,  20,  20,  10,   0,   0,
-     0,   0,  10,  20,  20,  10,   0,   0,
-     0,   0,  10,  20,  20,  10,   0,   0,
-     0,   0,  10,  20,  20,  10,   0,   0,
-     0,   0,  10,  20,  20,  10,   0,   0,
-     0,   0,   5,  20,  20,   5,   0,   0
+    // workers leave the calling thread's board at the root position
+    load_board_state(&job->root);
 
-};
+    U64 total_nodes = 0;
 
-// king positional score
-const int king_score[64] = 
-{
-     0,   0,   0,   0,   0,   0,   0,   0,
-     0,   0,   5,   5,   5,   5,   0,   0,
-     0,   5,   5,  10,  10,   5,   5,   0,
-     0,   5,  10,  20,  20,  10,   5,   0,
-     0,   5,  10,  20,  20,  10,   5,   0,
-     0,   0,   5,  10,  10,   5,   0,   0,
-     0,   5,   5,  -5,  -5,   0,   5,   0,
-     0,   0,   8,   0, -15,   0,  10,   0
-};
+    for(int move_count = 0; move_count < job->root_moves.count; move_count++)
+        total_nodes += job->move_nodes[move_count];
 
-// mirror positional score tables for opposite side
-const int mirror_score[128] =
+    return total_nodes;
+}
+
+// UCI "go perft <depth>" command, prints nodes under every root move
+void perft_test(int depth)
 {
-    a1, b1, c1, d1, e1, f1, g1, h1,
-    a2, b2, c2, d2, e2, f2, g2, h2,
-    a3, b3, c3, d3, e3, f3, g3, h3,
-    a4, b4, c4, d4, e4, f4, g4, h4,
-    a5, b5, c5, d5, e5, f5, g5, h5,
-    a6, b6, c6, d6, e6, f6, g6, h6,
-    a7, b7, c7, d7, e7, f7, g7, h7,
-    a8, b8, c8, d8, e8, f8, g8, h8
-};
+    if (depth < 1)
+        depth = 1;
 
+    perft_job *job = malloc(sizeof(perft_job));
 
-static inline int evaluate()
-{
-    int score = 0;
+    clear_perft_table();
 
-    for(int bb_piece = P; bb_piece <= k; bb_piece++)
-    {
-        U64 bitboard = bitboards[bb_piece];
+    int start = get_time_ms();
 
-        while(bitboard)
-        {
+    U64 total_nodes = perft_divide(depth, job);
 
-            int square = get_ls1b_index(bitboard);
-            pop_bit(bitboard, square);
+    int time = get_time_ms() - start;
 
-            score += piece_values[bb_piece];
+    for(int move_count = 0; move_count < job->root_moves.count; move_count++)
+    {
+        printf(" Move: ");
+        print_move(job->root_moves.moves[move_count]);
 
-            switch(bb_piece)
-            {
-                // evaluate white pieces
-                case P: score += pawn_score[square]; break;
-                case N: score += knight_score[square]; break;
-                case B: score += bishop_score[square]; break;
-                case R: score += rook_score[square]; break;
-                case K: score += king_score[square]; break;
+        printf("   Nodes: %llu\n", job->move_nodes[move_count]); // prints the nodes traversed by the current move only
+    }
 
-                // evaluate black pieces
-                case p: score -= pawn_score[mirror_score[square]]; break;
-                case n: score -= knight_score[mirror_score[square]]; break;
-                case b: score -= bishop_score[mirror_score[square]]; break;
-                case r: score -= rook_score[mirror_score[square]]; break;
-                case k: score -= king_score[mirror_score[square]]; break;
-            }
+    printf("\n Depth: %d\n", depth);
+    printf(" Nodes: %llu\n", total_nodes);
+    printf(" Time: %d ms\n", time);
+    printf(" NPS: %llu\n\n", total_nodes * 1000 / (time ? time : 1));
+
+    free(job);
+}
+
+/*
+    Perft suite EPD format, one position per line:
+
+    <fen> ;D1 <nodes> ;D2 <nodes> ...
+
+    rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - ;D1 20 ;D2 400 ;D3 8902
+*/
+
+// run every position of an EPD perft suite up to max depth, returns number of failed tests
+int perft_suite(char *file_name, int max_depth)
+{
+    FILE *file = fopen(file_name, "r");
+
+    if (file == NULL)
+    {
+        printf("can't open perft suite %s\n", file_name);
+        return 1;
+    }
+
+    perft_job *job = malloc(sizeof(perft_job));
+
+    char line[1024];
+
+    int position_count = 0, passed = 0, failed = 0, skipped = 0;
+
+    U64 total_nodes = 0;
+
+    int total_time = 0;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        // skip comments and blank lines
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+            continue;
+
+        char *argument = strchr(line, ';');
+
+        if (argument == NULL)
+            continue;
+
+        position_count++;
+
+        // FEN ends where the first depth record begins
+        *argument = '\0';
+
+        printf(" Position %d: %s\n", position_count, line);
+
+        U64 position_nodes = 0;
+
+        int position_time = 0, position_tests = 0;
+
+        // loop over ";D<depth> <nodes>" records
+        for (argument++; argument; argument = strchr(argument, ';'))
+        {
+            if (*argument == ';')
+                argument++;
+
+            while (*argument == ' ')
+                argument++;
+
+            int depth = 0;
+
+            U64 expected = 0;
+
+            if (sscanf(argument, "D%d %llu", &depth, &expected) != 2)
+                continue;
+
+            if (depth < 1 || depth > max_depth)
+                continue;
+
+            parse_fen(line);
+
+            int start = get_time_ms();
+
+            U64 result = perft_divide(depth, job);
+
+            int time = get_time_ms() - start;
+
+            position_nodes += result;
+            position_time += time;
+            position_tests++;
+
+            if (result == expected)
+                passed++;
+            else
+                failed++;
+
+            printf("   Depth %d: %12llu %s", depth, result, (result == expected) ? "ok" : "FAILED");
+
+            if (result != expected)
+                printf(" (expected %llu)", expected);
+
+            printf("\n");
+        }
+
+        // nothing checked: only deeper records than the depth cap
+        if (position_tests == 0)
+        {
+            skipped++;
+            printf("   skipped (no record up to depth %d)\n\n", max_depth);
+            continue;
         }
 
+        printf("   Nodes: %llu  Time: %d ms  NPS: %llu\n\n", position_nodes, position_time,
+               position_nodes * 1000 / (position_time ? position_time : 1));
+
+        total_nodes += position_nodes;
+        total_time += position_time;
     }
 
-    return (side == white ? score : -score);
+    fclose(file);
+
+    free(job);
+
+    printf(" Positions: %d (%d skipped)\n", position_count, skipped);
+    printf(" Checks: %d passed, %d failed\n", passed, failed);
+    printf(" Nodes: %llu  Time: %d ms  NPS: %llu\n", total_nodes, total_time,
+           total_nodes * 1000 / (total_time ? total_time : 1));
+
+    return failed;
 }
 
 /****************************************************************
  * 
  * 
  * 
- *                          SEARCH                                
+ *                          EVALUATION                                
  * 
  * 
  *
  * **************************************************************/
 
-// most valuable victim & less valuable attacker
-
 /*
-                          
-    (Victims) Pawn Knight Bishop   Rook  Queen   King
-  (Attackers)
-        Pawn   105    205    305    405    505    605
-      Knight   104    204    304    404    504    604
-      Bishop   103    203    303    403    503    603
-        Rook   102    202    302    402    502    602
-       Queen   101    201    301    401    501    601
-        King   100    200    300    400    500    600
+    Evaluation parameters
+
+    All weights live in one contiguous block read by evaluate(). The default
+    build can replace it at runtime from a parameter file ("setoption name
+    EvalFile value <path>") or entry by entry ("setoption name EvalParam
+    value <name> <index> <value>"); "make constant" builds it as a constant
+    block for maximum speed.
+
+    parameter file: a name selects an array, the numbers after it fill the
+    array from the start. Text in brackets, "//" comments and other
+    punctuation are ignored, so the initializer below (or the output of
+    "Jabberook tune") can be loaded as it is. Values for black pieces follow
+    the white ones.
 */
 
-// MVV LVA [attacker][victim]
-static int mvv_lva[12][12] = {
-    105, 205, 305, 405, 505, 605,  105, 205, 305, 405, 505, 605,
-    104, 204, 304, 404, 504, 604,  104, 204, 304, 404, 504, 604,
-    103, 203, 303, 403, 503, 603,  103, 203, 303, 403, 503, 603,
-    102, 202, 302, 402, 502, 602,  102, 202, 302, 402, 502, 602,
-    101, 201, 301, 401, 501, 601,  101, 201, 301, 401, 501, 601,
-    100, 200, 300, 400, 500, 600,  100, 200, 300, 400, 500, 600,
+typedef struct {
+    int piece_values[12];
+    int pawn_score[64];
+    int knight_score[64];
+    int bishop_score[64];
+    int rook_score[64];
+    int king_score[64];
+} eval_parameters;
+
+#ifdef CONSTANT_EVAL
+    #define EVAL_CONST const
+#else
+    #define EVAL_CONST
+#endif
 
-    105, 205, 305, 405, 505, 605,  105, 205, 305, 405, 505, 605,
-    104, 204, 304, 404, 504, 604,  104, 204, 304, 404, 504, 604,
-    103, 203, 303, 403, 503, 603,  103, 203, 303, 403, 503, 603,
-    102, 202, 302, 402, 502, 602,  102, 202, 302, 402, 502, 602,
-    101, 201, 301, 401, 501, 601,  101, 201, 301, 401, 501, 601,
-    100, 200, 300, 400, 500, 600,  100, 200, 300, 400, 500, 600
+EVAL_CONST eval_parameters eval_params = {
+
+    .piece_values = {
+        100, 300, 350, 500, 1000, 10000,
+        -100, -300, -350, -500, -1000, -10000
+    },
+
+    // pawn positional score
+    .pawn_score = {
+        90,  90,  90,  90,  90,  90,  90,  90,
+        30,  30,  30,  40,  40,  30,  30,  30,
+        20,  20,  20,  30,  30,  30,  20,  20,
+        10,  10,  10,  20,  20,  10,  10,  10,
+         5,   5,  10,  20,  20,   5,   5,   5,
+         0,   0,   0,   5,   5,   0,   0,   0,
+         0,   0,   0, -10, -10,   0,   0,   0,
+         0,   0,   0,   0,   0,   0,   0,   0
+    },
+
+    // knight positional score
+    .knight_score = {
+        -10,   0,   0,   0,   0,   0,   0,  -10,
+        -5,    0,   0,  10,  10,   0,   0,   -5,
+        -5,    5,  20,  20,  20,  20,   5,   -5,
+        -5,   10,  20,  30,  30,  20,  10,   -5,
+        -5,   10,  20,  30,  30,  20,  10,   -5,
+        -5,    5,  20,  10,  10,  20,   5,   -5,
+        -5,    0,   0,   0,   0,   0,   0,   -5,
+        -10, -10,   0,   0,   0,   0, -10,  -10
+    },
+
+    // bishop positional score
+    .bishop_score = {
+         0,   0,   0,   0,   0,   0,   0,   0,
+         0,   0,   0,   0,   0,   0,   0,   0,
+         0,   0,   0,  10,  10,   0,   0,   0,
+         0,   0,  10,  20,  20,  10,   0,   0,
+         0,   0,  10,  20,  20,  10,   0,   0,
+         0,  10,   5,   0,   0,   5,  10,   0,
+         0,  30,   0,   0,   0,   0,  30,   0,
+         0,   0, -10,   0,   0, -10,   0,   0
+    },
+
+    // rook positional score
+    .rook_score = {
+        50,  50,  50,  50,  50,  50,  50,  50,
+        50,  50,  50,  50,  50,  50,  50,  50,
+         0,   0,  10,  20,  20,  10,   0,   0,
+         0,   0,  10,  20,  20,  10,   0,   0,
+         0,   0,  10,  20,  20,  10,   0,   0,
+         0,   0,  10,  20,  20,  10,   0,   0,
+         0,   0,  10,  20,  20,  10,   0,   0,
+         0,   0,   5,  20,  20,   5,   0,   0
+    },
+
+    // king positional score
+    .king_score = {
+         0,   0,   0,   0,   0,   0,   0,   0,
+         0,   0,   5,   5,   5,   5,   0,   0,
+         0,   5,   5,  10,  10,   5,   5,   0,
+         0,   5,  10,  20,  20,  10,   5,   0,
+         0,   5,  10,  20,  20,  10,   5,   0,
+         0,   0,   5,  10,  10,   5,   0,   0,
+         0,   5,   5,  -5,  -5,   0,   5,   0,
+         0,   0,   8,   0, -15,   0,  10,   0
+    }
 };
 
-#define MAX_PLY 64
+// parameter arrays by name (parameter files, EvalParam and tuning)
+typedef struct {
+    const char *name;
+    EVAL_CONST int *values;
+    int size;
+} eval_entry;
+
+const eval_entry eval_entries[] = {
+    { "piece_values", eval_params.piece_values, 12 },
+    { "pawn_score", eval_params.pawn_score, 64 },
+    { "knight_score", eval_params.knight_score, 64 },
+    { "bishop_score", eval_params.bishop_score, 64 },
+    { "rook_score", eval_params.rook_score, 64 },
+    { "king_score", eval_params.king_score, 64 }
+};
 
-//killer move indexed by [id][ply]
-int killer_moves[2][MAX_PLY];
+#define EVAL_ENTRIES (int)(sizeof(eval_entries) / sizeof(eval_entries[0]))
 
-//history move indexed by [piece][square]
-int history_moves[12][64];
+// look up parameter array by name
+const eval_entry *find_eval_entry(const char *name, int length)
+{
+    for (int index = 0; index < EVAL_ENTRIES; index++)
+        if ((int)strlen(eval_entries[index].name) == length && strncmp(eval_entries[index].name, name, length) == 0)
+            return &eval_entries[index];
 
-//score PV flags
-int follow_pv, score_pv;
+    return NULL;
+}
 
-/*
-      ================================
-            Triangular PV table
-      --------------------------------
-        PV line: e2e4 e7e5 g1f3 b8c6
-      ================================
-           0    1    2    3    4    5
-      
-      0    m1   m2   m3   m4   m5   m6
-      
-      1    0    m2   m3   m4   m5   m6 
-      
-      2    0    0    m3   m4   m5   m6
-      
-      3    0    0    0    m4   m5   m6
-       
-      4    0    0    0    0    m5   m6
-      
-      5    0    0    0    0    0    m6
-*/
+#ifndef CONSTANT_EVAL
 
-// PV length
-int pv_length[MAX_PLY];
+// load parameter file, returns number of values read (0 and parameters untouched on error)
+int load_eval_params(char *file_name)
+{
+    FILE *file = fopen(file_name, "rb");
 
-// PV table
-int pv_table[MAX_PLY][MAX_PLY];
+    if (file == NULL)
+        return 0;
 
-//half move counter
-int ply;
+    // whole file as one string
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
 
-static inline void enable_PV_scoring(moves *move_list)
-{
-    follow_pv = 0;
+    char *text = (size >= 0) ? malloc(size + 1) : NULL;
 
-    for(int i = 0; i < move_list->count; i++)
+    if (text == NULL || fread(text, 1, size, file) != (size_t)size)
     {
-        if(move_list->moves[i] == pv_table[0][ply])
-        {
-            follow_pv = 1;
-
-            score_pv = 1;
-        }
+        free(text);
+        fclose(file);
+        return 0;
     }
-}
 
-static inline int score_move(int move)
-{
-    if(score_pv)
+    text[size] = '\0';
+    fclose(file);
+
+    // keep the old values if anything is wrong
+    eval_parameters previous = eval_params;
+
+    const eval_entry *entry = NULL;
+    int filled = 0, values = 0, error = 0;
+
+    char *current = text;
+
+    while (*current && !error)
     {
-        if(pv_table[0][ply] == move)
+        // comment
+        if (current[0] == '/' && current[1] == '/')
+            current += strcspn(current, "\n");
+
+        // array size or index
+        else if (*current == '[')
+            current += strcspn(current, "]");
+
+        // name
+        else if (isalpha(*current) || *current == '_')
         {
-            score_pv = 0;
+            int length = 0;
 
-            return 20000;
-        }
-    }
+            while (isalnum(current[length]) || current[length] == '_')
+                length++;
 
-    if(get_move_capture(move))
-    {
-        int target_piece = P; //initial value takes care of en passant
+            const eval_entry *found = find_eval_entry(current, length);
 
-        int start_piece = side == white ? p : P;
-        int end_piece = side == white ? k : K;
+            // other words (const, int, ...) keep the current array
+            if (found)
+            {
+                entry = found;
+                filled = 0;
+            }
 
-        for(int bb_piece = start_piece; bb_piece <= end_piece; bb_piece++)
+            current += length - 1;
+        }
+
+        // value of the current array
+        else if (isdigit(*current) || (*current == '-' && isdigit(current[1])))
         {
-            if(get_bit(bitboards[bb_piece], get_move_dest(move)))
+            char *end;
+            long value = strtol(current, &end, 10);
+
+            if (entry == NULL || filled == entry->size)
+                error = 1;
+
+            else
             {
-                target_piece = bb_piece;
-                break;
+                entry->values[filled++] = value;
+                values++;
             }
+
+            current = end - 1;
         }
 
-        return mvv_lva[get_move_piece(move)][target_piece] + 10000;
+        if (*current)
+            current++;
     }
 
-    else {
-        if(killer_moves[0][ply] == move)
-            return 9000;
-        else if(killer_moves[1][ply] == move)
-            return 8000;
-        else
-            return history_moves[get_move_piece(move)][get_move_dest(move)];
+    free(text);
+
+    if (error)
+    {
+        eval_params = previous;
         return 0;
     }
+
+    // black values mirror the white ones
+    for (int piece = P; piece <= K; piece++)
+        eval_params.piece_values[piece + 6] = -eval_params.piece_values[piece];
+
+    return values;
 }
 
-void print_move_scores(moves* move_list)
+// set one value ("pawn_score 8 30"), returns 0 if unknown
+int set_eval_param(char *setting)
 {
-    for(int i = 0; i < move_list->count; i++)
-    {
-        print_move(move_list->moves[i]);
-        int score = score_move(move_list->moves[i]);
-        printf("   Score : %d\n", score);
-    }
+    char name[64];
+    int index, value;
+
+    if (sscanf(setting, "%63s %d %d", name, &index, &value) != 3)
+        return 0;
+
+    const eval_entry *entry = find_eval_entry(name, strlen(name));
+
+    if (entry == NULL || index < 0 || index >= entry->size)
+        return 0;
+
+    entry->values[index] = value;
+
+    // black values mirror the white ones
+    if (entry->values == eval_params.piece_values)
+        eval_params.piece_values[(index + 6) % 12] = -value;
+
+    return 1;
 }
 
-static inline void sort_moves(moves* move_list) //descending
+#endif
+
+// mirror positional score tables for opposite side
+const int mirror_score[128] =
 {
-    int move_scores[move_list->count];
-    for (int count = 0; count < move_list->count; count++)
-        move_scores[count] = score_move(move_list->moves[count]);
-    
-    //simple bubble sort
-    for (int current_move = 0; current_move < move_list->count; current_move++)
-    {
-        for (int next_move = current_move + 1; next_move < move_list->count; next_move++)
-        {
-            if (move_scores[current_move] < move_scores[next_move])
-            {
-                int temp_score = move_scores[current_move];
-                move_scores[current_move] = move_scores[next_move];
-                move_scores[next_move] = temp_score;
-                
-                int temp_move = move_list->moves[current_move];
-                move_list->moves[current_move] = move_list->moves[next_move];
-                move_list->moves[next_move] = temp_move;
-            }
-        }
-    }
+    a1, b1, c1, d1, e1, f1, g1, h1,
+    a2, b2, c2, d2, e2, f2, g2, h2,
+    a3, b3, c3, d3, e3, f3, g3, h3,
+    a4, b4, c4, d4, e4, f4, g4, h4,
+    a5, b5, c5, d5, e5, f5, g5, h5,
+    a6, b6, c6, d6, e6, f6, g6, h6,
+    a7, b7, c7, d7, e7, f7, g7, h7,
+    a8, b8, c8, d8, e8, f8, g8, h8
+};
+
+
+/*
+    Endgame knowledge
+
+    KPK is looked up in a win / draw bitbase built by retrograde analysis at
+    startup. KRK, KQK and KBNK get mating evaluations that drive the lone king
+    to the edge (or the bishop's corner) and bring the kings together. The
+    evaluators are picked by material signature.
+*/
+
+// score for a known won endgame (well below mate scores)
+#define KNOWN_WIN 1000
+
+// KPK positions: side to move x white king x black king x 24 pawn squares (files a-d, ranks 2-7)
+#define KPK_SIZE (2 * 64 * 64 * 24)
+
+// KPK win bits (white has the pawn)
+U64 kpk_bitbase[KPK_SIZE / 64];
+
+// KPK position classes during generation
+enum { KPK_INVALID = 0, KPK_UNKNOWN = 1, KPK_DRAW = 2, KPK_WIN = 4 };
+
+// KPK index, pawn on files a-d
+static inline int kpk_index(int stm, int white_king, int black_king, int pawn)
+{
+    return stm | black_king << 1 | white_king << 7 | ((pawn % 8) * 6 + pawn / 8 - 1) << 13;
 }
 
-static inline int quiescence(int alpha, int beta)
+// classify position before any search
+int kpk_initial(int stm, int white_king, int black_king, int pawn)
 {
-    // every 2047 nodes
-    if((nodes & 2047 ) == 0)
-        // "listen" to the GUI/user input
-        communicate();
+    U64 pawn_attack = pawn_attacks[white][pawn];
 
-    nodes++;
-    int eval = evaluate();
+    // kings touching, pieces on one square or black king in check with white to move
+    if (king_attacks[white_king] & (1ULL << black_king) || white_king == black_king ||
+        white_king == pawn || black_king == pawn || (stm == white && (pawn_attack & (1ULL << black_king))))
+        return KPK_INVALID;
 
-    // fail-hard cutoff
-    if (eval >= beta)
+    // pawn on the 7th promotes safely
+    if (stm == white && pawn / 8 == 1)
     {
-        // node fails high
-        return beta;
+        int queen_square = pawn - 8;
+
+        if (queen_square != white_king && queen_square != black_king &&
+            (!(king_attacks[black_king] & (1ULL << queen_square)) || (king_attacks[white_king] & (1ULL << queen_square))))
+            return KPK_WIN;
     }
 
-    // found a better move than before
-    if (eval > alpha)
+    if (stm == black)
     {
-        alpha = eval;
-    } 
+        // stalemate
+        if (!(king_attacks[black_king] & ~(king_attacks[white_king] | pawn_attack)))
+            return KPK_DRAW;
 
-    moves move_list[1];
+        // black takes undefended pawn
+        if (king_attacks[black_king] & ~king_attacks[white_king] & (1ULL << pawn))
+            return KPK_DRAW;
+    }
 
-    generate_moves(move_list);
+    return KPK_UNKNOWN;
+}
 
-    sort_moves(move_list);
+// classify position from its successors
+int kpk_classify(unsigned char *db, int stm, int white_king, int black_king, int pawn)
+{
+    int result = KPK_INVALID;
 
-    for(int move_count = 0; move_count < move_list->count; move_count++)
+    if (stm == white)
     {
-        int move = move_list->moves[move_count];
-        
-        copy_board();
+        U64 targets = king_attacks[white_king];
 
-        ply++;
-
-        if(!make_move(move, captures_only))
+        while (targets)
         {
-            ply--;
-            continue;
+            int square = __builtin_ctzll(targets);
+            pop_bit(targets, square);
+
+            result |= db[kpk_index(black, square, black_king, pawn)];
         }
 
-        int score = -quiescence(-beta, -alpha);
+        // single push (promotions are settled by the initial classification)
+        if (pawn / 8 > 1)
+            result |= db[kpk_index(black, white_king, black_king, pawn - 8)];
 
-        ply--;
+        // double push
+        if (pawn / 8 == 6 && pawn - 8 != white_king && pawn - 8 != black_king)
+            result |= db[kpk_index(black, white_king, black_king, pawn - 16)];
 
-        take_back();
+        return (result & KPK_WIN) ? KPK_WIN : (result & KPK_UNKNOWN) ? KPK_UNKNOWN : KPK_DRAW;
+    }
 
-        // return 0 if time is up
-        if(stopped == 1) return 0;
+    U64 targets = king_attacks[black_king];
 
-        // fail-hard cutoff
-        if (score >= beta)
+    while (targets)
+    {
+        int square = __builtin_ctzll(targets);
+        pop_bit(targets, square);
+
+        result |= db[kpk_index(white, white_king, square, pawn)];
+    }
+
+    return (result & KPK_DRAW) ? KPK_DRAW : (result & KPK_UNKNOWN) ? KPK_UNKNOWN : KPK_WIN;
+}
+
+// build KPK bitbase
+void init_kpk_bitbase()
+{
+    unsigned char *db = malloc(KPK_SIZE);
+
+    // positions still to be decided
+    int *unknown = malloc(KPK_SIZE * sizeof(int));
+    int unknown_count = 0;
+
+    for (int index = 0; index < KPK_SIZE; index++)
+    {
+        // pawn files a-d, ranks 2-7 (BBC square order, so rows 1-6)
+        int pawn = ((index >> 13) % 6 + 1) * 8 + (index >> 13) / 6;
+
+        db[index] = kpk_initial(index & 1, (index >> 7) & 63, (index >> 1) & 63, pawn);
+
+        if (db[index] == KPK_UNKNOWN)
+            unknown[unknown_count++] = index;
+    }
+
+    // propagate wins and draws until nothing changes
+    int previous_count = 0;
+
+    while (unknown_count != previous_count)
+    {
+        previous_count = unknown_count;
+        unknown_count = 0;
+
+        for (int entry = 0; entry < previous_count; entry++)
         {
-            // node fails high
-            return beta;
+            int index = unknown[entry];
+            int pawn = ((index >> 13) % 6 + 1) * 8 + (index >> 13) / 6;
+
+            db[index] = kpk_classify(db, index & 1, (index >> 7) & 63, (index >> 1) & 63, pawn);
+
+            if (db[index] == KPK_UNKNOWN)
+                unknown[unknown_count++] = index;
         }
+    }
 
-        // found a better move than before
-        if (score > alpha)
-        {
-            alpha = score;
-        }       
+    // keep win bits only, whatever is still unknown is a draw
+    memset(kpk_bitbase, 0, sizeof(kpk_bitbase));
+
+    for (int index = 0; index < KPK_SIZE; index++)
+    {
+        if (db[index] == KPK_WIN)
+            kpk_bitbase[index / 64] |= 1ULL << (index % 64);
     }
 
-    return alpha;
+    free(unknown);
+    free(db);
 }
 
+// 1 if the side with the pawn wins
+static inline int kpk_probe(int stm, int strong_king, int weak_king, int pawn, int strong_side)
+{
+    // black pawn: flip the board so white has it
+    if (strong_side == black)
+    {
+        strong_king ^= 56;
+        weak_king ^= 56;
+        pawn ^= 56;
+        stm ^= 1;
+    }
+
+    // pawn on files e-h: mirror to a-d
+    if (pawn % 8 > 3)
+    {
+        strong_king ^= 7;
+        weak_king ^= 7;
+        pawn ^= 7;
+    }
 
-const int full_depth_moves = 4;
-const int reduction_limit = 3;
+    int index = kpk_index(stm, strong_king, weak_king, pawn);
 
-static inline int negamax(int depth, int alpha, int beta)
+    return (kpk_bitbase[index / 64] >> (index % 64)) & 1;
+}
+
+// Chebyshev distance between squares
+static inline int square_distance(int square_1, int square_2)
 {
-    // every 2047 nodes
-    if((nodes & 2047 ) == 0)
-        // "listen" to the GUI/user input
-        communicate();
+    int file_distance = abs(square_1 % 8 - square_2 % 8);
+    int rank_distance = abs(square_1 / 8 - square_2 / 8);
 
-    pv_length[ply] = ply;
+    return (file_distance > rank_distance) ? file_distance : rank_distance;
+}
 
-    if (depth == 0)
-        return quiescence(alpha, beta);
-        //return evaluate();
+// bonus for driving a king to the edge
+static inline int push_to_edge(int square)
+{
+    int file = square % 8, rank = square / 8;
 
-    if(depth > MAX_PLY - 1)
-        return evaluate();
-    
-    nodes++;
+    int file_edge = (file < 7 - file) ? file : 7 - file;
+    int rank_edge = (rank < 7 - rank) ? rank : 7 - rank;
 
-    int is_check = is_square_attacked(get_ls1b_index((side == white ? bitboards[K]
-                                                                    : bitboards[k])),
-                                                                    side ^ 1);
+    return 30 * (3 - ((file_edge < rank_edge) ? file_edge : rank_edge));
+}
 
-    if(is_check) depth++;
+// bonus for bringing the kings together
+static inline int push_close(int square_1, int square_2)
+{
+    return 20 * (7 - square_distance(square_1, square_2));
+}
 
-    int legal_moves = 0;
+// material signature: 4 bits of piece count per piece type
+#define MATERIAL(piece, count) ((U64)(count) << (4 * (piece)))
 
-    // Null Move Pruning
-    if(depth >= 3 && is_check == 0 && ply)
-    {
-        copy_board();
+// signatures with a white strong side (black ones are shifted by 24 bits)
+#define KPK_MATERIAL (MATERIAL(K, 1) | MATERIAL(k, 1) | MATERIAL(P, 1))
+#define KRK_MATERIAL (MATERIAL(K, 1) | MATERIAL(k, 1) | MATERIAL(R, 1))
+#define KQK_MATERIAL (MATERIAL(K, 1) | MATERIAL(k, 1) | MATERIAL(Q, 1))
+#define KBNK_MATERIAL (MATERIAL(K, 1) | MATERIAL(k, 1) | MATERIAL(B, 1) | MATERIAL(N, 1))
 
-        side ^= 1;
+// swap colors of a signature
+#define FLIP_MATERIAL(material) ((((material) & 0xffffff) << 24) | ((material) >> 24))
 
-        enpassant = no_sq;
+// score of a known endgame from white's point of view, returns 0 if the material has no evaluator
+static inline int evaluate_endgame(int *score)
+{
+    // cheap rejection of everything bigger than 4 pieces
+    if (__builtin_popcountll(occupancies[both]) > 4)
+        return 0;
 
-        int score = -negamax(depth - 1 - 2, -beta, -beta + 1);
- 
-        take_back();
+    U64 material = 0ULL;
 
-        if(score >= beta)
-            return beta;
+    for (int piece = P; piece <= k; piece++)
+        material |= MATERIAL(piece, count_bits(bitboards[piece]));
+
+    int strong_side;
+
+    if (material == KPK_MATERIAL || material == KRK_MATERIAL ||
+        material == KQK_MATERIAL || material == KBNK_MATERIAL)
+        strong_side = white;
+
+    else if (material == FLIP_MATERIAL(KPK_MATERIAL) || material == FLIP_MATERIAL(KRK_MATERIAL) ||
+             material == FLIP_MATERIAL(KQK_MATERIAL) || material == FLIP_MATERIAL(KBNK_MATERIAL))
+    {
+        strong_side = black;
+        material = FLIP_MATERIAL(material);
     }
 
-    moves move_list[1];
+    else
+        return 0;
 
-    generate_moves(move_list);
+    int strong_king = get_ls1b_index(bitboards[strong_side == white ? K : k]);
+    int weak_king = get_ls1b_index(bitboards[strong_side == white ? k : K]);
 
-    // make sure PV gets scored in sorting
-    if(follow_pv)
-        enable_PV_scoring(move_list);
+    int result;
 
-    sort_moves(move_list);
+    // win / draw from the bitbase, more for an advanced pawn
+    if (material == KPK_MATERIAL)
+    {
+        int pawn = get_ls1b_index(bitboards[strong_side == white ? P : p]);
 
-    int moves_searched = 0;
+        if (!kpk_probe(side, strong_king, weak_king, pawn, strong_side))
+            result = 0;
+        else
+            result = KNOWN_WIN + eval_params.piece_values[P] + 10 * ((strong_side == white) ? 7 - pawn / 8 : pawn / 8);
+    }
 
-    for(int move_count = 0; move_count < move_list->count; move_count++)
+    // mate with bishop and knight: corner of the bishop's color
+    else if (material == KBNK_MATERIAL)
     {
-        int move = move_list->moves[move_count];
-        
-        copy_board();
+        int bishop = get_ls1b_index(bitboards[strong_side == white ? B : b]);
 
-        ply++;
+        // a8 and h1 are light squares
+        int corner_1 = ((bishop / 8 + bishop % 8) & 1) ? h8 : a8;
+        int corner_2 = ((bishop / 8 + bishop % 8) & 1) ? a1 : h1;
 
-        if(!make_move(move, all_moves))
-        {
-            ply--;
-            continue;
-        }
+        int corner_distance = square_distance(weak_king, corner_1);
 
-        legal_moves++;
+        if (square_distance(weak_king, corner_2) < corner_distance)
+            corner_distance = square_distance(weak_king, corner_2);
 
-        int score;
+        result = KNOWN_WIN + eval_params.piece_values[B] + eval_params.piece_values[N] + 40 * (7 - corner_distance) +
+                 push_close(strong_king, weak_king);
+    }
 
-        // PVS Search with Late Move Reduction
-        
-        if(moves_searched == 0)
-        {
-            score = -negamax(depth-1, -beta, -alpha);
-        }
+    // mate with a major piece: drive the king to the edge
+    else
+        result = KNOWN_WIN + eval_params.piece_values[(material == KQK_MATERIAL) ? Q : R] +
+                 push_to_edge(weak_king) + push_close(strong_king, weak_king);
 
-        else
+    *score = (strong_side == white) ? result : -result;
+
+    return 1;
+}
+
+
+static inline int evaluate()
+{
+    int score = 0;
+
+    // known endgames
+    if (evaluate_endgame(&score))
+        return (side == white ? score : -score);
+
+    for(int bb_piece = P; bb_piece <= k; bb_piece++)
+    {
+        U64 bitboard = bitboards[bb_piece];
+
+        while(bitboard)
         {
-            if(moves_searched >= full_depth_moves && depth >= reduction_limit && is_check == 0
-                && get_move_capture(move) == 0 && get_move_promoted(move) == 0) 
-            {
-                score = -negamax(depth-2, -alpha-1, -alpha); // LMR
-            }
-            else
-            {
-                score = alpha + 1;
-            }
 
-            if(score > alpha) //  PVS runs for captures, checks, promotions, first few moves and low depth searches
+            int square = get_ls1b_index(bitboard);
+            pop_bit(bitboard, square);
+
+            score += eval_params.piece_values[bb_piece];
+
+            switch(bb_piece)
             {
-                score = -negamax(depth-1, -alpha-1, -alpha);
+                // evaluate white pieces
+                case P: score += eval_params.pawn_score[square]; break;
+                case N: score += eval_params.knight_score[square]; break;
+                case B: score += eval_params.bishop_score[square]; break;
+                case R: score += eval_params.rook_score[square]; break;
+                case K: score += eval_params.king_score[square]; break;
 
-                if(score > alpha && score < beta)
-                {
-                    score = -negamax(depth-1, -beta, -alpha);
-                }
+                // evaluate black pieces
+                case p: score -= eval_params.pawn_score[mirror_score[square]]; break;
+                case n: score -= eval_params.knight_score[mirror_score[square]]; break;
+                case b: score -= eval_params.bishop_score[mirror_score[square]]; break;
+                case r: score -= eval_params.rook_score[mirror_score[square]]; break;
+                case k: score -= eval_params.king_score[mirror_score[square]]; break;
             }
         }
-        
-        ply--;
 
-        take_back();
+    }
 
-        // return 0 if time is up
-        if(stopped == 1) return 0;
+    return (side == white ? score : -score);
+}
 
-        moves_searched++;
+/****************************************************************
+ *
+ *
+ *
+ *                          TABLEBASES
+ *
+ *
+ *
+ * **************************************************************/
 
-        // fail-hard cutoff
-        if (score >= beta)
+/*
+    Retrograde DTM tablebases for 3 and 4 piece endings
+
+    A table holds one byte per position: 0 draw (or illegal position), 1-127
+    win in that many plies, 128 + n loss in n plies (128 = checkmated).
+    Positions are indexed by the white king on a canonical square (the a1-d1-d4
+    triangle without pawns, files a-d with pawns), the squares of the other
+    pieces and the side to move. Castling and en passant are ignored.
+
+    Generation works backwards from the mates: at ply n every position with a
+    move into a loss in n - 1 is a win in n, and a position is lost once all
+    of its moves lead into wins for the opponent. Captures and promotions leave
+    the table and are looked up in the smaller tables generated before.
+
+    file layout: tb_header followed by one byte per entry, named after the
+    material (e.g. "KQvKR.jbt")
+*/
+
+// biggest supported material
+#define TB_MAX_PIECES 4
+
+// tables kept at once
+#define TB_MAX_TABLES 64
+
+// longest distance to mate that fits in a table byte
+#define TB_MAX_DTM 126
+
+// table file header
+typedef struct {
+    char magic[4];                  // "JBTB"
+    int version;
+    U64 material;                   // MATERIAL() signature
+    int count;                      // number of pieces
+    int pieces[TB_MAX_PIECES];      // piece in every slot: white king, white pieces, black king, black pieces
+    U64 entries;
+} tb_header;
+
+// loaded or generated table
+typedef struct {
+    tb_header header;
+    unsigned char *data;            // one byte per entry
+    unsigned char *mapping;         // mapped file (NULL for generated tables)
+    size_t mapping_size;
+    int pawns;                      // only left-right symmetry with pawns
+} tb_table;
+
+// all tables
+tb_table tb_tables[TB_MAX_TABLES];
+
+// number of tables
+int tb_count = 0;
+
+// most pieces covered by a table (0 = no tables)
+int tb_pieces = 0;
+
+// canonical white king squares [pawns][square] and their index
+int tb_king_index[2][64];
+int tb_king_list[2][64];
+int tb_king_squares[2];
+
+// table byte decoding
+#define TB_DRAW 0
+#define TB_IS_LOSS(value) ((value) >= 128)
+#define TB_DISTANCE(value) ((value) & 127)
+
+// canonical white king squares for both symmetries
+void init_tablebases()
+{
+    for (int pawns = 0; pawns < 2; pawns++)
+    {
+        tb_king_squares[pawns] = 0;
+
+        for (int square = 0; square < 64; square++)
         {
-            if(!get_move_capture(move))
+            int file = square % 8, rank = 7 - square / 8;
+
+            // a1-d1-d4 triangle without pawns, files a-d with pawns
+            if (file <= 3 && (pawns || rank <= file))
             {
-                killer_moves[1][ply] = killer_moves[0][ply];
-                killer_moves[0][ply] = move;
+                tb_king_list[pawns][tb_king_squares[pawns]] = square;
+                tb_king_index[pawns][square] = tb_king_squares[pawns]++;
             }
-            // node fails high
-            return beta;
+            else
+                tb_king_index[pawns][square] = -1;
         }
+    }
+}
 
-        // found a better move than before
-        if (score > alpha)
-        {
-            if(!get_move_capture(move))
-                history_moves[get_move_piece(move)][get_move_dest(move)] += depth;
-            alpha = score;
+// apply one of the 8 board symmetries (only 0 and 1 keep pawns moving the right way)
+static inline int tb_transform(int square, int transform)
+{
+    if (transform & 4) square = (square % 8) * 8 + square / 8;
+    if (transform & 1) square ^= 7;
+    if (transform & 2) square ^= 56;
 
-            pv_table[ply][ply] = move;
+    return square;
+}
 
-            for(int next_ply = ply + 1; next_ply < pv_length[ply+1]; next_ply++)
-                pv_table[ply][next_ply] = pv_table[ply+1][next_ply];
+// index of a position with the white king on a canonical square
+static inline U64 tb_index(tb_table *table, int *squares, int stm)
+{
+    U64 index = tb_king_index[table->pawns][squares[0]];
 
-            pv_length[ply] = pv_length[ply+1];
+    for (int slot = 1; slot < table->header.count; slot++)
+        index = index * 64 + squares[slot];
 
-        }       
-    }
+    return index * 2 + stm;
+}
 
-    if(legal_moves == 0)
+// squares and side to move of an index
+static inline void tb_decode(tb_table *table, U64 index, int *squares, int *stm)
+{
+    *stm = index & 1;
+    index >>= 1;
+
+    for (int slot = table->header.count - 1; slot > 0; slot--)
     {
-        if(is_check) // checkmate
-            return -49000 + ply;
-        else         // stalemate
-            return 0;
+        squares[slot] = index % 64;
+        index /= 64;
     }
 
-    // node fails low
-    return alpha;
+    squares[0] = tb_king_list[table->pawns][index];
 }
 
-void search_position(int depth)
+// table for a material signature
+tb_table *tb_find(U64 material)
 {
-    // reset data from a previous search
-    nodes = 0;
+    for (int index = 0; index < tb_count; index++)
+    {
+        if (tb_tables[index].header.material == material)
+            return &tb_tables[index];
+    }
 
-    // reset "time is up" flag
-    stopped = 0;
+    return NULL;
+}
 
-    // PV score flags
-    follow_pv = 0;
-    score_pv = 0;
+// table name from its pieces (e.g. "KQvKR")
+void tb_name(tb_header *header, char *name)
+{
+    for (int slot = 0; slot < header->count; slot++)
+    {
+        if (slot && header->pieces[slot] == k)
+            *name++ = 'v';
 
-    memset(killer_moves, 0, sizeof(killer_moves));
-    memset(history_moves, 0, sizeof(history_moves));
-    memset(pv_table, 0, sizeof(pv_table));
-    memset(pv_length, 0, sizeof(pv_length));
+        *name++ = ascii_pieces[header->pieces[slot] % 6];
+    }
 
-    //Iterative deepening
-    int alpha = -50000, beta = 50000;
-    int best_move_so_far;
+    *name = '\0';
+}
 
-    for(int current_depth = 1; current_depth <= depth; current_depth++)
-    {        
-        // if time is up
-        if(stopped == 1)
-            // stop calculating and return best move so far 
-            break;
+// order each side king first then strongest piece first, the stronger side plays white
+void tb_canonical(tb_header *header)
+{
+    int sides[2][TB_MAX_PIECES], counts[2] = { 0, 0 };
 
-        follow_pv = 1;
-        int score = negamax(current_depth, alpha, beta); // -50000 is -inf and 50000 is +inf
+    for (int slot = 0; slot < header->count; slot++)
+    {
+        int kind = header->pieces[slot] % 6;
+        int color = header->pieces[slot] >= p;
+        int *pieces = sides[color];
+        int count = counts[color]++;
 
-        if((score <= alpha) || (score >= beta)) // if value falls out of narrow window reset window len with infs
+        while (count && pieces[count - 1] < kind)
         {
-            alpha = -50000;
-            beta = 50000;
-            continue;
+            pieces[count] = pieces[count - 1];
+            count--;
         }
 
-        // Improvement on Iterative deepening
-        // Assume the newer vals will be close to the previous one
-        // Adjust the alpha-beta window accordingly
-        alpha = score - 50;
-        beta = score + 50;
+        pieces[count] = kind;
+    }
 
-        printf("info score cp %d depth %d nodes %ld pv ", score, current_depth, nodes);
-            
-        for(int i = 0; i < pv_length[0]; i++)
+    // more pieces, then the first stronger piece decides
+    int stronger = (counts[black] > counts[white]) ? black : white;
+
+    for (int slot = 0; counts[black] == counts[white] && slot < counts[white]; slot++)
+    {
+        if (sides[white][slot] != sides[black][slot])
         {
-            print_move(pv_table[0][i]);
-            printf(" ");
+            stronger = (sides[black][slot] > sides[white][slot]) ? black : white;
+            break;
         }
-
-        printf("\n");
-        
-        best_move_so_far = pv_table[0][0];  
     }
-    printf("bestmove ");
-    if (stopped == 0)
-        print_move(pv_table[0][0]);
-    else
-        print_move(best_move_so_far);
 
-    printf("\n"); 
-}
+    header->count = 0;
+    header->material = 0ULL;
 
+    for (int color = white; color <= black; color++)
+    {
+        int from = color ^ stronger;
 
-/********************************************
-*
-*                      UCI
-*                 forked from BBC
-*
-************************************************/
+        for (int slot = 0; slot < counts[from]; slot++)
+        {
+            int piece = sides[from][slot] + (color == black ? 6 : 0);
 
-// parse user/GUI move string input (e.g. "e7e8q")
-int parse_move(char *move_string)
+            header->pieces[header->count++] = piece;
+            header->material += MATERIAL(piece, 1);
+        }
+    }
+}
+
+// material signature of the current position
+static inline U64 tb_material()
 {
-    // create move list instance
-    moves move_list[1];
-    
-    // generate moves
-    generate_moves(move_list);
-    // print_move_list(move_list);
-    
-    // parse source square
-    int source_square = (move_string[0] - 'a') + (8 - (move_string[1] - '0')) * 8;
-    
-    // parse target square
-    int target_square = (move_string[2] - 'a') + (8 - (move_string[3] - '0')) * 8;
-    
-    // loop over the moves within a move list
-    for (int move_count = 0; move_count < move_list->count; move_count++)
+    U64 material = 0ULL;
+
+    for (int piece = P; piece <= k; piece++)
+        material |= MATERIAL(piece, __builtin_popcountll(bitboards[piece]));
+
+    return material;
+}
+
+// bare kings and a single minor piece can't mate
+static inline int tb_trivial_draw(U64 material)
+{
+    U64 kings = MATERIAL(K, 1) | MATERIAL(k, 1);
+
+    return material == kings ||
+           material == (kings | MATERIAL(N, 1)) || material == (kings | MATERIAL(n, 1)) ||
+           material == (kings | MATERIAL(B, 1)) || material == (kings | MATERIAL(b, 1));
+}
+
+// table value of the current position, returns 0 if no table covers it
+static inline int tb_probe(int *value)
+{
+    U64 material = tb_material();
+
+    if (tb_trivial_draw(material))
     {
-        // init move
-        int move = move_list->moves[move_count];
-        
-        // make sure source & target squares are available within the generated move
-        if (source_square == get_move_source(move) && target_square == get_move_dest(move))
+        *value = TB_DRAW;
+        return 1;
+    }
+
+    // tables are stored with the pieces as named, try the colour flipped board too
+    int flip = 0;
+
+    tb_table *table = tb_find(material);
+
+    if (table == NULL)
+    {
+        table = tb_find(FLIP_MATERIAL(material));
+        flip = 1;
+    }
+
+    if (table == NULL)
+        return 0;
+
+    // fill slots from the board (same pieces in ls1b order)
+    int squares[TB_MAX_PIECES];
+
+    U64 remaining[12];
+
+    memcpy(remaining, bitboards, sizeof(remaining));
+
+    for (int slot = 0; slot < table->header.count; slot++)
+    {
+        int piece = table->header.pieces[slot];
+        int board_piece = flip ? (piece + 6) % 12 : piece;
+
+        int square = __builtin_ctzll(remaining[board_piece]);
+        remaining[board_piece] &= remaining[board_piece] - 1;
+
+        squares[slot] = flip ? square ^ 56 : square;
+    }
+
+    // move white king to a canonical square
+    for (int transform = 0; transform < (table->pawns ? 2 : 8); transform++)
+    {
+        if (tb_king_index[table->pawns][tb_transform(squares[0], transform)] != -1)
         {
-            // init promoted piece
-            int promoted_piece = get_move_promoted(move);
-            
-            // promoted piece is available
-            if (promoted_piece)
-            {
-                printf("in promoted");
-                // promoted to queen
-                if ((promoted_piece == Q || promoted_piece == q) && move_string[4] == 'q')
-                    // return legal move
-                    return move;
-                
-                // promoted to rook
-                else if ((promoted_piece == R || promoted_piece == r) && move_string[4] == 'r')
-                    // return legal move
-                    return move;
-                
-                // promoted to bishop
-                else if ((promoted_piece == B || promoted_piece == b) && move_string[4] == 'b')
-                    // return legal move
-                    return move;
-                
-                // promoted to knight
-                else if ((promoted_piece == N || promoted_piece == n) && move_string[4] == 'n')
-                    // return legal move
-                    return move;
-                
-                // continue the loop on possible wrong promotions (e.g. "e7e8f")
-                continue;
-            }
-            
-            // return legal move
-            return move;
+            for (int slot = 0; slot < table->header.count; slot++)
+                squares[slot] = tb_transform(squares[slot], transform);
+
+            break;
         }
     }
-    
-    // return illegal move
-    return 0;
+
+    *value = table->data[tb_index(table, squares, flip ? side ^ 1 : side)];
+
+    return 1;
 }
 
-/*
-    Example UCI commands to init position on chess board
-    
-    // init start position
-    position startpos
-    
-    // init start position and make the moves on chess board
-    position startpos moves e2e4 e7e5
-    
-    // init position from FEN string
-    position fen r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1 
-    
-    // init position from fen string and make moves on chess board
-    position fen r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1 moves e2a6 e8g8
-*/
+// register table, returns NULL if there's no room
+tb_table *tb_add(tb_header *header)
+{
+    if (tb_count == TB_MAX_TABLES)
+        return NULL;
 
-// parse UCI "position" command
-void parse_position(char *command)
+    tb_table *table = &tb_tables[tb_count++];
+
+    memset(table, 0, sizeof(tb_table));
+    table->header = *header;
+
+    for (int slot = 0; slot < header->count; slot++)
+    {
+        if (header->pieces[slot] % 6 == P)
+            table->pawns = 1;
+    }
+
+    if (header->count > tb_pieces)
+        tb_pieces = header->count;
+
+    return table;
+}
+
+// drop all tables
+void tb_clear()
 {
-    // shift pointer to the right where next token begins
-    command += 9;
-    
-    // init pointer to the current character in the command string
-    char *current_char = command;
-    
-    // parse UCI "startpos" command
-    if (strncmp(command, "startpos", 8) == 0)
-        // init chess board with start position
-        parse_fen(start_position);
-    
-    // parse UCI "fen" command 
-    else
+    for (int index = 0; index < tb_count; index++)
     {
-        // make sure "fen" command is available within command string
-        current_char = strstr(command, "fen");
-        
-        // if no "fen" command is available within command string
-        if (current_char == NULL)
-            // init chess board with start position
-            parse_fen(start_position);
-            
-        // found "fen" substring
+        tb_table *table = &tb_tables[index];
+
+        if (table->mapping == NULL)
+            free(table->data);
+#ifdef __MINGW32__
         else
+            free(table->mapping);
+#else
+        else
+            munmap(table->mapping, table->mapping_size);
+#endif
+    }
+
+    tb_count = 0;
+    tb_pieces = 0;
+}
+
+// map table file, returns 0 if it isn't a valid table
+int tb_load_file(char *file_name)
+{
+    unsigned char *mapping;
+    size_t size;
+
+#ifdef __MINGW32__
+    FILE *file = fopen(file_name, "rb");
+
+    if (file == NULL)
+        return 0;
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    mapping = malloc(size ? size : 1);
+
+    if (fread(mapping, 1, size, file) != size)
+    {
+        fclose(file);
+        free(mapping);
+        return 0;
+    }
+
+    fclose(file);
+#else
+    int file = open(file_name, O_RDONLY);
+
+    if (file < 0)
+        return 0;
+
+    struct stat file_stat;
+
+    if (fstat(file, &file_stat) < 0 || file_stat.st_size < (off_t)sizeof(tb_header))
+    {
+        close(file);
+        return 0;
+    }
+
+    size = file_stat.st_size;
+    mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, file, 0);
+
+    close(file);
+
+    if (mapping == MAP_FAILED)
+        return 0;
+#endif
+
+    tb_header *header = (tb_header *)mapping;
+
+    tb_table *table = NULL;
+
+    if (size >= sizeof(tb_header) && memcmp(header->magic, "JBTB", 4) == 0 && header->version == 1 &&
+        header->count <= TB_MAX_PIECES && size == sizeof(tb_header) + header->entries &&
+        tb_find(header->material) == NULL)
+        table = tb_add(header);
+
+    if (table == NULL)
+    {
+#ifdef __MINGW32__
+        free(mapping);
+#else
+        munmap(mapping, size);
+#endif
+        return 0;
+    }
+
+    table->mapping = mapping;
+    table->mapping_size = size;
+    table->data = mapping + sizeof(tb_header);
+
+    return 1;
+}
+
+// load every table in a directory, returns number of tables
+int tb_load_path(char *path)
+{
+    tb_clear();
+
+    DIR *directory = opendir(path);
+
+    if (directory == NULL)
+        return 0;
+
+    struct dirent *entry;
+
+    while ((entry = readdir(directory)))
+    {
+        int length = strlen(entry->d_name);
+
+        if (length < 5 || strcmp(entry->d_name + length - 4, ".jbt"))
+            continue;
+
+        char file_name[1024];
+
+        snprintf(file_name, sizeof(file_name), "%s/%s", path, entry->d_name);
+
+        tb_load_file(file_name);
+    }
+
+    closedir(directory);
+
+    return tb_count;
+}
+
+// position states during generation
+enum { TB_UNKNOWN, TB_INVALID, TB_DRAWN, TB_WIN, TB_LOSS };
+
+// distance of undecided positions during generation
+#define TB_NO_DTM 255
+
+// generation state of one table
+typedef struct {
+    tb_table *table;
+    unsigned char *state;
+    unsigned char *dtm;
+    unsigned char *counter;         // moves not yet known to lose
+    unsigned char *exit_win;        // shortest win through a capture or promotion (0 = none)
+    unsigned char *exit_loss;       // ply at which all losing captures and promotions are accounted for
+    U64 next;                       // next chunk for the workers
+    int ply;                        // ply being generated
+    U64 marked;                     // positions decided during the ply
+    U64 missing;                    // material of a missing smaller table
+} tb_generator;
+
+// set up board from table squares
+void tb_set_board(tb_table *table, int *squares, int stm)
+{
+    memset(bitboards, 0, sizeof(bitboards));
+    memset(occupancies, 0, sizeof(occupancies));
+
+    for (int slot = 0; slot < table->header.count; slot++)
+        set_bit(bitboards[table->header.pieces[slot]], squares[slot]);
+
+    for (int piece = P; piece <= K; piece++)
+        occupancies[white] |= bitboards[piece];
+
+    for (int piece = p; piece <= k; piece++)
+        occupancies[black] |= bitboards[piece];
+
+    occupancies[both] = occupancies[white] | occupancies[black];
+
+    side = stm;
+    castle = 0;
+    enpassant = no_sq;
+    hash_key = 0ULL;
+}
+
+// first look at one position: legality, mates and moves leaving the table
+void tb_init_position(tb_generator *generator, U64 index)
+{
+    tb_table *table = generator->table;
+
+    int squares[TB_MAX_PIECES], stm;
+
+    tb_decode(table, index, squares, &stm);
+
+    generator->state[index] = TB_INVALID;
+
+    // overlapping pieces and pawns on the back ranks
+    for (int slot = 0; slot < table->header.count; slot++)
+    {
+        for (int other = 0; other < slot; other++)
         {
-            // shift pointer to the right where next token begins
-            current_char += 4;
-            
-            // init chess board with position from FEN string
-            parse_fen(current_char);
+            if (squares[slot] == squares[other])
+                return;
         }
+
+        if (table->header.pieces[slot] % 6 == P && (squares[slot] < 8 || squares[slot] >= 56))
+            return;
     }
-    
-    // parse moves after position
-    current_char = strstr(command, "moves");
-    
-    // moves available
-    if (current_char != NULL)
+
+    tb_set_board(table, squares, stm);
+
+    // side not to move in check (covers touching kings)
+    if (is_square_attacked(get_ls1b_index(bitboards[stm == white ? k : K]), stm))
+        return;
+
+    generator->state[index] = TB_UNKNOWN;
+
+    int legal_moves = 0, counter = 0, exit_win = 0, exit_loss = 0;
+
+    moves move_list[1];
+
+    generate_moves(move_list);
+
+    for (int count = 0; count < move_list->count; count++)
     {
-        // shift pointer to the right where next token begins
-        current_char += 6;
-        
-        // loop over moves within a move string
-        while(*current_char)
+        int move = move_list->moves[count];
+
+        copy_board();
+
+        if (!make_move(move, all_moves))
+            continue;
+
+        legal_moves++;
+
+        // captures and promotions leave the table
+        if (get_move_capture(move) || get_move_promoted(move) || get_move_enpassant(move))
         {
-            // parse next move
-            int move = parse_move(current_char);
-            // printf("\nParsed Move: ");
-            // print_move(move);
-            
-            // if no more moves
-            if (move == 0)
-                // break out of the loop
-                break;
-            
-            // make move on the chess board
-            make_move(move, all_moves);
-            
-            // move current character mointer to the end of current move
-            while (*current_char && *current_char != ' ') current_char++;
-            
-            // go to the next move
-            current_char++;
-        }        
-    }
-    
-    // print board
-    //print_board();
+            int value;
+
+            if (!tb_probe(&value))
+                generator->missing = tb_material();
+
+            else if (value == TB_DRAW)
+                counter++;
+
+            // opponent loses: win one ply later
+            else if (TB_IS_LOSS(value))
+            {
+                if (exit_win == 0 || TB_DISTANCE(value) + 1 < exit_win)
+                    exit_win = TB_DISTANCE(value) + 1;
+            }
+
+            // opponent wins: lose no earlier than one ply after
+            else if (TB_DISTANCE(value) + 1 > exit_loss)
+                exit_loss = TB_DISTANCE(value) + 1;
+        }
+        else
+            counter++;
+
+        take_back();
+    }
+
+    // checkmate or stalemate
+    if (legal_moves == 0)
+    {
+        int in_check = is_square_attacked(get_ls1b_index(bitboards[stm == white ? K : k]), stm ^ 1);
+
+        generator->state[index] = in_check ? TB_LOSS : TB_DRAWN;
+        generator->dtm[index] = 0;
+        return;
+    }
+
+    generator->counter[index] = counter;
+    generator->exit_win[index] = exit_win;
+    generator->exit_loss[index] = exit_loss;
+}
+
+// initialization worker, takes chunks of positions
+void *tb_init_worker(void *arg)
+{
+    tb_generator *generator = arg;
+
+    U64 entries = generator->table->header.entries;
+
+    while (1)
+    {
+        U64 start = __sync_fetch_and_add(&generator->next, 4096);
+
+        if (start >= entries)
+            break;
+
+        U64 end = (start + 4096 < entries) ? start + 4096 : entries;
+
+        for (U64 index = start; index < end; index++)
+            tb_init_position(generator, index);
+    }
+
+    return NULL;
+}
+
+// slot of a second identical piece (e.g. KBBvK), 0 if all pieces differ
+static inline int tb_twin_slot(tb_table *table)
+{
+    for (int slot = 2; slot < table->header.count; slot++)
+    {
+        if (table->header.pieces[slot] == table->header.pieces[slot - 1])
+            return slot;
+    }
+
+    return 0;
+}
+
+// order identical pieces by square so equal positions compare equal
+static inline void tb_normalize(tb_table *table, int *squares)
+{
+    int twin = tb_twin_slot(table);
+
+    if (twin && squares[twin] < squares[twin - 1])
+    {
+        int square = squares[twin];
+        squares[twin] = squares[twin - 1];
+        squares[twin - 1] = square;
+    }
+}
+
+/*
+    A position is stored under several indices when the white king is on the
+    a1-h8 diagonal or two pieces are identical. Only the smallest of them takes
+    part in the backward pass so every move is counted once; the others get
+    the same values since they are predecessors of the same positions.
+*/
+int tb_primary(tb_table *table, U64 index)
+{
+    int squares[TB_MAX_PIECES], stm;
+
+    tb_decode(table, index, squares, &stm);
+
+    for (int transform = 0; transform < (table->pawns ? 2 : 8); transform++)
+    {
+        int image[TB_MAX_PIECES] = { 0 };
+
+        for (int slot = 0; slot < table->header.count; slot++)
+            image[slot] = tb_transform(squares[slot], transform);
+
+        if (tb_king_index[table->pawns][image[0]] == -1)
+            continue;
+
+        tb_normalize(table, image);
+
+        if (tb_index(table, image, stm) < index)
+            return 0;
+    }
+
+    return 1;
+}
+
+// positions one move before the given one (non capturing moves only), returns count
+int tb_predecessors(tb_table *table, U64 index, U64 *predecessors)
+{
+    int squares[TB_MAX_PIECES], stm;
+
+    tb_decode(table, index, squares, &stm);
+
+    int count = table->header.count;
+    int twin = tb_twin_slot(table);
+
+    // distinct symmetric images, each of their predecessors is a different move
+    int images[8][TB_MAX_PIECES];
+    int image_count = 0;
+
+    for (int transform = 0; transform < (table->pawns ? 2 : 8); transform++)
+    {
+        int *image = images[image_count];
+
+        for (int slot = 0; slot < count; slot++)
+            image[slot] = tb_transform(squares[slot], transform);
+
+        tb_normalize(table, image);
+
+        int duplicate = 0;
+
+        for (int other = 0; other < image_count; other++)
+        {
+            if (memcmp(images[other], image, count * sizeof(int)) == 0)
+                duplicate = 1;
+        }
+
+        if (!duplicate)
+            image_count++;
+    }
+
+    // side that made the last move
+    int mover = stm ^ 1;
+
+    int predecessor_count = 0;
+
+    for (int image_index = 0; image_index < image_count; image_index++)
+    {
+        int *image = images[image_index];
+
+        U64 occupancy = 0ULL;
+
+        for (int slot = 0; slot < count; slot++)
+            occupancy |= 1ULL << image[slot];
+
+        for (int slot = 0; slot < count; slot++)
+        {
+            int piece = table->header.pieces[slot];
+
+            if ((piece < p) != (mover == white))
+                continue;
+
+            int square = image[slot];
+
+            U64 from = 0ULL;
+
+            switch (piece % 6)
+            {
+                case P:
+                    // undo pushes (white pawns came from higher rows in BBC order)
+                    if (piece == P)
+                    {
+                        if (square / 8 < 6 && !(occupancy & (1ULL << (square + 8))))
+                        {
+                            from |= 1ULL << (square + 8);
+
+                            if (square / 8 == 4 && !(occupancy & (1ULL << (square + 16))))
+                                from |= 1ULL << (square + 16);
+                        }
+                    }
+                    else
+                    {
+                        if (square / 8 > 1 && !(occupancy & (1ULL << (square - 8))))
+                        {
+                            from |= 1ULL << (square - 8);
+
+                            if (square / 8 == 3 && !(occupancy & (1ULL << (square - 16))))
+                                from |= 1ULL << (square - 16);
+                        }
+                    }
+                    break;
+
+                case N: from = knight_attacks[square] & ~occupancy; break;
+                case B: from = get_bishop_attacks(square, occupancy) & ~occupancy; break;
+                case R: from = get_rook_attacks(square, occupancy) & ~occupancy; break;
+                case Q: from = get_queen_attacks(square, occupancy) & ~occupancy; break;
+                case K: from = king_attacks[square] & ~occupancy; break;
+            }
+
+            while (from)
+            {
+                int from_square = __builtin_ctzll(from);
+                from &= from - 1;
+
+                int predecessor[TB_MAX_PIECES];
+
+                memcpy(predecessor, image, count * sizeof(int));
+                predecessor[slot] = from_square;
+
+                // the other images cover non canonical predecessors
+                if (tb_king_index[table->pawns][predecessor[0]] == -1)
+                    continue;
+
+                predecessors[predecessor_count++] = tb_index(table, predecessor, mover);
+
+                // identical pieces in the other order are stored separately
+                if (twin)
+                {
+                    int square = predecessor[twin];
+                    predecessor[twin] = predecessor[twin - 1];
+                    predecessor[twin - 1] = square;
+
+                    predecessors[predecessor_count++] = tb_index(table, predecessor, mover);
+                }
+            }
+        }
+    }
+
+    return predecessor_count;
+}
+
+// backward pass worker: predecessors of losses win, predecessors of wins lose a move
+void *tb_retro_worker(void *arg)
+{
+    tb_generator *generator = arg;
+
+    tb_table *table = generator->table;
+
+    U64 entries = table->header.entries;
+
+    int ply = generator->ply;
+
+    U64 predecessors[2 * 8 * 64 * TB_MAX_PIECES];
+
+    U64 marked = 0;
+
+    while (1)
+    {
+        U64 start = __sync_fetch_and_add(&generator->next, 4096);
+
+        if (start >= entries)
+            break;
+
+        U64 end = (start + 4096 < entries) ? start + 4096 : entries;
+
+        for (U64 index = start; index < end; index++)
+        {
+            // positions decided by other threads this ply carry TB_NO_DTM until done
+            if (generator->dtm[index] != ply - 1 ||
+                (generator->state[index] != TB_WIN && generator->state[index] != TB_LOSS) ||
+                !tb_primary(table, index))
+                continue;
+
+            int count = tb_predecessors(table, index, predecessors);
+
+            for (int entry = 0; entry < count; entry++)
+            {
+                U64 predecessor = predecessors[entry];
+
+                if (generator->state[predecessor] != TB_UNKNOWN)
+                    continue;
+
+                // move into a lost position wins
+                if (generator->state[index] == TB_LOSS)
+                {
+                    generator->state[predecessor] = TB_WIN;
+                    generator->dtm[predecessor] = ply;
+                    marked++;
+                }
+
+                // one more move known to lose
+                else
+                    __sync_fetch_and_sub(&generator->counter[predecessor], 1);
+            }
+        }
+    }
+
+    __sync_fetch_and_add(&generator->marked, marked);
+
+    return NULL;
+}
+
+// generate table from its name (e.g. "KQvKR") into a directory, returns 0 on success
+int tb_generate(char *name, char *path)
+{
+    tb_header header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "JBTB", 4);
+    header.version = 1;
+
+    // parse pieces
+    int color = white;
+
+    for (char *current = name; *current; current++)
+    {
+        if (*current == 'v')
+        {
+            color = black;
+            continue;
+        }
+
+        char *letter = strchr("PNBRQK", toupper(*current));
+
+        if (letter == NULL || header.count == TB_MAX_PIECES)
+        {
+            printf("tbgen: bad table name %s\n", name);
+            return 1;
+        }
+
+        header.pieces[header.count++] = (letter - "PNBRQK") + (color == black ? 6 : 0);
+    }
+
+    // one king a side
+    int kings[2] = { 0, 0 };
+
+    for (int slot = 0; slot < header.count; slot++)
+    {
+        if (header.pieces[slot] % 6 == K)
+            kings[header.pieces[slot] == k]++;
+    }
+
+    if (header.count < 3 || kings[white] != 1 || kings[black] != 1)
+    {
+        printf("tbgen: bad table name %s\n", name);
+        return 1;
+    }
+
+    // generate under the canonical name (e.g. "KPvKQ" as "KQvKP")
+    char canonical_name[16];
+
+    tb_canonical(&header);
+    tb_name(&header, canonical_name);
+    name = canonical_name;
+
+    if (tb_find(header.material) || tb_find(FLIP_MATERIAL(header.material)))
+    {
+        printf("tbgen: %s already loaded\n", name);
+        return 0;
+    }
+
+    tb_table *table = tb_add(&header);
+
+    if (table == NULL)
+    {
+        printf("tbgen: too many tables\n");
+        return 1;
+    }
+
+    table->header.entries = 2ULL * tb_king_squares[table->pawns];
+
+    for (int slot = 1; slot < header.count; slot++)
+        table->header.entries *= 64;
+
+    U64 entries = table->header.entries;
+
+    int start = get_time_ms();
+
+    tb_generator generator;
+
+    memset(&generator, 0, sizeof(generator));
+    generator.table = table;
+    generator.state = calloc(entries, 1);
+    generator.dtm = malloc(entries);
+    generator.counter = calloc(entries, 1);
+    generator.exit_win = calloc(entries, 1);
+    generator.exit_loss = calloc(entries, 1);
+
+    // undecided positions never match the ply being unmoved
+    memset(generator.dtm, TB_NO_DTM, entries);
+
+    // the table isn't usable until it's done
+    table->data = NULL;
+    U64 material = table->header.material;
+    table->header.material = 0;
+
+    // legality, mates and exits in parallel
+    pthread_t workers[MAX_THREADS];
+
+    for (int index = 1; index < threads; index++)
+        pthread_create(&workers[index], NULL, tb_init_worker, &generator);
+
+    tb_init_worker(&generator);
+
+    for (int index = 1; index < threads; index++)
+        pthread_join(workers[index], NULL);
+
+    table->header.material = material;
+
+    if (generator.missing)
+    {
+        U64 missing = generator.missing;
+
+        tb_header missing_header;
+        memset(&missing_header, 0, sizeof(missing_header));
+
+        for (int piece = P; piece <= k; piece++)
+        {
+            for (int count = 0; count < (int)((missing >> (4 * piece)) & 15); count++)
+                missing_header.pieces[missing_header.count++] = piece;
+        }
+
+        // name it the way tbgen accepts it
+        char missing_name[16];
+        tb_canonical(&missing_header);
+        tb_name(&missing_header, missing_name);
+
+        printf("tbgen: %s needs the %s table first\n", name, missing_name);
+
+        tb_count--;
+        return 1;
+    }
+
+    // highest ply at which captures and promotions still decide something
+    int last_exit = 0;
+
+    for (U64 index = 0; index < entries; index++)
+    {
+        if (generator.state[index] == TB_UNKNOWN)
+        {
+            if (generator.exit_win[index] > last_exit) last_exit = generator.exit_win[index];
+            if (generator.exit_loss[index] > last_exit) last_exit = generator.exit_loss[index];
+        }
+    }
+
+    int ply;
+
+    for (ply = 1; ply <= TB_MAX_DTM; ply++)
+    {
+        // unmove from the positions decided last ply in parallel
+        generator.ply = ply;
+        generator.next = 0;
+        generator.marked = 0;
+
+        for (int index = 1; index < threads; index++)
+            pthread_create(&workers[index], NULL, tb_retro_worker, &generator);
+
+        tb_retro_worker(&generator);
+
+        for (int index = 1; index < threads; index++)
+            pthread_join(workers[index], NULL);
+
+        U64 marked = generator.marked;
+
+        // resolved through captures and promotions or out of moves
+        for (U64 index = 0; index < entries; index++)
+        {
+            if (generator.state[index] != TB_UNKNOWN)
+                continue;
+
+            if (generator.exit_win[index] == ply)
+            {
+                generator.state[index] = TB_WIN;
+                generator.dtm[index] = ply;
+                marked++;
+            }
+
+            // every move loses, winning exits resolve earlier or above
+            else if (generator.counter[index] == 0 && generator.exit_win[index] == 0 &&
+                     generator.exit_loss[index] <= ply)
+            {
+                generator.state[index] = TB_LOSS;
+                generator.dtm[index] = ply;
+                marked++;
+            }
+        }
+
+        if (marked == 0 && ply > last_exit)
+            break;
+    }
+
+    if (ply > TB_MAX_DTM)
+        printf("tbgen: %s has mates longer than %d plies, stored as draws\n", name, TB_MAX_DTM);
+
+    // pack into table bytes
+    table->data = malloc(entries);
+
+    U64 wins = 0, losses = 0, draws = 0;
+    int longest = 0;
+
+    for (U64 index = 0; index < entries; index++)
+    {
+        unsigned char value = TB_DRAW;
+
+        if (generator.state[index] == TB_WIN)
+        {
+            value = generator.dtm[index];
+            wins++;
+        }
+        else if (generator.state[index] == TB_LOSS)
+        {
+            value = 128 + generator.dtm[index];
+            losses++;
+        }
+        else if (generator.state[index] != TB_INVALID)
+            draws++;
+
+        if (generator.state[index] == TB_WIN || generator.state[index] == TB_LOSS)
+        {
+            if (generator.dtm[index] > longest)
+                longest = generator.dtm[index];
+        }
+
+        table->data[index] = value;
+    }
+
+    free(generator.state);
+    free(generator.dtm);
+    free(generator.counter);
+    free(generator.exit_win);
+    free(generator.exit_loss);
+
+    // write table file
+    char file_name[1024];
+
+    snprintf(file_name, sizeof(file_name), "%s/%s.jbt", path, name);
+
+    FILE *file = fopen(file_name, "wb");
+
+    if (file == NULL || fwrite(&table->header, sizeof(tb_header), 1, file) != 1 ||
+        fwrite(table->data, 1, entries, file) != entries)
+    {
+        printf("tbgen: could not write %s\n", file_name);
+
+        if (file)
+            fclose(file);
+
+        return 1;
+    }
+
+    fclose(file);
+
+    printf("%-8s entries %10llu  wins %9llu  losses %9llu  draws %9llu  longest mate %3d plies  %6d ms\n",
+           name, entries, wins, losses, draws, longest, get_time_ms() - start);
+
+    return 0;
+}
+
+// all 3 and 4 piece tables in dependency order (KBvK and KNvK are trivial draws)
+char *tb_default_tables[] = {
+    "KQvK", "KRvK", "KPvK",
+    "KQQvK", "KQRvK", "KQBvK", "KQNvK", "KRRvK", "KRBvK", "KRNvK", "KBBvK", "KBNvK", "KNNvK",
+    "KQPvK", "KRPvK", "KBPvK", "KNPvK", "KPPvK",
+    "KQvKQ", "KQvKR", "KQvKB", "KQvKN", "KRvKR", "KRvKB", "KRvKN", "KBvKB", "KBvKN", "KNvKN",
+    "KQvKP", "KRvKP", "KBvKP", "KNvKP", "KPvKP",
+    NULL
+};
+
+// generate tables into a directory (default set if none given), returns 0 on success
+int tb_generate_all(char *path, char **names, int name_count)
+{
+    tb_load_path(path);
+
+    if (name_count == 0)
+    {
+        for (names = tb_default_tables; names[name_count]; name_count++);
+    }
+
+    for (int index = 0; index < name_count; index++)
+    {
+        if (tb_generate(names[index], path))
+            return 1;
+    }
+
+    return 0;
+}
+
+/****************************************************************
+ * 
+ * 
+ * 
+ *                          SEARCH                                
+ * 
+ * 
+ *
+ * **************************************************************/
+
+// most valuable victim & less valuable attacker
+
+/*
+                          
+    (Victims) Pawn Knight Bishop   Rook  Queen   King
+  (Attackers)
+        Pawn   105    205    305    405    505    605
+      Knight   104    204    304    404    504    604
+      Bishop   103    203    303    403    503    603
+        Rook   102    202    302    402    502    602
+       Queen   101    201    301    401    501    601
+        King   100    200    300    400    500    600
+*/
+
+// MVV LVA [attacker][victim]
+static int mvv_lva[12][12] = {
+    105, 205, 305, 405, 505, 605,  105, 205, 305, 405, 505, 605,
+    104, 204, 304, 404, 504, 604,  104, 204, 304, 404, 504, 604,
+    103, 203, 303, 403, 503, 603,  103, 203, 303, 403, 503, 603,
+    102, 202, 302, 402, 502, 602,  102, 202, 302, 402, 502, 602,
+    101, 201, 301, 401, 501, 601,  101, 201, 301, 401, 501, 601,
+    100, 200, 300, 400, 500, 600,  100, 200, 300, 400, 500, 600,
+
+    105, 205, 305, 405, 505, 605,  105, 205, 305, 405, 505, 605,
+    104, 204, 304, 404, 504, 604,  104, 204, 304, 404, 504, 604,
+    103, 203, 303, 403, 503, 603,  103, 203, 303, 403, 503, 603,
+    102, 202, 302, 402, 502, 602,  102, 202, 302, 402, 502, 602,
+    101, 201, 301, 401, 501, 601,  101, 201, 301, 401, 501, 601,
+    100, 200, 300, 400, 500, 600,  100, 200, 300, 400, 500, 600
+};
+
+#define MAX_PLY 64
+
+// selective depth (max ply reached including quiescence)
+THREAD_LOCAL int seldepth;
+
+// search start time for "info" output
+THREAD_LOCAL int search_start_time;
+
+// report root move being searched after this many ms
+#define CURRMOVE_DELAY 1000
+
+// search output hooks (NULL prints UCI "info" lines), currmove and "info string"
+// lines are only printed without an info hook unless they have a hook of their own
+THREAD_LOCAL void (*info_hook)(int depth, int line, int time) = NULL;
+THREAD_LOCAL void (*currmove_hook)(int move, int number) = NULL;
+THREAD_LOCAL void (*string_hook)(const char *text) = NULL;
+
+// report root move being searched
+void report_currmove(int move, int number)
+{
+    if (currmove_hook)
+        currmove_hook(move, number);
+
+    else if (info_hook == NULL)
+    {
+        printf("info currmove ");
+        print_move(move);
+        printf(" currmovenumber %d\n", number);
+    }
+}
+
+// report "info string" line of the search (printf style text)
+void report_string(const char *format, ...)
+{
+    char text[512] = "info string ";
+
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(text + 12, sizeof(text) - 12, format, arguments);
+    va_end(arguments);
+
+    if (string_hook)
+        string_hook(text);
+
+    else if (info_hook == NULL)
+        printf("%s\n", text);
+}
+
+/*
+    Search statistics, compiled in with -DSEARCH_STATS ("make stats").
+    Printed as "info string" lines after every iteration and by the "stats" command.
+*/
+
+#ifdef SEARCH_STATS
+
+typedef struct {
+    U64 main_nodes, qsearch_nodes;      // negamax vs quiescence nodes
+    U64 cutoffs, first_move_cutoffs;    // beta cutoffs / cutoffs by the first move searched
+    U64 null_tries, null_cutoffs;       // null move searches / null move fail highs
+    U64 null_verifications;             // null move fail highs checked by a verification search
+    U64 lmr_reductions, lmr_researches; // reduced searches / reduced searches that failed high
+    U64 iteration_nodes[MAX_PLY + 1];   // cumulative nodes at the end of each iteration
+    int last_depth;                     // last completed iteration
+} search_stats;
+
+THREAD_LOCAL search_stats stats;
+
+#define STAT_INC(field) (stats.field++)
+
+// percentage helper that tolerates empty counters
+static double stat_rate(U64 part, U64 total)
+{
+    return total ? 100.0 * part / total : 0.0;
+}
+
+// print one line summary of the search so far
+void print_search_stats()
+{
+    U64 all_nodes = stats.main_nodes + stats.qsearch_nodes;
+
+    report_string("stats main %llu qsearch %llu (%.1f%%) fmc %.1f%% null %llu/%llu (%.1f%%) verified %llu lmr %llu/%llu re-searched (%.1f%%)",
+           stats.main_nodes, stats.qsearch_nodes, stat_rate(stats.qsearch_nodes, all_nodes),
+           stat_rate(stats.first_move_cutoffs, stats.cutoffs),
+           stats.null_cutoffs, stats.null_tries, stat_rate(stats.null_cutoffs, stats.null_tries),
+           stats.null_verifications, stats.lmr_researches, stats.lmr_reductions, stat_rate(stats.lmr_researches, stats.lmr_reductions));
+}
+
+// print summary plus effective branching factor of every completed iteration
+void dump_search_stats()
+{
+    print_search_stats();
+
+    for (int depth = 2; depth <= stats.last_depth; depth++)
+    {
+        U64 previous = stats.iteration_nodes[depth - 1] - stats.iteration_nodes[depth - 2];
+        U64 current = stats.iteration_nodes[depth] - stats.iteration_nodes[depth - 1];
+
+        printf("info string stats depth %d nodes %llu ebf %.2f\n", depth, current,
+               previous ? (double)current / previous : 0.0);
+    }
+}
+
+#else
+
+#define STAT_INC(field) ((void)0)
+
+#endif
+
+//killer move indexed by [id][ply]
+THREAD_LOCAL int killer_moves[2][MAX_PLY];
+
+//history move indexed by [piece][square]
+THREAD_LOCAL int history_moves[12][64];
+
+//score PV flags
+THREAD_LOCAL int follow_pv, score_pv;
+
+// plies the game advanced since the previous search (0 = unrelated position, start cold)
+THREAD_LOCAL int warm_start_plies = 0;
+
+// moves that advanced the game since the previous search
+THREAD_LOCAL int warm_start_moves[2];
+
+// position of the previous "position" command, next commands usually just extend it
+THREAD_LOCAL char session_base[256] = "";        // "startpos" or "fen ..."
+THREAD_LOCAL char session_moves[3000] = "";      // move list
+THREAD_LOCAL board_state session_board;          // board after the move list
+
+// forget the previous position (next "position" command is parsed from scratch)
+void reset_session()
+{
+    session_base[0] = '\0';
+    session_moves[0] = '\0';
+    warm_start_plies = 0;
+}
+
+/*
+      ================================
+            Triangular PV table
+      --------------------------------
+        PV line: e2e4 e7e5 g1f3 b8c6
+      ================================
+           0    1    2    3    4    5
+      
+      0    m1   m2   m3   m4   m5   m6
+      
+      1    0    m2   m3   m4   m5   m6 
+      
+      2    0    0    m3   m4   m5   m6
+      
+      3    0    0    0    m4   m5   m6
+       
+      4    0    0    0    0    m5   m6
+      
+      5    0    0    0    0    0    m6
+*/
+
+// PV length
+THREAD_LOCAL int pv_length[MAX_PLY];
+
+// PV table
+THREAD_LOCAL int pv_table[MAX_PLY][MAX_PLY];
+
+//half move counter
+THREAD_LOCAL int ply;
+
+static inline void enable_PV_scoring(moves *move_list)
+{
+    follow_pv = 0;
+
+    for(int i = 0; i < move_list->count; i++)
+    {
+        if(get_list_move(move_list->moves[i]) == pv_table[0][ply])
+        {
+            follow_pv = 1;
+
+            score_pv = 1;
+        }
+    }
+}
+
+static inline int score_move(int move)
+{
+    if(score_pv)
+    {
+        if(pv_table[0][ply] == move)
+        {
+            score_pv = 0;
+
+            return 20000;
+        }
+    }
+
+    if(get_move_capture(move))
+    {
+        int target_piece = P; //initial value takes care of en passant
+
+        int start_piece = side == white ? p : P;
+        int end_piece = side == white ? k : K;
+
+        for(int bb_piece = start_piece; bb_piece <= end_piece; bb_piece++)
+        {
+            if(get_bit(bitboards[bb_piece], get_move_dest(move)))
+            {
+                target_piece = bb_piece;
+                break;
+            }
+        }
+
+        return mvv_lva[get_move_piece(move)][target_piece] + 10000;
+    }
+
+    else {
+        if(killer_moves[0][ply] == move)
+            return 9000;
+        else if(killer_moves[1][ply] == move)
+            return 8000;
+        else
+            return history_moves[get_move_piece(move)][get_move_dest(move)];
+        return 0;
+    }
+}
+
+void print_move_scores(moves* move_list)
+{
+    for(int i = 0; i < move_list->count; i++)
+    {
+        print_move(move_list->moves[i]);
+        int score = score_move(move_list->moves[i]);
+        printf("   Score : %d\n", score);
+    }
+}
+
+// highest ordering score that fits above a 16 bit move in an int
+#define MAX_ORDER_SCORE 0x7fff
+
+static inline void sort_moves(moves* move_list) //descending
+{
+    // pack score and move into one entry, so sorting the entries sorts by score
+    for (int count = 0; count < move_list->count; count++)
+    {
+        int move = get_list_move(move_list->moves[count]);
+        int score = score_move(move);
+
+        if (score > MAX_ORDER_SCORE)
+            score = MAX_ORDER_SCORE;
+
+        move_list->moves[count] = (score << 16) | move;
+    }
+
+    // insertion sort
+    for (int current_move = 1; current_move < move_list->count; current_move++)
+    {
+        int entry = move_list->moves[current_move];
+        int next_move = current_move - 1;
+
+        while (next_move >= 0 && move_list->moves[next_move] < entry)
+        {
+            move_list->moves[next_move + 1] = move_list->moves[next_move];
+            next_move--;
+        }
+
+        move_list->moves[next_move + 1] = entry;
+    }
+}
+
+/*
+    Per phase cycle accounting, compiled in with -DSEARCH_PROFILE ("make profile").
+
+    Search call sites of the hot functions are wrapped with rdtsc timers that add
+    into thread local counters (no locking). make_move includes its own legality
+    test, is_square_attacked is the in-check test done at every node. A breakdown
+    is printed as "info string profile" lines before bestmove.
+*/
+
+enum { PHASE_GENERATE_MOVES, PHASE_SORT_MOVES, PHASE_MAKE_MOVE, PHASE_EVALUATE,
+       PHASE_IS_SQUARE_ATTACKED, PHASE_COMMUNICATE, PHASES };
+
+#ifdef SEARCH_PROFILE
+
+char *phase_names[PHASES] = { "generate_moves", "sort_moves", "make_move", "evaluate", "is_square_attacked", "communicate" };
+
+// cycles and calls per phase
+THREAD_LOCAL U64 phase_cycles[PHASES], phase_calls[PHASES];
+
+// cycle count at search start
+THREAD_LOCAL U64 profile_start_cycles;
+
+// time a statement
+#define PROFILE(phase, statement) \
+    { U64 phase_start = read_cycles(); statement; phase_cycles[phase] += read_cycles() - phase_start; phase_calls[phase]++; }
+
+// time an expression and yield its value
+#define PROFILED(phase, expression) \
+    ({ U64 phase_start = read_cycles(); __typeof__(expression) phase_result = (expression); \
+       phase_cycles[phase] += read_cycles() - phase_start; phase_calls[phase]++; phase_result; })
+
+void profile_start()
+{
+    memset(phase_cycles, 0, sizeof(phase_cycles));
+    memset(phase_calls, 0, sizeof(phase_calls));
+
+    profile_start_cycles = read_cycles();
+}
+
+// print share of search cycles spent in every phase
+void print_profile()
+{
+    U64 total = read_cycles() - profile_start_cycles, profiled = 0;
+
+    if (total == 0)
+        total = 1;
+
+    for (int phase = 0; phase < PHASES; phase++)
+    {
+        profiled += phase_cycles[phase];
+
+        report_string("profile %-18s %5.1f%% calls %llu cycles/call %llu", phase_names[phase],
+               100.0 * phase_cycles[phase] / total, phase_calls[phase],
+               phase_calls[phase] ? phase_cycles[phase] / phase_calls[phase] : 0);
+    }
+
+    report_string("profile %-18s %5.1f%% total cycles %llu", "other",
+           100.0 * (total - profiled) / total, total);
+}
+
+#else
+
+#define PROFILE(phase, statement) statement
+#define PROFILED(phase, expression) (expression)
+
+#endif
+
+/*
+    Binary search tree trace, compiled in with -DSEARCH_TRACE ("make trace") and
+    switched on with "setoption name TraceFile value <path>" ("<empty>" turns it off).
+
+    One search at a time owns the trace file, searches running meanwhile on other
+    threads (server games, library instances) are not traced.
+
+    Every node, move, pruning decision and result is recorded as a 16 byte event
+    into one half of a preallocated buffer. A full half is handed to a writer
+    thread while the search fills the other one, so the search never waits for
+    the file; if the writer falls behind the half is dropped and counted. The
+    rest and the final block header are written after the search.
+
+    File layout: repeated blocks of [trace_header][trace_event * header.events]
+    Decode with: Jabberook tracedump <file> [max ply] [root moves...]
+*/
+
+// trace event types
+enum { TRACE_NODE, TRACE_MOVE, TRACE_RESULT };
+
+// node kinds (TRACE_NODE decision)
+enum { NODE_MAIN, NODE_QSEARCH };
+
+// how a move was searched (TRACE_MOVE decision)
+enum { SEARCH_FULL, SEARCH_ZERO_WINDOW, SEARCH_REDUCED, SEARCH_RESEARCH_ZERO, SEARCH_RESEARCH_FULL, SEARCH_NULL_MOVE, SEARCH_CAPTURE,
+       SEARCH_EVASION, SEARCH_CHECK };
+
+// why a node returned (TRACE_RESULT decision, score is stored in alpha)
+enum { RESULT_SCORE, RESULT_CUTOFF, RESULT_NULL_CUTOFF, RESULT_STAND_PAT, RESULT_MATE, RESULT_STALEMATE };
+
+typedef struct {
+    int move;                   // move searched (TRACE_MOVE, TRACE_RESULT cutoffs), 0 otherwise
+    int alpha, beta;            // search window, result score in alpha for TRACE_RESULT
+    unsigned char ply, depth;
+    unsigned char type, decision;
+} trace_event;
+
+typedef struct {
+    char magic[4];              // "JBTR"
+    U64 events;                 // events following this header
+    U64 dropped;                // events lost (writer behind or write errors)
+    board_state root;           // searched position
+} trace_header;
+
+#ifdef SEARCH_TRACE
+
+// buffer size in events (16 bytes each), filled and written in two halves
+#define TRACE_EVENTS (1 << 20)
+#define TRACE_HALF (TRACE_EVENTS / 2)
+
+// half being filled by this thread's search (NULL while not tracing) and events in it
+THREAD_LOCAL trace_event *trace_events = NULL;
+THREAD_LOCAL int trace_fill = 0;
+
+// trace output file, tracing is off while empty (set under trace_lock)
+char trace_file[256] = "";
+
+// set while a search owns the trace file, everything below belongs to that search
+int trace_busy = 0;
+
+// event buffer of the traced search
+trace_event *trace_buffer = NULL;
+
+// file of the running search and offset of its block header
+FILE *trace_output = NULL;
+long trace_header_offset = 0;
+
+// events of the current search written to the file / lost
+U64 trace_written = 0, trace_dropped = 0;
+
+// root position of the traced search
+board_state trace_root;
+
+// writer thread, writes full halves while the search fills the other one
+pthread_t trace_writer;
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t trace_wake = PTHREAD_COND_INITIALIZER;
+
+// half handed to the writer (NULL while it's idle), its event count and end of search flag
+trace_event *trace_pending = NULL;
+int trace_pending_count = 0;
+int trace_done = 0;
+
+// write handed over halves to the trace file until the search is done
+void *trace_write_worker(void *argument)
+{
+    (void)argument;
+
+    pthread_mutex_lock(&trace_lock);
+
+    while (1)
+    {
+        while (trace_pending == NULL && !trace_done)
+            pthread_cond_wait(&trace_wake, &trace_lock);
+
+        if (trace_pending == NULL)
+            break;
+
+        trace_event *events = trace_pending;
+        int count = trace_pending_count;
+
+        // the search may hand over or drop halves meanwhile
+        pthread_mutex_unlock(&trace_lock);
+
+        U64 written = fwrite(events, sizeof(trace_event), count, trace_output);
+
+        pthread_mutex_lock(&trace_lock);
+
+        trace_written += written;
+        trace_dropped += count - written;
+        trace_pending = NULL;
+    }
+
+    pthread_mutex_unlock(&trace_lock);
+
+    return NULL;
+}
+
+// full half goes to the writer, dropped if the writer is still busy with the other one
+void trace_swap()
+{
+    pthread_mutex_lock(&trace_lock);
+
+    if (trace_pending == NULL)
+    {
+        trace_pending = trace_events;
+        trace_pending_count = trace_fill;
+        trace_events = (trace_events == trace_buffer) ? trace_buffer + TRACE_HALF : trace_buffer;
+
+        pthread_cond_signal(&trace_wake);
+    }
+    else
+        trace_dropped += trace_fill;
+
+    pthread_mutex_unlock(&trace_lock);
+
+    trace_fill = 0;
+}
+
+static inline void trace_add(int type, int decision, int ply, int depth, int alpha, int beta, int move)
+{
+    trace_event *event = &trace_events[trace_fill++];
+
+    event->move = move;
+    event->alpha = alpha, event->beta = beta;
+    event->ply = ply, event->depth = depth;
+    event->type = type, event->decision = decision;
+
+    if (trace_fill == TRACE_HALF)
+        trace_swap();
+}
+
+#define TRACE(type, decision, ply, depth, alpha, beta, move) \
+    do { if (trace_events) trace_add(type, decision, ply, depth, alpha, beta, move); } while (0)
+
+// set trace file, used from the next search on
+void set_trace_file(char *file_name)
+{
+    pthread_mutex_lock(&trace_lock);
+
+    if (strncmp(file_name, "<empty>", 7) == 0)
+        trace_file[0] = '\0';
+    else
+        strncpy(trace_file, file_name, sizeof(trace_file) - 1);
+
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// write block header of the current search (events and dropped as known so far)
+void trace_write_header()
+{
+    trace_header header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "JBTR", 4);
+    header.events = trace_written;
+    header.dropped = trace_dropped;
+    header.root = trace_root;
+
+    fseek(trace_output, trace_header_offset, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, trace_output);
+    fseek(trace_output, 0, SEEK_END);
+}
+
+// start recording a search from the current position, its block is appended to the trace file
+void trace_start()
+{
+    trace_events = NULL;
+    trace_fill = 0;
+
+    char file_name[256];
+
+    pthread_mutex_lock(&trace_lock);
+    strcpy(file_name, trace_file);
+    pthread_mutex_unlock(&trace_lock);
+
+    if (file_name[0] == '\0')
+        return;
+
+    if (!__sync_bool_compare_and_swap(&trace_busy, 0, 1))
+    {
+        report_string("trace file %s is in use by another search, not traced", file_name);
+        return;
+    }
+
+    // "r+b" lets the header be rewritten once the event count is known
+    trace_output = fopen(file_name, "r+b");
+
+    if (trace_output == NULL)
+        trace_output = fopen(file_name, "w+b");
+
+    trace_buffer = trace_output ? malloc(TRACE_EVENTS * sizeof(trace_event)) : NULL;
+
+    if (trace_buffer == NULL)
+    {
+        report_string("can't open trace file %s", file_name);
+
+        if (trace_output)
+            fclose(trace_output);
+
+        trace_output = NULL;
+        __sync_lock_release(&trace_busy);
+        return;
+    }
+
+    trace_written = trace_dropped = 0;
+
+    store_board_state(&trace_root);
+
+    fseek(trace_output, 0, SEEK_END);
+    trace_header_offset = ftell(trace_output);
+
+    trace_write_header();
+
+    trace_events = trace_buffer;
+    trace_pending = NULL;
+    trace_done = 0;
+
+    pthread_create(&trace_writer, NULL, trace_write_worker, NULL);
+}
+
+// write the rest of the events and the final header (called after the search)
+void trace_flush()
+{
+    if (trace_events == NULL)
+        return;
+
+    // writer finishes its half first so the events stay in order
+    pthread_mutex_lock(&trace_lock);
+    trace_done = 1;
+    pthread_cond_signal(&trace_wake);
+    pthread_mutex_unlock(&trace_lock);
+
+    pthread_join(trace_writer, NULL);
+
+    U64 written = fwrite(trace_events, sizeof(trace_event), trace_fill, trace_output);
+
+    trace_written += written;
+    trace_dropped += trace_fill - written;
+
+    trace_write_header();
+    fclose(trace_output);
+    free(trace_buffer);
+
+    trace_output = NULL;
+    trace_buffer = NULL;
+    trace_events = NULL;
+
+    // next search may trace
+    __sync_lock_release(&trace_busy);
+}
+
+#else
+
+#define TRACE(type, decision, ply, depth, alpha, beta, move) do { } while (0)
+
+#endif
+
+char *trace_search_names[] = { "full", "zero-window", "reduced", "re-search", "re-search-full", "null", "capture", "evasion", "check" };
+char *trace_result_names[] = { "score", "cutoff", "null-cutoff", "stand-pat", "mate", "stalemate" };
+
+// print search trees stored in a trace file, optionally limited to a ply and a line of root moves
+int trace_dump(char *file_name, int max_ply, char *path[], int path_length)
+{
+    FILE *file = fopen(file_name, "rb");
+
+    if (file == NULL)
+    {
+        printf("can't open trace file %s\n", file_name);
+        return 1;
+    }
+
+    trace_header header;
+
+    int search_count = 0;
+
+    while (fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "JBTR", 4) == 0)
+    {
+        search_count++;
+
+        load_board_state(&header.root);
+
+        printf("search %d: %llu events (%llu dropped)\n", search_count, header.events, header.dropped);
+        print_board();
+
+        // last move made at every ply, used to match the requested line
+        int line[256] = { 0 };
+
+        // window of the node open at every ply (tells fail-low, exact and fail-high apart)
+        int node_alpha[256] = { 0 }, node_beta[256] = { 0 };
+
+        trace_event event;
+
+        for (U64 index = 0; index < header.events && fread(&event, sizeof(event), 1, file) == 1; index++)
+        {
+            if (event.type == TRACE_MOVE)
+                line[event.ply] = event.move;
+
+            if (event.type == TRACE_NODE)
+                node_alpha[event.ply] = event.alpha, node_beta[event.ply] = event.beta;
+
+            if (event.ply > max_ply)
+                continue;
+
+            // only print events inside the requested subtree
+            int inside = 1;
+
+            for (int path_ply = 0; path_ply < path_length; path_ply++)
+            {
+                if (path_ply >= event.ply + (event.type == TRACE_MOVE))
+                    break;
+
+                char move_string[8];
+
+                sprintf(move_string, "%s%s", square_to_coordinates[get_move_source(line[path_ply])],
+                        square_to_coordinates[get_move_dest(line[path_ply])]);
+
+                if (strncmp(move_string, path[path_ply], 4) != 0)
+                    inside = 0;
+            }
+
+            if (!inside)
+                continue;
+
+            printf("%*s", event.ply * 2, "");
+
+            switch (event.type)
+            {
+                case TRACE_NODE:
+                    printf("%s ply %d depth %d window (%d, %d)\n", event.decision == NODE_MAIN ? "node" : "qnode",
+                           event.ply, event.depth, event.alpha, event.beta);
+                    break;
+
+                case TRACE_MOVE:
+                    if (event.move)
+                        print_move(event.move);
+                    else
+                        printf("null");
+
+                    printf(" %s depth %d window (%d, %d)\n", trace_search_names[event.decision], event.depth,
+                           event.alpha, event.beta);
+                    break;
+
+                case TRACE_RESULT:
+                    printf("= %d %s", event.alpha, trace_result_names[event.decision]);
+
+                    if (event.decision == RESULT_SCORE)
+                        printf(" (%s)", event.alpha <= node_alpha[event.ply] ? "fail-low"
+                                      : event.alpha >= node_beta[event.ply] ? "fail-high" : "exact");
+
+                    if (event.move)
+                    {
+                        printf(" by ");
+                        print_move(event.move);
+                    }
+
+                    printf("\n");
+                    break;
+            }
+        }
+    }
+
+    fclose(file);
+
+    return 0;
+}
+
+/*
+    Quiescence search: captures only, except that a side in check has to
+    answer it (all evasions, no standing pat, mated if there are none) and the
+    first quiescence ply also tries quiet moves that give check.
+*/
+static inline int quiescence(int alpha, int beta, int quiet_checks)
+{
+    // every 2047 nodes
+    if((nodes & 2047 ) == 0)
+        // "listen" to the GUI/user input
+        PROFILE(PHASE_COMMUNICATE, communicate());
+
+    nodes++;
+    STAT_INC(qsearch_nodes);
+    TRACE(TRACE_NODE, NODE_QSEARCH, ply, 0, alpha, beta, 0);
+
+    if(ply > seldepth)
+        seldepth = ply;
+
+    if(ply > MAX_PLY - 1)
+        return PROFILED(PHASE_EVALUATE, evaluate());
+
+    int is_check = PROFILED(PHASE_IS_SQUARE_ATTACKED,
+                            is_square_attacked(__builtin_ctzll(side == white ? bitboards[K] : bitboards[k]), side ^ 1));
+
+    // no standing pat in check
+    if(!is_check)
+    {
+        int eval = PROFILED(PHASE_EVALUATE, evaluate());
+
+        // fail-hard cutoff
+        if (eval >= beta)
+        {
+            TRACE(TRACE_RESULT, RESULT_STAND_PAT, ply, 0, beta, beta, 0);
+
+            // node fails high
+            return beta;
+        }
+
+        // found a better move than before
+        if (eval > alpha)
+        {
+            alpha = eval;
+        }
+    }
+
+    // squares from which each piece type checks the enemy king
+    U64 check_squares[6] = { 0ULL };
+
+    if(quiet_checks && !is_check)
+    {
+        int enemy_king = __builtin_ctzll(side == white ? bitboards[k] : bitboards[K]);
+
+        check_squares[P] = pawn_attacks[side ^ 1][enemy_king];
+        check_squares[N] = knight_attacks[enemy_king];
+        check_squares[B] = get_bishop_attacks(enemy_king, occupancies[both]);
+        check_squares[R] = get_rook_attacks(enemy_king, occupancies[both]);
+        check_squares[Q] = check_squares[B] | check_squares[R];
+    }
+
+    int legal_moves = 0;
+
+    moves move_list[1];
+
+    PROFILE(PHASE_GENERATE_MOVES, generate_moves(move_list));
+
+    PROFILE(PHASE_SORT_MOVES, sort_moves(move_list));
+
+    for(int move_count = 0; move_count < move_list->count; move_count++)
+    {
+        int move = get_list_move(move_list->moves[move_count]);
+
+        // quiet moves: evasions, or direct checks on the first ply
+        if(!is_check && !get_move_capture(move))
+        {
+            if(get_move_promoted(move) || get_move_castling(move) ||
+               !(check_squares[get_move_piece(move) % 6] & (1ULL << get_move_dest(move))))
+                continue;
+        }
+
+        copy_board();
+
+        ply++;
+
+        if(!PROFILED(PHASE_MAKE_MOVE, make_move(move, all_moves)))
+        {
+            ply--;
+            continue;
+        }
+
+        legal_moves++;
+
+        TRACE(TRACE_MOVE, is_check ? SEARCH_EVASION : get_move_capture(move) ? SEARCH_CAPTURE : SEARCH_CHECK,
+              ply - 1, 0, alpha, beta, move);
+
+        int score = -quiescence(-beta, -alpha, 0);
+
+        ply--;
+
+        take_back();
+
+        // return 0 if time is up
+        if(stopped == 1) return 0;
+
+        // fail-hard cutoff
+        if (score >= beta)
+        {
+            TRACE(TRACE_RESULT, RESULT_CUTOFF, ply, 0, beta, beta, move);
+
+            // node fails high
+            return beta;
+        }
+
+        // found a better move than before
+        if (score > alpha)
+        {
+            alpha = score;
+        }       
+    }
+
+    // checkmate
+    if(is_check && legal_moves == 0)
+    {
+        TRACE(TRACE_RESULT, RESULT_MATE, ply, 0, -49000 + ply, beta, 0);
+
+        return -49000 + ply;
+    }
+
+    TRACE(TRACE_RESULT, RESULT_SCORE, ply, 0, alpha, beta, 0);
+
+    return alpha;
+}
+
+
+const int full_depth_moves = 4;
+const int reduction_limit = 3;
+
+// null move: reduction of null_move_reduction + depth / 4, one more per
+// null_move_margin of static eval above beta (up to null_move_max_extra)
+const int null_move_reduction = 3;
+const int null_move_margin = 200;
+const int null_move_max_extra = 3;
+
+// null move cutoffs from this depth on are verified by a reduced search without null moves
+const int null_verify_depth = 10;
+
+// null move made at this ply (no second one right after it)
+THREAD_LOCAL int null_move_made[MAX_PLY];
+
+// no null moves before this ply (set during verification searches)
+THREAD_LOCAL int null_min_ply = 0;
+
+// side to move has pieces besides king and pawns (null move is unsafe in zugzwang prone endings)
+static inline int has_non_pawn_material()
+{
+    return (side == white) ? (bitboards[N] | bitboards[B] | bitboards[R] | bitboards[Q]) != 0
+                           : (bitboards[n] | bitboards[b] | bitboards[r] | bitboards[q]) != 0;
+}
+
+static inline int negamax(int depth, int alpha, int beta)
+{
+    // every 2047 nodes
+    if((nodes & 2047 ) == 0)
+        // "listen" to the GUI/user input
+        PROFILE(PHASE_COMMUNICATE, communicate());
+
+    pv_length[ply] = ply;
+
+    if (depth == 0)
+        return quiescence(alpha, beta, 1);
+        //return evaluate();
+
+    if(depth > MAX_PLY - 1)
+        return PROFILED(PHASE_EVALUATE, evaluate());
+
+    // tablebase hit: exact distance to mate (castling and en passant aren't in the tables)
+    if(ply && __builtin_popcountll(occupancies[both]) <= tb_pieces && castle == 0 && enpassant == no_sq)
+    {
+        int value;
+
+        if(tb_probe(&value))
+        {
+            if(value == TB_DRAW)
+                return 0;
+
+            return TB_IS_LOSS(value) ? -49000 + ply + TB_DISTANCE(value)
+                                     : 49000 - ply - TB_DISTANCE(value);
+        }
+    }
+
+    // KPK is settled by the bitbase, no need to search on
+    if(ply && __builtin_popcountll(occupancies[both]) == 3 && (bitboards[P] | bitboards[p]))
+        return PROFILED(PHASE_EVALUATE, evaluate());
+    
+    nodes++;
+    STAT_INC(main_nodes);
+    TRACE(TRACE_NODE, NODE_MAIN, ply, depth, alpha, beta, 0);
+
+    if(ply > seldepth)
+        seldepth = ply;
+
+    int is_check = PROFILED(PHASE_IS_SQUARE_ATTACKED,
+                            is_square_attacked(get_ls1b_index((side == white ? bitboards[K]
+                                                                             : bitboards[k])),
+                                                                             side ^ 1));
+
+    if(is_check) depth++;
+
+    int legal_moves = 0;
+
+    // Null Move Pruning: not twice in a row, not without pieces, only when static eval reaches beta
+    if(depth >= 3 && is_check == 0 && ply && ply >= null_min_ply && !null_move_made[ply - 1] &&
+       has_non_pawn_material())
+    {
+        int static_eval = PROFILED(PHASE_EVALUATE, evaluate());
+
+        if(static_eval >= beta)
+        {
+            // deeper searches and bigger margins reduce more
+            int extra = (static_eval - beta) / null_move_margin;
+            int reduced_depth = depth - null_move_reduction - depth / 4 -
+                                ((extra < null_move_max_extra) ? extra : null_move_max_extra);
+
+            if(reduced_depth < 0) reduced_depth = 0;
+
+            copy_board();
+
+            side ^= 1;
+            hash_key ^= side_key;
+
+            if(enpassant != no_sq)
+                hash_key ^= enpassant_keys[enpassant];
+
+            enpassant = no_sq;
+
+            STAT_INC(null_tries);
+            TRACE(TRACE_MOVE, SEARCH_NULL_MOVE, ply, reduced_depth, beta - 1, beta, 0);
+
+            null_move_made[ply] = 1;
+            ply++;
+
+            int score = -negamax(reduced_depth, -beta, -beta + 1);
+
+            ply--;
+            null_move_made[ply] = 0;
+
+            take_back();
+
+            if(stopped == 1) return 0;
+
+            // verify at high depth: same reduced search with our own move, no null moves near the top
+            if(score >= beta && depth >= null_verify_depth && null_min_ply == 0)
+            {
+                STAT_INC(null_verifications);
+
+                null_min_ply = ply + 3 * reduced_depth / 4;
+                score = negamax(reduced_depth, beta - 1, beta);
+                null_min_ply = 0;
+
+                if(stopped == 1) return 0;
+            }
+
+            if(score >= beta)
+            {
+                STAT_INC(null_cutoffs);
+                TRACE(TRACE_RESULT, RESULT_NULL_CUTOFF, ply, depth, beta, beta, 0);
+                return beta;
+            }
+        }
+    }
+
+    moves move_list[1];
+
+    PROFILE(PHASE_GENERATE_MOVES, generate_moves(move_list));
+
+    // make sure PV gets scored in sorting
+    if(follow_pv)
+        enable_PV_scoring(move_list);
+
+    PROFILE(PHASE_SORT_MOVES, sort_moves(move_list));
+
+    int moves_searched = 0;
+
+    for(int move_count = 0; move_count < move_list->count; move_count++)
+    {
+        int move = get_list_move(move_list->moves[move_count]);
+        
+        copy_board();
+
+        ply++;
+
+        if(!PROFILED(PHASE_MAKE_MOVE, make_move(move, all_moves)))
+        {
+            ply--;
+            continue;
+        }
+
+        legal_moves++;
+
+        // report root move on long searches
+        if(ply == 1 && get_time_ms() - search_start_time > CURRMOVE_DELAY)
+            report_currmove(move, legal_moves);
+
+        int score;
+
+        // PVS Search with Late Move Reduction
+        
+        if(moves_searched == 0)
+        {
+            TRACE(TRACE_MOVE, SEARCH_FULL, ply - 1, depth - 1, alpha, beta, move);
+            score = -negamax(depth-1, -beta, -alpha);
+        }
+
+        else
+        {
+            if(moves_searched >= full_depth_moves && depth >= reduction_limit && is_check == 0
+                && get_move_capture(move) == 0 && get_move_promoted(move) == 0) 
+            {
+                TRACE(TRACE_MOVE, SEARCH_REDUCED, ply - 1, depth - 2, alpha, alpha + 1, move);
+                score = -negamax(depth-2, -alpha-1, -alpha); // LMR
+                STAT_INC(lmr_reductions);
+
+                if(score > alpha)
+                    STAT_INC(lmr_researches);
+            }
+            else
+            {
+                score = alpha + 1;
+            }
+
+            if(score > alpha) //  PVS runs for captures, checks, promotions, first few moves and low depth searches
+            {
+                TRACE(TRACE_MOVE, (score == alpha + 1) ? SEARCH_ZERO_WINDOW : SEARCH_RESEARCH_ZERO,
+                      ply - 1, depth - 1, alpha, alpha + 1, move);
+                score = -negamax(depth-1, -alpha-1, -alpha);
+
+                if(score > alpha && score < beta)
+                {
+                    TRACE(TRACE_MOVE, SEARCH_RESEARCH_FULL, ply - 1, depth - 1, alpha, beta, move);
+                    score = -negamax(depth-1, -beta, -alpha);
+                }
+            }
+        }
+        
+        ply--;
+
+        take_back();
+
+        // return 0 if time is up
+        if(stopped == 1) return 0;
+
+        moves_searched++;
+
+        // fail-hard cutoff
+        if (score >= beta)
+        {
+            STAT_INC(cutoffs);
+
+            if(moves_searched == 1)
+                STAT_INC(first_move_cutoffs);
+
+            if(!get_move_capture(move))
+            {
+                killer_moves[1][ply] = killer_moves[0][ply];
+                killer_moves[0][ply] = move;
+            }
+
+            TRACE(TRACE_RESULT, RESULT_CUTOFF, ply, depth, beta, beta, move);
+
+            // node fails high
+            return beta;
+        }
+
+        // found a better move than before
+        if (score > alpha)
+        {
+            if(!get_move_capture(move))
+                history_moves[get_move_piece(move)][get_move_dest(move)] += depth;
+            alpha = score;
+
+            pv_table[ply][ply] = move;
+
+            for(int next_ply = ply + 1; next_ply < pv_length[ply+1]; next_ply++)
+                pv_table[ply][next_ply] = pv_table[ply+1][next_ply];
+
+            pv_length[ply] = pv_length[ply+1];
+
+        }       
+    }
+
+    if(legal_moves == 0)
+    {
+        TRACE(TRACE_RESULT, is_check ? RESULT_MATE : RESULT_STALEMATE, ply, depth, is_check ? -49000 + ply : 0, beta, 0);
+
+        if(is_check) // checkmate
+            return -49000 + ply;
+        else         // stalemate
+            return 0;
+    }
+
+    TRACE(TRACE_RESULT, RESULT_SCORE, ply, depth, alpha, beta, 0);
+
+    // node fails low
+    return alpha;
+}
+
+// max number of principal variations (UCI "MultiPV" option)
+#define MAX_MULTIPV 16
+
+// number of best lines to search
+THREAD_LOCAL int multipv = 1;
+
+// principal variation of one of the best root moves
+typedef struct {
+    int score;
+    int length;
+    int moves[MAX_PLY];
+} pv_line;
+
+// best lines of the current iteration, best first
+THREAD_LOCAL pv_line pv_lines[MAX_MULTIPV];
+
+// number of lines with an exact score in the current iteration
+THREAD_LOCAL int pv_line_count;
+
+// insert root move line (move + PV of the child node) into the sorted list of best lines
+static inline void add_pv_line(int move, int score)
+{
+    int index = (pv_line_count < multipv) ? pv_line_count++ : multipv - 1;
+
+    // shift weaker lines down
+    while (index > 0 && pv_lines[index - 1].score < score)
+    {
+        pv_lines[index] = pv_lines[index - 1];
+        index--;
+    }
+
+    pv_line *line = &pv_lines[index];
+
+    line->score = score;
+    line->moves[0] = move;
+    line->length = 1;
+
+    for (int next_ply = 1; next_ply < pv_length[1]; next_ply++)
+        line->moves[line->length++] = pv_table[1][next_ply];
+}
+
+// root move with the results of the last completed iteration
+typedef struct {
+    int move;
+    int score;      // exact score, or -50000 if the move didn't make it into the best lines
+    U64 nodes;      // nodes spent below the move
+} root_move;
+
+// legal root moves of the current search, searched in this order
+THREAD_LOCAL root_move root_moves[256];
+
+// number of root moves
+THREAD_LOCAL int root_move_count;
+
+// UCI "searchmoves" restriction for the next search (0 = all moves)
+THREAD_LOCAL int search_moves[256];
+THREAD_LOCAL int search_move_count = 0;
+
+// build root move list from legal moves, restricted to "searchmoves" if given
+void init_root_moves()
+{
+    moves move_list[1];
+
+    generate_moves(move_list);
+
+    // previous best line first, then the usual move ordering
+    enable_PV_scoring(move_list);
+    sort_moves(move_list);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        root_move_count = 0;
+
+        for(int move_count = 0; move_count < move_list->count; move_count++)
+        {
+            int move = get_list_move(move_list->moves[move_count]);
+
+            // skip moves outside of the requested ones (first pass only)
+            if (pass == 0 && search_move_count)
+            {
+                int allowed = 0;
+
+                for (int index = 0; index < search_move_count; index++)
+                {
+                    if (search_moves[index] == move)
+                        allowed = 1;
+                }
+
+                if (!allowed)
+                    continue;
+            }
+
+            copy_board();
+
+            if(!make_move(move, all_moves))
+                continue;
+
+            take_back();
+
+            root_moves[root_move_count].move = move;
+            root_moves[root_move_count].score = -50000;
+            root_moves[root_move_count].nodes = 0;
+            root_move_count++;
+        }
+
+        // no legal move left after the restriction: search everything
+        if (root_move_count || search_move_count == 0)
+            break;
+    }
+
+    // restriction holds for a single search
+    search_move_count = 0;
+}
+
+// order root moves for the next iteration: best lines first, then by subtree size
+void sort_root_moves()
+{
+    U64 keys[256];
+
+    for (int index = 0; index < root_move_count; index++)
+    {
+        keys[index] = root_moves[index].nodes;
+
+        for (int line = 0; line < pv_line_count; line++)
+        {
+            if (pv_lines[line].moves[0] == root_moves[index].move)
+                keys[index] = ~0ULL - line;
+        }
+    }
+
+    // stable insertion sort, descending
+    for (int index = 1; index < root_move_count; index++)
+    {
+        root_move current = root_moves[index];
+        U64 key = keys[index];
+
+        int next = index;
+
+        while (next > 0 && keys[next - 1] < key)
+        {
+            root_moves[next] = root_moves[next - 1];
+            keys[next] = keys[next - 1];
+            next--;
+        }
+
+        root_moves[next] = current;
+        keys[next] = key;
+    }
+}
+
+/*
+    Root search. With MultiPV n every root move is searched against the score
+    of the n-th best line found so far instead of the best one, so the n best
+    lines come out of a single pass over the root moves (killers, history and
+    PV ordering are shared) rather than n searches with excluded moves.
+*/
+static inline int search_root(int depth, int alpha, int beta)
+{
+    pv_length[0] = 0;
+    pv_line_count = 0;
+
+    nodes++;
+    STAT_INC(main_nodes);
+    TRACE(TRACE_NODE, NODE_MAIN, ply, depth, alpha, beta, 0);
+
+    int is_check = is_square_attacked(get_ls1b_index((side == white ? bitboards[K] : bitboards[k])), side ^ 1);
+
+    if(is_check) depth++;
+
+    for(int move_count = 0; move_count < root_move_count; move_count++)
+    {
+        root_move *root = &root_moves[move_count];
+
+        int move = root->move;
+
+        long start_nodes = nodes;
+        
+        copy_board();
+
+        ply++;
+
+        PROFILE(PHASE_MAKE_MOVE, make_move(move, all_moves));
+
+        // report root move on long searches
+        if(get_time_ms() - search_start_time > CURRMOVE_DELAY)
+            report_currmove(move, move_count + 1);
+
+        // a move has to beat the weakest of the best lines to become one
+        int bound = (pv_line_count < multipv) ? alpha : pv_lines[multipv - 1].score;
+
+        if (bound < alpha)
+            bound = alpha;
+
+        int score;
+
+        // PVS Search with Late Move Reduction
+        
+        if(move_count == 0)
+        {
+            TRACE(TRACE_MOVE, SEARCH_FULL, ply - 1, depth - 1, bound, beta, move);
+            score = -negamax(depth-1, -beta, -bound);
+        }
+
+        else
+        {
+            if(move_count >= full_depth_moves && depth >= reduction_limit && is_check == 0
+                && get_move_capture(move) == 0 && get_move_promoted(move) == 0) 
+            {
+                TRACE(TRACE_MOVE, SEARCH_REDUCED, ply - 1, depth - 2, bound, bound + 1, move);
+                score = -negamax(depth-2, -bound-1, -bound); // LMR
+                STAT_INC(lmr_reductions);
+
+                if(score > bound)
+                    STAT_INC(lmr_researches);
+            }
+            else
+            {
+                score = bound + 1;
+            }
+
+            if(score > bound)
+            {
+                TRACE(TRACE_MOVE, (score == bound + 1) ? SEARCH_ZERO_WINDOW : SEARCH_RESEARCH_ZERO,
+                      ply - 1, depth - 1, bound, bound + 1, move);
+                score = -negamax(depth-1, -bound-1, -bound);
+
+                if(score > bound && score < beta)
+                {
+                    TRACE(TRACE_MOVE, SEARCH_RESEARCH_FULL, ply - 1, depth - 1, bound, beta, move);
+                    score = -negamax(depth-1, -beta, -bound);
+                }
+            }
+        }
+        
+        ply--;
+
+        take_back();
+
+        // return 0 if time is up
+        if(stopped == 1) return 0;
+
+        root->nodes = nodes - start_nodes;
+        root->score = (score > bound && score < beta) ? score : -50000;
+
+        // fail-hard cutoff
+        if (score >= beta)
+        {
+            STAT_INC(cutoffs);
+
+            if(move_count == 0)
+                STAT_INC(first_move_cutoffs);
+
+            if(!get_move_capture(move))
+            {
+                killer_moves[1][ply] = killer_moves[0][ply];
+                killer_moves[0][ply] = move;
+            }
+
+            TRACE(TRACE_RESULT, RESULT_CUTOFF, ply, depth, beta, beta, move);
+
+            // root fails high
+            return beta;
+        }
+
+        // found one of the best lines
+        if (score > bound)
+        {
+            if(!get_move_capture(move))
+                history_moves[get_move_piece(move)][get_move_dest(move)] += depth;
+
+            add_pv_line(move, score);
+        }
+    }
+
+    if(root_move_count == 0)
+    {
+        TRACE(TRACE_RESULT, is_check ? RESULT_MATE : RESULT_STALEMATE, ply, depth, is_check ? -49000 : 0, beta, 0);
+
+        // checkmate or stalemate
+        return is_check ? -49000 : 0;
+    }
+
+    // root fails low
+    if(pv_line_count == 0)
+    {
+        TRACE(TRACE_RESULT, RESULT_SCORE, ply, depth, alpha, beta, 0);
+        return alpha;
+    }
+
+    // best line is the principal variation
+    memcpy(pv_table[0], pv_lines[0].moves, pv_lines[0].length * sizeof(int));
+    pv_length[0] = pv_lines[0].length;
+
+    TRACE(TRACE_RESULT, RESULT_SCORE, ply, depth, pv_lines[0].score, beta, 0);
+
+    return pv_lines[0].score;
+}
+
+// shift last search's killers and PV by the plies played since, and age history
+void warm_start()
+{
+    int shift = warm_start_plies;
+
+    // killers found at ply n + shift are now at ply n
+    for (int id = 0; id < 2; id++)
+    {
+        memmove(killer_moves[id], killer_moves[id] + shift, (MAX_PLY - shift) * sizeof(int));
+        memset(killer_moves[id] + MAX_PLY - shift, 0, shift * sizeof(int));
+    }
+
+    // old history counts matter less than the ones found in this search
+    for (int piece = 0; piece < 12; piece++)
+    {
+        for (int square = 0; square < 64; square++)
+            history_moves[piece][square] /= 2;
+    }
+
+    // keep the rest of the predicted line if the game followed it
+    int predicted = pv_length[0] > shift;
+
+    for (int index = 0; index < shift; index++)
+    {
+        if (pv_table[0][index] != warm_start_moves[index])
+            predicted = 0;
+    }
+
+    int length = predicted ? pv_length[0] - shift : 0;
+
+    int line[MAX_PLY];
+
+    memcpy(line, pv_table[0] + shift, length * sizeof(int));
+
+    memset(pv_table, 0, sizeof(pv_table));
+    memset(pv_length, 0, sizeof(pv_length));
+
+    // seed PV ordering of the first iterations with the predicted line
+    memcpy(pv_table[0], line, length * sizeof(int));
+    pv_length[0] = length;
+}
+
+// write space separated UCI moves of a line into buffer (at least 6 * MAX_PLY bytes)
+void line_to_string(pv_line *line, char *buffer)
+{
+    buffer[0] = '\0';
+
+    for (int index = 0; index < line->length; index++)
+    {
+        if (index)
+            strcat(buffer, " ");
+
+        move_to_string(line->moves[index], buffer + strlen(buffer));
+    }
+}
+
+// size of an "info" line buffer
+#define INFO_LINE_SIZE (128 + 6 * MAX_PLY)
+
+// write UCI "info" line of one of the best lines into buffer (INFO_LINE_SIZE bytes)
+void format_info_line(char *buffer, int depth, int line, int time)
+{
+    int length = sprintf(buffer, "info score cp %d depth %d seldepth %d ", pv_lines[line].score, depth, seldepth);
+
+    if (multipv > 1)
+        length += sprintf(buffer + length, "multipv %d ", line + 1);
+
+    length += sprintf(buffer + length, "nodes %ld time %d nps %ld pv ", nodes, time, nodes * 1000 / (time ? time : 1));
+
+    line_to_string(&pv_lines[line], buffer + length);
+}
+
+// print UCI "bestmove" line ("0000" if there is no legal move)
+void print_bestmove(int move)
+{
+    printf("bestmove ");
+
+    if (move)
+        print_move(move);
+    else
+        printf("0000");
+
+    printf("\n");
+}
+
+// bestmove hook (NULL prints the UCI "bestmove" line), info hooks see report_currmove
+THREAD_LOCAL void (*bestmove_hook)(int move, pv_line *line) = NULL;
+
+void search_position(int depth)
+{
+    // reset data from a previous search
+    nodes = 0;
+
+    // reset "time is up" flag
+    stopped = 0;
+
+    // PV score flags
+    follow_pv = 0;
+    score_pv = 0;
+
+    // reset selective depth and timer used in "info" output
+    seldepth = 0;
+    search_start_time = get_time_ms();
+
+#ifdef SEARCH_STATS
+    memset(&stats, 0, sizeof(stats));
+#endif
+
+#ifdef SEARCH_TRACE
+    trace_start();
+#endif
+
+#ifdef SEARCH_PROFILE
+    profile_start();
+#endif
+
+    // continuing the previous game: keep move ordering data from the last search
+    if (warm_start_plies)
+        warm_start();
+
+    else
+    {
+        memset(killer_moves, 0, sizeof(killer_moves));
+        memset(history_moves, 0, sizeof(history_moves));
+        memset(pv_table, 0, sizeof(pv_table));
+        memset(pv_length, 0, sizeof(pv_length));
+    }
+
+    warm_start_plies = 0;
+
+    // legal (and requested) root moves
+    init_root_moves();
+
+    //Iterative deepening
+    int alpha = -50000, beta = 50000;
+    int best_move_so_far = 0;
+
+    // best line of the last completed iteration
+    pv_line best_line = { 0 };
+
+    for(int current_depth = 1; current_depth <= depth; current_depth++)
+    {        
+        // if time is up
+        if(stopped == 1)
+            // stop calculating and return best move so far 
+            break;
+
+        follow_pv = 1;
+        int score = search_root(current_depth, alpha, beta); // -50000 is -inf and 50000 is +inf
+
+        if((score <= alpha) || (score >= beta)) // if value falls out of narrow window reset window len with infs
+        {
+            alpha = -50000;
+            beta = 50000;
+            continue;
+        }
+
+        // Improvement on Iterative deepening
+        // Assume the newer vals will be close to the previous one
+        // Adjust the alpha-beta window accordingly
+        // (several lines need exact scores far below the best one, so no window then)
+        if (multipv == 1)
+        {
+            alpha = score - 50;
+            beta = score + 50;
+        }
+
+        // next iteration searches best lines first, then the moves with the biggest subtrees
+        sort_root_moves();
+
+        int time = get_time_ms() - search_start_time;
+
+        for (int line = 0; line < pv_line_count; line++)
+        {
+            if (info_hook)
+                info_hook(current_depth, line, time);
+
+            else
+            {
+                char info[INFO_LINE_SIZE];
+
+                format_info_line(info, current_depth, line, time);
+                printf("%s\n", info);
+            }
+        }
+
+#ifdef SEARCH_STATS
+        stats.iteration_nodes[current_depth] = nodes;
+        stats.last_depth = current_depth;
+
+        print_search_stats();
+#endif
+        
+        best_move_so_far = pv_table[0][0];  
+
+        if (pv_line_count)
+            best_line = pv_lines[0];
+    }
+
+#ifdef SEARCH_PROFILE
+    print_profile();
+#endif
+
+    int best_move = (stopped == 0) ? pv_table[0][0] : best_move_so_far;
+
+    // mate or stalemate at the root
+    if (root_move_count == 0)
+        best_move = 0;
+
+    // stopped before the first iteration completed: first root move in search order
+    else if (best_move == 0)
+        best_move = root_moves[0].move;
+
+    if (bestmove_hook)
+        bestmove_hook(best_move, &best_line);
+    else
+        print_bestmove(best_move);
+
+#ifdef SEARCH_TRACE
+    // write trace after the move is out
+    trace_flush();
+#endif
+}
+
+
+/****************************************************************
+ * 
+ * 
+ * 
+ *                          BENCHMARK
+ * 
+ * 
+ *
+ * **************************************************************/
+
+// default bench search depth
+#define BENCH_DEPTH 7
+
+// fixed bench positions, total node count is the search signature of a build
+char *bench_positions[] = {
+    start_position,
+    tricky_position,
+    killer_position,
+    cmk_position,
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1 ",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1 ",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10 ",
+    "8/8/1p1k4/pPp1p3/P1P1P3/3K4/8/8 w - - 0 1 "
+};
+
+// search every bench position to a fixed depth, print node signature and speed
+void bench(int depth)
+{
+    if (depth < 1)
+        depth = BENCH_DEPTH;
+
+    // bench positions don't continue the game, next "position" command starts over
+    reset_session();
+
+    // deterministic search: no time control and no GUI input
+    int old_timeset = timeset;
+    timeset = 0;
+    poll_input = 0;
+
+    int position_count = sizeof(bench_positions) / sizeof(bench_positions[0]);
+
+    U64 total_nodes = 0;
+
+    int start = get_time_ms();
+
+    for (int index = 0; index < position_count; index++)
+    {
+        printf("info string bench position %d/%d %s\n", index + 1, position_count, bench_positions[index]);
+
+        parse_fen(bench_positions[index]);
+
+        search_position(depth);
+
+        total_nodes += nodes;
+    }
+
+    int time = get_time_ms() - start;
+
+    printf("\n===========================\n");
+    printf("Total time (ms) : %d\n", time);
+    printf("Nodes searched  : %llu\n", total_nodes);
+    printf("Nodes/second    : %llu\n", total_nodes * 1000 / (time ? time : 1));
+
+    timeset = old_timeset;
+    poll_input = 1;
+}
+
+
+/****************************************************************
+ * 
+ * 
+ * 
+ *                      BATCH ANALYSIS
+ * 
+ * 
+ *
+ * **************************************************************/
+
+/*
+    Batch analysis of an EPD / FEN file ("Jabberook analyze")
+
+    Worker threads take positions from the input one at a time and search
+    them on their own board and search state. Results go to the output file
+    in input order, one EPD line per position (best move in UCI notation):
+
+    <position> bm <move>; ce <centipawns>; acd <depth>; acn <nodes>;
+
+    rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - bm e2e4; ce 30; acd 8; acn 61287;
+
+    Positions without a legal move get no bm: "ce -49000; c0 "checkmate";"
+    or "ce 0; c0 "stalemate";".
+
+    Lines starting with '#' and blank lines are skipped, anything after the
+    four position fields (EPD operations, FEN move counters) is ignored. Every
+    other line gets a result, lines with fewer than four fields or an illegal
+    position get "c0 "invalid position";" so output lines match input lines.
+*/
+
+// default analysis depth
+#define ANALYSIS_DEPTH 8
+
+// positions in flight (searched or waiting to be written in order)
+#define ANALYSIS_WINDOW (16 * MAX_THREADS)
+
+// position in flight
+typedef struct {
+    char position[128];             // the four EPD position fields
+    char result[128];               // EPD operations
+    int done;
+} analysis_slot;
+
+// shared state of the analysis
+typedef struct {
+    FILE *input;
+    FILE *output;
+    int depth;
+    int movetime;
+
+    // positions are numbered in input order, written once all before them are out
+    analysis_slot slots[ANALYSIS_WINDOW];
+    U64 next_read, next_write;
+    int input_done;
+    pthread_mutex_t lock;
+    pthread_cond_t window;
+
+    // totals
+    U64 nodes;
+    U64 invalid;
+} analysis_job;
+
+// last completed iteration of the thread's search
+THREAD_LOCAL int analysis_depth, analysis_score, analysis_move;
+
+// search info hook: remember depth of the best line
+static void analysis_info(int depth, int line, int time)
+{
+    (void)time;
+
+    if (line == 0)
+        analysis_depth = depth;
+}
+
+// search bestmove hook
+static void analysis_bestmove(int move, pv_line *line)
+{
+    analysis_move = move;
+    analysis_score = line->score;
+}
+
+// copy the four position fields of an EPD / FEN line, returns 0 if there are fewer
+int epd_position(char *line, char *position, int size)
+{
+    int length = 0;
+
+    for (int field = 0; field < 4; field++)
+    {
+        while (*line == ' ' || *line == '\t')
+            line++;
+
+        if (*line == '\0' || *line == '\n' || *line == '\r' || *line == ';')
+            return 0;
+
+        if (field)
+            position[length++] = ' ';
+
+        while (*line && !isspace((unsigned char)*line) && *line != ';' && length < size - 2)
+            position[length++] = *line++;
+    }
+
+    position[length] = '\0';
+
+    return 1;
+}
+
+// one king per side and the side that just moved not in check
+int position_is_valid()
+{
+    if (count_bits(bitboards[K]) != 1 || count_bits(bitboards[k]) != 1)
+        return 0;
+
+    int king = get_ls1b_index(bitboards[(side == white) ? k : K]);
+
+    return !is_square_attacked(king, side);
+}
+
+// worker: take positions until the input is exhausted
+void *analysis_worker(void *arg)
+{
+    analysis_job *job = arg;
+
+    poll_input = 0;
+    info_hook = analysis_info;
+    bestmove_hook = analysis_bestmove;
+
+    char line[1024];
+
+    pthread_mutex_lock(&job->lock);
+
+    while (1)
+    {
+        // don't run more than a window ahead of the writer
+        while (!job->input_done && job->next_read - job->next_write >= ANALYSIS_WINDOW)
+            pthread_cond_wait(&job->window, &job->lock);
+
+        if (job->input_done)
+            break;
+
+        if (!fgets(line, sizeof(line), job->input))
+        {
+            job->input_done = 1;
+            break;
+        }
+
+        // skip comments and blank lines
+        char *text = line + strspn(line, " \t");
+
+        if (*text == '#' || *text == '\0' || *text == '\n' || *text == '\r')
+            continue;
+
+        analysis_slot *slot = &job->slots[job->next_read % ANALYSIS_WINDOW];
+
+        int complete = epd_position(text, slot->position, sizeof(slot->position));
+
+        // line missing position fields: echoed up to the operations as an invalid position
+        if (!complete)
+        {
+            text[strcspn(text, ";\r\n")] = '\0';
+
+            for (int length = strlen(text); length && isspace((unsigned char)text[length - 1]); length--)
+                text[length - 1] = '\0';
+
+            snprintf(slot->position, sizeof(slot->position), "%s", text);
+        }
+
+        job->next_read++;
+        slot->done = 0;
+
+        pthread_mutex_unlock(&job->lock);
+
+        // parse_fen expects a separator after the last field
+        char fen[sizeof(slot->position) + 1];
+
+        if (complete)
+        {
+            sprintf(fen, "%s ", slot->position);
+            parse_fen(fen);
+        }
+
+        U64 searched = 0;
+
+        if (!complete || !position_is_valid())
+        {
+            strcpy(slot->result, "c0 \"invalid position\";");
+            __sync_fetch_and_add(&job->invalid, 1);
+        }
+
+        else
+        {
+            // every position is searched from scratch
+            warm_start_plies = 0;
+            search_move_count = 0;
+            analysis_depth = analysis_score = analysis_move = 0;
+
+            timeset = (job->movetime > 0);
+            starttime = get_time_ms();
+            stoptime = starttime + job->movetime;
+
+            search_position(job->depth);
+
+            // no legal move: mate score (same scale as the search) or draw, no bm
+            if (analysis_move == 0)
+            {
+                int king = get_ls1b_index(bitboards[(side == white) ? K : k]);
+
+                if (is_square_attacked(king, side ^ 1))
+                    strcpy(slot->result, "ce -49000; c0 \"checkmate\";");
+                else
+                    strcpy(slot->result, "ce 0; c0 \"stalemate\";");
+            }
+
+            else
+            {
+                char move[6];
+
+                move_to_string(analysis_move, move);
+                sprintf(slot->result, "bm %s; ce %d; acd %d; acn %ld;", move, analysis_score, analysis_depth, nodes);
+            }
+
+            searched = nodes;
+        }
+
+        pthread_mutex_lock(&job->lock);
+
+        slot->done = 1;
+        job->nodes += searched;
+
+        // write every finished position that is next in input order
+        while (job->next_write < job->next_read && job->slots[job->next_write % ANALYSIS_WINDOW].done)
+        {
+            analysis_slot *next = &job->slots[job->next_write % ANALYSIS_WINDOW];
+
+            fprintf(job->output, "%s %s\n", next->position, next->result);
+            job->next_write++;
+        }
+
+        pthread_cond_broadcast(&job->window);
+    }
+
+    // wake workers waiting for the window
+    pthread_cond_broadcast(&job->window);
+    pthread_mutex_unlock(&job->lock);
+
+    return NULL;
+}
+
+// analyse every position of an EPD / FEN file, returns 0 on success
+int analyze_file(char *input_file, char *output_file, int depth, int movetime)
+{
+    static analysis_job job;
+
+    memset(&job, 0, sizeof(job));
+
+    job.input = fopen(input_file, "r");
+
+    if (job.input == NULL)
+    {
+        printf("analyze: could not open %s\n", input_file);
+        return 1;
+    }
+
+    job.output = fopen(output_file, "w");
+
+    if (job.output == NULL)
+    {
+        printf("analyze: could not create %s\n", output_file);
+        fclose(job.input);
+        return 1;
+    }
+
+    // movetime alone means no depth limit
+    job.depth = (depth > 0) ? depth : (movetime > 0) ? 64 : ANALYSIS_DEPTH;
+    job.movetime = movetime;
+
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.window, NULL);
+
+    int start = get_time_ms();
+
+    pthread_t workers[MAX_THREADS];
+
+    for (int index = 0; index < threads; index++)
+        pthread_create(&workers[index], NULL, analysis_worker, &job);
+
+    for (int index = 0; index < threads; index++)
+        pthread_join(workers[index], NULL);
+
+    int time = get_time_ms() - start;
+
+    fclose(job.input);
+    fclose(job.output);
+
+    printf("Positions       : %llu (%llu invalid)\n", job.next_write, job.invalid);
+    printf("Total time (ms) : %d\n", time);
+    printf("Nodes searched  : %llu\n", job.nodes);
+    printf("Nodes/second    : %llu\n", job.nodes * 1000 / (time ? time : 1));
+
+    return 0;
+}
+
+
+/****************************************************************
+ * 
+ * 
+ * 
+ *                      TRAINING DATA
+ * 
+ * 
+ *
+ * **************************************************************/
+
+/*
+    Self-play data generation ("Jabberook datagen") and packed positions
+
+    Every worker plays games from a few random opening moves, searches each
+    position to a node (or depth) limit and records quiet positions with the
+    search score. Once the game is over its positions get the result and go
+    to the worker's write buffer, full buffers are appended to the output
+    file. Memory stays at one game and one buffer per worker.
+
+    packed position (32 bytes, little endian):
+
+    bytes 0-7    occupied squares (bit n = square n, a8 = 0)
+    bytes 8-23   4 bit piece codes (P-k = 0-11) of the occupied squares in
+                 square order, low nibble first
+    bytes 24-25  search score in centipawns from the side to move, clamped
+                 to +-PACKED_SCORE_LIMIT (mate scores come out as the limit)
+    bytes 26-27  best move (16 bit move encoding)
+    byte 28      side to move (bit 0), castling rights (bits 1-4)
+    byte 29      en passant square (64 = none)
+    byte 30      game result for white: 0 loss, 1 draw, 2 win
+    byte 31      ply of the game (255 = 255 or later)
+*/
+
+// size of a packed position
+#define PACKED_SIZE 32
+
+// biggest packed score (fits 16 bits, mates are stored as this)
+#define PACKED_SCORE_LIMIT 32000
+
+// default search limits and random opening length
+#define DATAGEN_NODES 5000
+#define DATAGEN_RANDOM_PLIES 8
+
+// positions per worker write buffer
+#define DATAGEN_BUFFER 8192
+
+// games longer than this are drawn
+#define DATAGEN_MAX_PLIES 400
+
+// adjudication: win once the score stays beyond this for 4 plies, draw after
+// DATAGEN_DRAW_PLY plies of scores within DATAGEN_DRAW_SCORE for 8 plies
+#define DATAGEN_WIN_SCORE 2000
+#define DATAGEN_DRAW_PLY 80
+#define DATAGEN_DRAW_SCORE 10
+
+// pack current position with its score, best move and game ply
+void pack_position(unsigned char *bytes, int score, int move, int game_ply)
+{
+    memset(bytes, 0, PACKED_SIZE);
+
+    U64 occupied = occupancies[both];
+
+    for (int byte = 0; byte < 8; byte++)
+        bytes[byte] = occupied >> (8 * byte);
+
+    int index = 0;
+
+    while (occupied)
+    {
+        int square = get_ls1b_index(occupied);
+
+        int piece = P;
+
+        while (!get_bit(bitboards[piece], square))
+            piece++;
+
+        bytes[8 + index / 2] |= piece << (4 * (index & 1));
+        index++;
+
+        pop_bit(occupied, square);
+    }
+
+    if (score > PACKED_SCORE_LIMIT) score = PACKED_SCORE_LIMIT;
+    if (score < -PACKED_SCORE_LIMIT) score = -PACKED_SCORE_LIMIT;
+
+    bytes[24] = score & 0xff;
+    bytes[25] = (score >> 8) & 0xff;
+    bytes[26] = move & 0xff;
+    bytes[27] = move >> 8;
+    bytes[28] = side | castle << 1;
+    bytes[29] = (enpassant == no_sq) ? 64 : enpassant;
+    bytes[31] = (game_ply > 255) ? 255 : game_ply;
+}
+
+// load packed position onto the board, score / move / result may be NULL
+void unpack_position(const unsigned char *bytes, int *score, int *move, int *result)
+{
+    memset(bitboards, 0, sizeof(bitboards));
+    memset(occupancies, 0, sizeof(occupancies));
+
+    U64 occupied = 0;
+
+    for (int byte = 0; byte < 8; byte++)
+        occupied |= (U64)bytes[byte] << (8 * byte);
+
+    int index = 0;
+
+    while (occupied)
+    {
+        int square = get_ls1b_index(occupied);
+
+        int piece = (bytes[8 + index / 2] >> (4 * (index & 1))) & 15;
+
+        set_bit(bitboards[piece], square);
+        index++;
+
+        pop_bit(occupied, square);
+    }
+
+    for (int piece = P; piece <= K; piece++)
+        occupancies[white] |= bitboards[piece];
+
+    for (int piece = p; piece <= k; piece++)
+        occupancies[black] |= bitboards[piece];
+
+    occupancies[both] = occupancies[white] | occupancies[black];
+
+    side = bytes[28] & 1;
+    castle = (bytes[28] >> 1) & 15;
+    enpassant = (bytes[29] == 64) ? no_sq : bytes[29];
+
+    hash_key = generate_hash_key();
+
+    if (score) *score = (short)(bytes[24] | bytes[25] << 8);
+    if (move) *move = bytes[26] | bytes[27] << 8;
+    if (result) *result = bytes[30];
+}
+
+// shared state of the generator
+typedef struct {
+    FILE *output;
+    pthread_mutex_t lock;
+
+    // settings
+    U64 games;
+    long nodes;
+    int depth;
+    int random_plies;
+
+    // progress
+    U64 next_game;
+    U64 finished_games;
+    U64 positions;
+    int start;
+} datagen_job;
+
+// result of the thread's last search
+THREAD_LOCAL int datagen_score, datagen_move;
+
+// search bestmove hook
+static void datagen_bestmove(int move, pv_line *line)
+{
+    datagen_move = move;
+    datagen_score = line->score;
+}
+
+// search info hook: quiet
+static void datagen_info(int depth, int line, int time)
+{
+    (void)depth, (void)line, (void)time;
+}
+
+// xorshift64 for random openings
+static inline U64 datagen_random(U64 *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+// legal moves of the current position, returns count
+int legal_moves(moves *legal)
+{
+    moves move_list[1];
+
+    generate_moves(move_list);
+
+    legal->count = 0;
+
+    for (int count = 0; count < move_list->count; count++)
+    {
+        copy_board();
+
+        if (make_move(move_list->moves[count], all_moves))
+            add_move(legal, move_list->moves[count]);
+
+        take_back();
+    }
+
+    return legal->count;
+}
+
+// no pawns, rooks or queens and at most one minor piece
+static inline int insufficient_material()
+{
+    if (bitboards[P] | bitboards[p] | bitboards[R] | bitboards[r] | bitboards[Q] | bitboards[q])
+        return 0;
+
+    return count_bits(bitboards[N] | bitboards[n] | bitboards[B] | bitboards[b]) <= 1;
+}
+
+// append a finished game to the write buffer, flush the buffer when full
+void datagen_store(datagen_job *job, unsigned char *buffer, int *buffered, unsigned char *game, int count, int result)
+{
+    for (int index = 0; index < count; index++)
+    {
+        game[index * PACKED_SIZE + 30] = result;
+
+        memcpy(buffer + (*buffered)++ * PACKED_SIZE, game + index * PACKED_SIZE, PACKED_SIZE);
+
+        if (*buffered == DATAGEN_BUFFER)
+        {
+            pthread_mutex_lock(&job->lock);
+            fwrite(buffer, PACKED_SIZE, *buffered, job->output);
+            pthread_mutex_unlock(&job->lock);
+
+            *buffered = 0;
+        }
+    }
+
+    pthread_mutex_lock(&job->lock);
+
+    job->finished_games++;
+    job->positions += count;
+
+    // progress every 100 games
+    if (job->finished_games % 100 == 0 || job->finished_games == job->games)
+    {
+        int time = get_time_ms() - job->start;
+
+        printf("games %llu/%llu positions %llu positions/hour %llu\n", job->finished_games, job->games, job->positions,
+               job->positions * 3600000ULL / (time ? time : 1));
+    }
+
+    pthread_mutex_unlock(&job->lock);
+}
+
+// play one game, returns result for white (0 loss, 1 draw, 2 win) and stores positions in game
+int datagen_game(datagen_job *job, U64 *random_state, unsigned char *game, int *count)
+{
+    moves legal[1];
+
+    // random opening, start over if it ends the game
+    int ply;
+
+    do
+    {
+        parse_fen(start_position);
+
+        for (ply = 0; ply < job->random_plies; ply++)
+        {
+            if (!legal_moves(legal))
+                break;
+
+            make_move(legal->moves[datagen_random(random_state) % legal->count], all_moves);
+        }
+    }
+    while (ply < job->random_plies || !legal_moves(legal));
+
+    U64 history[DATAGEN_MAX_PLIES + 1];
+    int irreversible = 0;
+    int win_plies = 0, draw_plies = 0;
+
+    *count = 0;
+    warm_start_plies = 0;
+
+    for (int game_ply = 0; game_ply < DATAGEN_MAX_PLIES; game_ply++)
+    {
+        history[game_ply] = hash_key;
+
+        // repetition since the last capture or pawn move
+        for (int index = game_ply - 2; index >= irreversible; index -= 2)
+        {
+            if (history[index] == hash_key)
+                return 1;
+        }
+
+        // fifty move rule
+        if (game_ply - irreversible >= 100 || insufficient_material())
+            return 1;
+
+        int in_check = is_square_attacked(get_ls1b_index(bitboards[(side == white) ? K : k]), side ^ 1);
+
+        node_limit = job->nodes;
+        search_move_count = 0;
+
+        search_position(job->depth);
+
+        int move = datagen_move, score = datagen_score;
+
+        // mate or stalemate
+        if (move == 0)
+            return in_check ? ((side == white) ? 0 : 2) : 1;
+
+        int white_score = (side == white) ? score : -score;
+
+        // adjudication
+        win_plies = (abs(score) >= DATAGEN_WIN_SCORE) ? win_plies + 1 : 0;
+        draw_plies = (game_ply >= DATAGEN_DRAW_PLY && abs(score) <= DATAGEN_DRAW_SCORE) ? draw_plies + 1 : 0;
+
+        if (win_plies >= 4)
+            return (white_score > 0) ? 2 : 0;
+
+        if (draw_plies >= 8)
+            return 1;
+
+        // keep quiet positions only: not in check, best move not tactical
+        if (!in_check && !get_move_capture(move) && !(move & 0x8000))
+            pack_position(game + (*count)++ * PACKED_SIZE, score, move, game_ply + job->random_plies);
+
+        if (get_move_capture(move) || get_move_piece(move) % 6 == P)
+            irreversible = game_ply + 1;
+
+        make_move(move, all_moves);
+
+        // next search continues this one
+        warm_start_plies = 1;
+        warm_start_moves[0] = move;
+    }
+
+    return 1;
+}
+
+// worker: play games until enough are done
+void *datagen_worker(void *arg)
+{
+    datagen_job *job = arg;
+
+    poll_input = 0;
+    timeset = 0;
+    info_hook = datagen_info;
+    bestmove_hook = datagen_bestmove;
+
+    unsigned char *buffer = malloc(DATAGEN_BUFFER * PACKED_SIZE);
+    unsigned char *game = malloc(DATAGEN_MAX_PLIES * PACKED_SIZE);
+    int buffered = 0;
+
+    U64 random_state = (U64)get_time_ns() ^ ((U64)(size_t)&random_state * 0x9E3779B97F4A7C15ULL);
+
+    if (random_state == 0)
+        random_state = 88172645463325252ULL;
+
+    while (__sync_fetch_and_add(&job->next_game, 1) < job->games)
+    {
+        int count;
+        int result = datagen_game(job, &random_state, game, &count);
+
+        datagen_store(job, buffer, &buffered, game, count, result);
+    }
+
+    // rest of the buffer
+    if (buffered)
+    {
+        pthread_mutex_lock(&job->lock);
+        fwrite(buffer, PACKED_SIZE, buffered, job->output);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    free(buffer);
+    free(game);
+
+    return NULL;
+}
+
+// play self-play games and write packed positions, returns 0 on success
+int datagen(char *output_file, U64 games, long nodes, int depth, int random_plies)
+{
+    static datagen_job job;
+
+    memset(&job, 0, sizeof(job));
+
+    job.output = fopen(output_file, "ab");
+
+    if (job.output == NULL)
+    {
+        printf("datagen: could not open %s\n", output_file);
+        return 1;
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+
+    job.games = games;
+    job.nodes = nodes;
+    job.depth = (depth > 0) ? depth : 64;
+    job.random_plies = random_plies;
+    job.start = get_time_ms();
+
+    pthread_t workers[MAX_THREADS];
+
+    for (int index = 0; index < threads; index++)
+        pthread_create(&workers[index], NULL, datagen_worker, &job);
+
+    for (int index = 0; index < threads; index++)
+        pthread_join(workers[index], NULL);
+
+    fclose(job.output);
+
+    printf("datagen: %llu games, %llu positions written to %s\n", job.finished_games, job.positions, output_file);
+
+    return 0;
+}
+
+// convert packed positions to "<fen> | <score> | <result>" lines (score and result for white)
+int dataconvert(char *input_file, char *output_file)
+{
+    FILE *input = fopen(input_file, "rb");
+
+    if (input == NULL)
+    {
+        printf("dataconvert: could not open %s\n", input_file);
+        return 1;
+    }
+
+    FILE *output = strcmp(output_file, "-") ? fopen(output_file, "w") : stdout;
+
+    if (output == NULL)
+    {
+        printf("dataconvert: could not create %s\n", output_file);
+        fclose(input);
+        return 1;
+    }
+
+    unsigned char bytes[PACKED_SIZE];
+    char fen[128];
+
+    U64 positions = 0;
+
+    while (fread(bytes, PACKED_SIZE, 1, input) == 1)
+    {
+        int score, result;
+
+        unpack_position(bytes, &score, NULL, &result);
+        board_to_fen(fen);
+
+        fprintf(output, "%s | %d | %s\n", fen, (side == white) ? score : -score,
+                (result == 2) ? "1.0" : (result == 1) ? "0.5" : "0.0");
+
+        positions++;
+    }
+
+    fclose(input);
+
+    if (output != stdout)
+    {
+        fclose(output);
+        printf("dataconvert: %llu positions\n", positions);
+    }
+
+    return 0;
+}
+
+
+/****************************************************************
+ * 
+ * 
+ * 
+ *                          TUNING
+ * 
+ * 
+ *
+ * **************************************************************/
+
+/*
+    Texel tuning of piece_values and the piece square tables ("Jabberook tune")
+
+    Outside the endgame evaluators the evaluation is a sum of one piece value
+    and one table value per piece, so a position is kept as nothing but its
+    pieces (16 bit code: piece type * 64 + square seen from its own side, bit
+    15 for black), the piece count and the game result, about 45 bytes per
+    position. Positions scored by the endgame evaluators don't depend on the
+    tables and are left out.
+
+    error = mean of (result - sigmoid(eval))^2, sigmoid = 1 / (1 + 10^(-K * eval / 400))
+
+    K is fitted to the current tables first. In every pass the workers score
+    a block of their share of positions into a float buffer, turn the scores
+    into error and gradient terms in a branch free loop the compiler
+    vectorizes and add the terms to their own gradient. Adam moves all values
+    with the summed gradient. The queen has no table and the king value stays
+    fixed. The result is written in the form of the eval_params initializer,
+    ready to paste or to load with EvalFile.
+
+    input: packed positions (".bin", see TRAINING DATA) or "<fen> | ... | <result>" lines
+*/
+
+// positions scored per block
+#define TUNE_BLOCK 1024
+
+// default passes and Adam step size in centipawns
+#define TUNE_ITERATIONS 1000
+#define TUNE_RATE 1.0
+
+// progress and table output interval in passes
+#define TUNE_REPORT 50
+
+// one value per piece type and square (piece value + table value)
+#define TUNE_SLOTS (6 * 64)
+
+// tuned values: 6 piece values followed by 6 tables
+#define TUNE_PARAMS (6 + TUNE_SLOTS)
+
+// tables in piece order (the queen has none)
+const int *tune_tables[6] = { eval_params.pawn_score, eval_params.knight_score, eval_params.bishop_score,
+                              eval_params.rook_score, NULL, eval_params.king_score };
+const char *tune_table_names[6] = { "pawn", "knight", "bishop", "rook", NULL, "king" };
+
+// loaded positions
+typedef struct {
+    unsigned short *pieces;     // piece codes of all positions
+    unsigned char *counts;      // pieces per position
+    unsigned char *results;     // result for white: 0 loss, 1 draw, 2 win
+    U64 count;
+    U64 capacity;
+    U64 piece_count;
+    U64 piece_capacity;
+} tune_set;
+
+// one pass over all positions
+typedef struct {
+    tune_set *set;
+    const float *values;        // piece value + table value of every slot
+    float scale;                // K * ln(10) / 400
+    int gradient;               // also collect the gradient
+    int next_worker;
+
+    // worker shares: positions first[n] to first[n + 1], starting at piece first_piece[n]
+    U64 first[MAX_THREADS + 1];
+    U64 first_piece[MAX_THREADS];
+
+    // worker results
+    double error[MAX_THREADS];
+    double slot_gradient[MAX_THREADS][TUNE_SLOTS];
+} tune_job;
+
+// add current position, returns 0 if it is skipped and -1 if out of memory
+int tune_add_position(tune_set *set, int result)
+{
+    int score;
+
+    if (count_bits(occupancies[both]) > 32 || evaluate_endgame(&score))
+        return 0;
+
+    if (set->count == set->capacity)
+    {
+        U64 capacity = set->capacity ? set->capacity * 2 : 1 << 16;
+
+        unsigned char *counts = realloc(set->counts, capacity);
+        if (counts) set->counts = counts;
+
+        unsigned char *results = realloc(set->results, capacity);
+        if (results) set->results = results;
+
+        if (counts == NULL || results == NULL)
+            return -1;
+
+        set->capacity = capacity;
+    }
+
+    if (set->piece_count + 32 > set->piece_capacity)
+    {
+        U64 capacity = set->piece_capacity ? set->piece_capacity * 2 : 1 << 20;
+
+        unsigned short *pieces = realloc(set->pieces, capacity * sizeof(unsigned short));
+
+        if (pieces == NULL)
+            return -1;
+
+        set->pieces = pieces;
+        set->piece_capacity = capacity;
+    }
+
+    unsigned short *code = set->pieces + set->piece_count;
+
+    for (int piece = P; piece <= k; piece++)
+    {
+        U64 bitboard = bitboards[piece];
+
+        while (bitboard)
+        {
+            int square = get_ls1b_index(bitboard);
+            pop_bit(bitboard, square);
+
+            *code++ = (piece <= K) ? piece * 64 + square : 0x8000 | ((piece - p) * 64 + mirror_score[square]);
+        }
+    }
+
+    set->counts[set->count] = code - (set->pieces + set->piece_count);
+    set->results[set->count] = result;
+    set->piece_count = code - set->pieces;
+    set->count++;
+
+    return 1;
+}
+
+// load packed (".bin") or text positions, returns 0 on success
+int tune_load(tune_set *set, char *file_name)
+{
+    FILE *file = fopen(file_name, "rb");
+
+    if (file == NULL)
+    {
+        printf("tune: could not open %s\n", file_name);
+        return 1;
+    }
+
+    size_t length = strlen(file_name);
+    int packed = length > 4 && strcmp(file_name + length - 4, ".bin") == 0;
+
+    U64 skipped = 0;
+    int added = 0;
+
+    if (packed)
+    {
+        unsigned char bytes[PACKED_SIZE];
+
+        while (added >= 0 && fread(bytes, PACKED_SIZE, 1, file) == 1)
+        {
+            int result;
+
+            unpack_position(bytes, NULL, NULL, &result);
+
+            added = (result <= 2) ? tune_add_position(set, result) : 0;
+            skipped += (added == 0);
+        }
+    }
+
+    else
+    {
+        char line[512];
+
+        while (added >= 0 && fgets(line, sizeof(line), file))
+        {
+            // result for white after the last bar
+            char *bar = strrchr(line, '|');
+            double value = bar ? strtod(bar + 1, NULL) : -1;
+
+            int result = (value == 1.0) ? 2 : (value == 0.5) ? 1 : (value == 0.0) ? 0 : -1;
+
+            if (result < 0)
+            {
+                skipped++;
+                continue;
+            }
+
+            *strchr(line, '|') = '\0';
+            parse_fen(line);
+
+            added = tune_add_position(set, result);
+            skipped += (added == 0);
+        }
+    }
+
+    fclose(file);
+
+    if (added < 0)
+    {
+        printf("tune: out of memory after %llu positions\n", set->count);
+        return 1;
+    }
+
+    printf("tune: %llu positions loaded, %llu skipped\n", set->count, skipped);
+
+    return set->count == 0;
+}
+
+// worker: error (and gradient terms) of its share of positions
+void *tune_worker(void *arg)
+{
+    tune_job *job = arg;
+    tune_set *set = job->set;
+
+    int index = __sync_fetch_and_add(&job->next_worker, 1);
+
+    const float *values = job->values;
+    const float scale = job->scale;
+    double *gradient = job->slot_gradient[index];
+
+    if (job->gradient)
+        memset(gradient, 0, sizeof(job->slot_gradient[index]));
+
+    float scores[TUNE_BLOCK];
+    float results[TUNE_BLOCK];
+
+    const unsigned short *pieces = set->pieces + job->first_piece[index];
+
+    double error = 0;
+
+    for (U64 block = job->first[index]; block < job->first[index + 1]; block += TUNE_BLOCK)
+    {
+        int size = (job->first[index + 1] - block < TUNE_BLOCK) ? job->first[index + 1] - block : TUNE_BLOCK;
+
+        const unsigned char *counts = set->counts + block;
+        const unsigned short *code = pieces;
+
+        // evaluation for white
+        for (int position = 0; position < size; position++)
+        {
+            float score = 0;
+
+            for (int piece = 0; piece < counts[position]; piece++, code++)
+                score += (*code & 0x8000) ? -values[*code & 0x1ff] : values[*code & 0x1ff];
+
+            scores[position] = score;
+            results[position] = 0.5f * set->results[block + position];
+        }
+
+        // error and gradient terms (vectorized)
+        float block_error = 0;
+
+        for (int position = 0; position < size; position++)
+        {
+            float sigmoid = 1.0f / (1.0f + expf(-scale * scores[position]));
+            float difference = sigmoid - results[position];
+
+            block_error += difference * difference;
+            scores[position] = difference * sigmoid * (1.0f - sigmoid);
+        }
+
+        error += block_error;
+
+        // gradient of every slot used by the block
+        if (job->gradient)
+        {
+            code = pieces;
+
+            for (int position = 0; position < size; position++)
+                for (int piece = 0; piece < counts[position]; piece++, code++)
+                    gradient[*code & 0x1ff] += (*code & 0x8000) ? -scores[position] : scores[position];
+        }
+
+        pieces = code;
+    }
+
+    job->error[index] = error;
+
+    return NULL;
+}
+
+// mean error of all positions with the given slot values, per slot gradient terms if asked
+double tune_pass(tune_job *job, const float *values, double k_factor, int gradient)
+{
+    job->values = values;
+    job->scale = k_factor * 2.302585093 / 400;
+    job->gradient = gradient;
+    job->next_worker = 0;
+
+    pthread_t workers[MAX_THREADS];
+
+    for (int index = 0; index < threads; index++)
+        pthread_create(&workers[index], NULL, tune_worker, job);
+
+    double error = 0;
+
+    for (int index = 0; index < threads; index++)
+    {
+        pthread_join(workers[index], NULL);
+        error += job->error[index];
+    }
+
+    return error / job->set->count;
+}
+
+// slot values from piece values and tables
+void tune_values(const double *params, float *values)
+{
+    for (int slot = 0; slot < TUNE_SLOTS; slot++)
+        values[slot] = params[slot / 64] + params[6 + slot];
+}
+
+// write tuned values as eval_params initializer (also a parameter file for EvalFile)
+void tune_print(FILE *output, const double *params)
+{
+    fprintf(output, "    .piece_values = {\n        ");
+
+    for (int piece = P; piece <= k; piece++)
+    {
+        int value = (int)floor(params[piece % 6] + 0.5);
+
+        fprintf(output, "%d%s", (piece <= K) ? value : -value, (piece == K) ? ",\n        " : (piece < k) ? ", " : "\n");
+    }
+
+    fprintf(output, "    }");
+
+    for (int piece = P; piece <= K; piece++)
+    {
+        if (tune_tables[piece] == NULL)
+            continue;
+
+        fprintf(output, ",\n\n    // %s positional score\n    .%s_score = {\n",
+                tune_table_names[piece], tune_table_names[piece]);
+
+        for (int square = 0; square < 64; square++)
+            fprintf(output, "%s%4d%s", (square % 8) ? "" : "       ", (int)floor(params[6 + piece * 64 + square] + 0.5),
+                    (square == 63) ? "\n" : (square % 8 == 7) ? ",\n" : ",");
+
+        fprintf(output, "    }");
+    }
+
+    fprintf(output, "\n");
+}
+
+// write parameters to a file ("-" = stdout)
+void tune_write(char *output_file, const double *params)
+{
+    FILE *output = strcmp(output_file, "-") ? fopen(output_file, "w") : stdout;
+
+    if (output == NULL)
+    {
+        printf("tune: could not create %s\n", output_file);
+        return;
+    }
+
+    tune_print(output, params);
+
+    if (output != stdout)
+        fclose(output);
+}
+
+// tune evaluation values on a labelled position set, returns 0 on success
+int tune(char *data_file, int iterations, char *output_file)
+{
+    static tune_set set;
+    static tune_job job;
+
+    memset(&set, 0, sizeof(set));
+    memset(&job, 0, sizeof(job));
+
+    if (tune_load(&set, data_file))
+        return 1;
+
+    job.set = &set;
+
+    // worker shares
+    U64 first_piece = 0;
+
+    for (int index = 0; index < threads; index++)
+    {
+        job.first[index] = set.count * index / threads;
+        job.first[index + 1] = set.count * (index + 1) / threads;
+        job.first_piece[index] = first_piece;
+
+        for (U64 position = job.first[index]; position < job.first[index + 1]; position++)
+            first_piece += set.counts[position];
+    }
+
+    // start from the current values
+    static double params[TUNE_PARAMS], moment[TUNE_PARAMS], velocity[TUNE_PARAMS];
+    static float values[TUNE_SLOTS];
+
+    memset(moment, 0, sizeof(moment));
+    memset(velocity, 0, sizeof(velocity));
+
+    for (int piece = P; piece <= K; piece++)
+    {
+        params[piece] = eval_params.piece_values[piece];
+
+        for (int square = 0; square < 64; square++)
+            params[6 + piece * 64 + square] = tune_tables[piece] ? tune_tables[piece][square] : 0;
+    }
+
+    tune_values(params, values);
+
+    // fit K by golden section search
+    double low = 0.0, high = 4.0;
+
+    for (int step = 0; step < 40; step++)
+    {
+        double left = high - 0.618034 * (high - low);
+        double right = low + 0.618034 * (high - low);
+
+        if (tune_pass(&job, values, left, 0) < tune_pass(&job, values, right, 0))
+            high = right;
+        else
+            low = left;
+    }
+
+    double k_factor = (low + high) / 2;
+
+    printf("tune: K %.4f, error %.6f\n", k_factor, tune_pass(&job, values, k_factor, 0));
+
+    int start = get_time_ms();
+
+    for (int iteration = 1; iteration <= iterations; iteration++)
+    {
+        tune_values(params, values);
+
+        double error = tune_pass(&job, values, k_factor, 1);
+
+        // sum worker gradients, d error / d value = 2 / N * sum of terms * K * ln(10) / 400
+        double gradient[TUNE_PARAMS] = {0};
+        double factor = 2.0 * job.scale / set.count;
+
+        for (int index = 0; index < threads; index++)
+            for (int slot = 0; slot < TUNE_SLOTS; slot++)
+                gradient[6 + slot] += job.slot_gradient[index][slot] * factor;
+
+        for (int slot = 0; slot < TUNE_SLOTS; slot++)
+            gradient[slot / 64] += gradient[6 + slot];
+
+        // fixed values
+        gradient[K] = 0;
+
+        for (int square = 0; square < 64; square++)
+            gradient[6 + Q * 64 + square] = 0;
+
+        // Adam step
+        for (int param = 0; param < TUNE_PARAMS; param++)
+        {
+            moment[param] = 0.9 * moment[param] + 0.1 * gradient[param];
+            velocity[param] = 0.999 * velocity[param] + 0.001 * gradient[param] * gradient[param];
+
+            double moment_estimate = moment[param] / (1 - pow(0.9, iteration));
+            double velocity_estimate = velocity[param] / (1 - pow(0.999, iteration));
+
+            params[param] -= TUNE_RATE * moment_estimate / (sqrt(velocity_estimate) + 1e-12);
+        }
+
+        if (iteration % TUNE_REPORT == 0 || iteration == iterations)
+        {
+            printf("tune: iteration %d, error %.6f, %d ms\n", iteration, error, get_time_ms() - start);
+            fflush(stdout);
+
+            if (strcmp(output_file, "-"))
+                tune_write(output_file, params);
+        }
+    }
+
+    tune_values(params, values);
+    printf("tune: final error %.6f\n", tune_pass(&job, values, k_factor, 0));
+
+    tune_write(output_file, params);
+
+    free(set.pieces);
+    free(set.counts);
+    free(set.results);
+
+    return 0;
+}
+
+
+/****************************************************************
+ * 
+ * 
+ * 
+ *                      MICRO BENCHMARKS
+ * 
+ * 
+ *
+ * **************************************************************/
+
+// timed samples per primitive (after warm-up)
+#define MICRO_SAMPLES 25
+
+// untimed warm-up samples per primitive
+#define MICRO_WARMUP 5
+
+// primitive calls per position per sample
+#define MICRO_ITERATIONS 2000
+
+// keeps the compiler from optimizing benchmarked calls away
+volatile U64 micro_sink;
+
+// pseudo legal moves of the currently benchmarked position (make_move input)
+moves micro_move_list[1];
+
+// each primitive runs one batch on the current board and returns the number of calls made
+
+U64 micro_generate_moves()
+{
+    moves move_list[1];
+
+    generate_moves(move_list);
+
+    micro_sink += move_list->count;
+
+    return 1;
+}
+
+U64 micro_make_move()
+{
+    for (int move_count = 0; move_count < micro_move_list->count; move_count++)
+    {
+        copy_board();
+
+        if (make_move(micro_move_list->moves[move_count], all_moves))
+        {
+            take_back();
+        }
+    }
+
+    micro_sink += hash_key;
+
+    return micro_move_list->count;
+}
+
+U64 micro_is_square_attacked()
+{
+    int attacked = 0;
+
+    for (int square = 0; square < 64; square++)
+        attacked += is_square_attacked(square, side ^ 1);
+
+    micro_sink += attacked;
+
+    return 64;
+}
+
+U64 micro_get_rook_attacks()
+{
+    U64 attacks = 0ULL;
+
+    for (int square = 0; square < 64; square++)
+        attacks ^= get_rook_attacks(square, occupancies[both]);
+
+    micro_sink += attacks;
+
+    return 64;
+}
+
+U64 micro_get_bishop_attacks()
+{
+    U64 attacks = 0ULL;
+
+    for (int square = 0; square < 64; square++)
+        attacks ^= get_bishop_attacks(square, occupancies[both]);
+
+    micro_sink += attacks;
+
+    return 64;
+}
+
+U64 micro_evaluate()
+{
+    micro_sink += evaluate();
+
+    return 1;
+}
+
+typedef struct {
+    char *name;
+    U64 (*run)();
+} micro_primitive;
+
+micro_primitive micro_primitives[] = {
+    { "generate_moves", micro_generate_moves },
+    { "make_move", micro_make_move },
+    { "is_square_attacked", micro_is_square_attacked },
+    { "get_rook_attacks", micro_get_rook_attacks },
+    { "get_bishop_attacks", micro_get_bishop_attacks },
+    { "evaluate", micro_evaluate }
+};
+
+// ascending comparison for qsort
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// time one sample of a primitive over the whole bench corpus, returns ns and cycles per call
+void micro_sample(micro_primitive *primitive, double *ns_per_op, double *cycles_per_op)
+{
+    int position_count = sizeof(bench_positions) / sizeof(bench_positions[0]);
+
+    U64 ops = 0, time = 0, cycles = 0;
+
+    for (int index = 0; index < position_count; index++)
+    {
+        parse_fen(bench_positions[index]);
+
+        generate_moves(micro_move_list);
+
+        U64 start_time = get_time_ns();
+        U64 start_cycles = read_cycles();
+
+        for (int iteration = 0; iteration < MICRO_ITERATIONS; iteration++)
+            ops += primitive->run();
+
+        cycles += read_cycles() - start_cycles;
+        time += get_time_ns() - start_time;
+    }
+
+    *ns_per_op = (double)time / ops;
+    *cycles_per_op = (double)cycles / ops;
+}
+
+/*
+    Micro benchmark output (one record per primitive)
+
+    csv:  primitive,ns_per_op,cycles_per_op,median_ns,min_ns,samples,outliers
+    json: [{"primitive": "...", "ns_per_op": ..., ...}, ...]
+
+    ns_per_op and cycles_per_op are means over samples left after Tukey outlier
+    rejection (outside 1.5 interquartile ranges), cycles_per_op is -1 without rdtsc
+*/
+
+// time every primitive over the bench corpus and print results as csv or json
+void micro_bench(char *format)
+{
+    int json = (format != NULL && strcmp(format, "json") == 0);
+
+    int primitive_count = sizeof(micro_primitives) / sizeof(micro_primitives[0]);
+
+    if (json)
+        printf("[\n");
+    else
+        printf("primitive,ns_per_op,cycles_per_op,median_ns,min_ns,samples,outliers\n");
+
+    for (int index = 0; index < primitive_count; index++)
+    {
+        double ns[MICRO_SAMPLES], cycles[MICRO_SAMPLES], sorted[MICRO_SAMPLES];
+
+        // warm caches and branch predictors
+        for (int sample = 0; sample < MICRO_WARMUP; sample++)
+            micro_sample(&micro_primitives[index], &ns[0], &cycles[0]);
+
+        for (int sample = 0; sample < MICRO_SAMPLES; sample++)
+        {
+            micro_sample(&micro_primitives[index], &ns[sample], &cycles[sample]);
+            sorted[sample] = ns[sample];
+        }
+
+        qsort(sorted, MICRO_SAMPLES, sizeof(double), compare_doubles);
+
+        // Tukey fences
+        double q1 = sorted[MICRO_SAMPLES / 4];
+        double q3 = sorted[(MICRO_SAMPLES * 3) / 4];
+        double low = q1 - 1.5 * (q3 - q1), high = q3 + 1.5 * (q3 - q1);
+
+        double ns_sum = 0, cycles_sum = 0;
+        int kept = 0;
+
+        for (int sample = 0; sample < MICRO_SAMPLES; sample++)
+        {
+            if (ns[sample] < low || ns[sample] > high)
+                continue;
+
+            ns_sum += ns[sample];
+            cycles_sum += cycles[sample];
+            kept++;
+        }
+
+        double ns_per_op = ns_sum / kept;
+        double cycles_per_op = HAS_RDTSC ? cycles_sum / kept : -1;
+
+        if (json)
+            printf("  {\"primitive\": \"%s\", \"ns_per_op\": %.3f, \"cycles_per_op\": %.1f, \"median_ns\": %.3f, "
+                   "\"min_ns\": %.3f, \"samples\": %d, \"outliers\": %d}%s\n",
+                   micro_primitives[index].name, ns_per_op, cycles_per_op, sorted[MICRO_SAMPLES / 2],
+                   sorted[0], kept, MICRO_SAMPLES - kept, (index < primitive_count - 1) ? "," : "");
+        else
+            printf("%s,%.3f,%.1f,%.3f,%.3f,%d,%d\n", micro_primitives[index].name, ns_per_op, cycles_per_op,
+                   sorted[MICRO_SAMPLES / 2], sorted[0], kept, MICRO_SAMPLES - kept);
+    }
+
+    if (json)
+        printf("]\n");
+}
+
+
+/****************************************************************
+ * 
+ * 
+ * 
+ *                      OPENING BOOK
+ * 
+ *
+ *
+ * **************************************************************/
+
+/*
+    Polyglot (.bin) book support. The book is mapped into memory once when the
+    BookFile option is set; a probe computes the Polyglot key of the position,
+    binary searches the key sorted entries and picks one of the matching moves.
+
+    entry layout (16 bytes, big endian):
+
+    key      64 bits
+    move     16 bits (to file 0-2, to row 3-5, from file 6-8, from row 9-11, promotion 12-14)
+    weight   16 bits
+    learn    32 bits (unused)
+*/
+
+// Polyglot random keys: 768 piece-square, 4 castling, 8 en passant file, 1 side to move
+const U64 polyglot_random[781] = {
+    0x9D39247E33776D41ULL, 0x2AF7398005AAA5C7ULL, 0x44DB015024623547ULL, 0x9C15F73E62A76AE2ULL,
+    0x75834465489C0C89ULL, 0x3290AC3A203001BFULL, 0x0FBBAD1F61042279ULL, 0xE83A908FF2FB60CAULL,
+    0x0D7E765D58755C10ULL, 0x1A083822CEAFE02DULL, 0x9605D5F0E25EC3B0ULL, 0xD021FF5CD13A2ED5ULL,
+    0x40BDF15D4A672E32ULL, 0x011355146FD56395ULL, 0x5DB4832046F3D9E5ULL, 0x239F8B2D7FF719CCULL,
+    0x05D1A1AE85B49AA1ULL, 0x679F848F6E8FC971ULL, 0x7449BBFF801FED0BULL, 0x7D11CDB1C3B7ADF0ULL,
+    0x82C7709E781EB7CCULL, 0xF3218F1C9510786CULL, 0x331478F3AF51BBE6ULL, 0x4BB38DE5E7219443ULL,
+    0xAA649C6EBCFD50FCULL, 0x8DBD98A352AFD40BULL, 0x87D2074B81D79217ULL, 0x19F3C751D3E92AE1ULL,
+    0xB4AB30F062B19ABFULL, 0x7B0500AC42047AC4ULL, 0xC9452CA81A09D85DULL, 0x24AA6C514DA27500ULL,
+    0x4C9F34427501B447ULL, 0x14A68FD73C910841ULL, 0xA71B9B83461CBD93ULL, 0x03488B95B0F1850FULL,
+    0x637B2B34FF93C040ULL, 0x09D1BC9A3DD90A94ULL, 0x3575668334A1DD3BULL, 0x735E2B97A4C45A23ULL,
+    0x18727070F1BD400BULL, 0x1FCBACD259BF02E7ULL, 0xD310A7C2CE9B6555ULL, 0xBF983FE0FE5D8244ULL,
+    0x9F74D14F7454A824ULL, 0x51EBDC4AB9BA3035ULL, 0x5C82C505DB9AB0FAULL, 0xFCF7FE8A3430B241ULL,
+    0x3253A729B9BA3DDEULL, 0x8C74C368081B3075ULL, 0xB9BC6C87167C33E7ULL, 0x7EF48F2B83024E20ULL,
+    0x11D505D4C351BD7FULL, 0x6568FCA92C76A243ULL, 0x4DE0B0F40F32A7B8ULL, 0x96D693460CC37E5DULL,
+    0x42E240CB63689F2FULL, 0x6D2BDCDAE2919661ULL, 0x42880B0236E4D951ULL, 0x5F0F4A5898171BB6ULL,
+    0x39F890F579F92F88ULL, 0x93C5B5F47356388BULL, 0x63DC359D8D231B78ULL, 0xEC16CA8AEA98AD76ULL,
+    0x5355F900C2A82DC7ULL, 0x07FB9F855A997142ULL, 0x5093417AA8A7ED5EULL, 0x7BCBC38DA25A7F3CULL,
+    0x19FC8A768CF4B6D4ULL, 0x637A7780DECFC0D9ULL, 0x8249A47AEE0E41F7ULL, 0x79AD695501E7D1E8ULL,
+    0x14ACBAF4777D5776ULL, 0xF145B6BECCDEA195ULL, 0xDABF2AC8201752FCULL, 0x24C3C94DF9C8D3F6ULL,
+    0xBB6E2924F03912EAULL, 0x0CE26C0B95C980D9ULL, 0xA49CD132BFBF7CC4ULL, 0xE99D662AF4243939ULL,
+    0x27E6AD7891165C3FULL, 0x8535F040B9744FF1ULL, 0x54B3F4FA5F40D873ULL, 0x72B12C32127FED2BULL,
+    0xEE954D3C7B411F47ULL, 0x9A85AC909A24EAA1ULL, 0x70AC4CD9F04F21F5ULL, 0xF9B89D3E99A075C2ULL,
+    0x87B3E2B2B5C907B1ULL, 0xA366E5B8C54F48B8ULL, 0xAE4A9346CC3F7CF2ULL, 0x1920C04D47267BBDULL,
+    0x87BF02C6B49E2AE9ULL, 0x092237AC237F3859ULL, 0xFF07F64EF8ED14D0ULL, 0x8DE8DCA9F03CC54EULL,
+    0x9C1633264DB49C89ULL, 0xB3F22C3D0B0B38EDULL, 0x390E5FB44D01144BULL, 0x5BFEA5B4712768E9ULL,
+    0x1E1032911FA78984ULL, 0x9A74ACB964E78CB3ULL, 0x4F80F7A035DAFB04ULL, 0x6304D09A0B3738C4ULL,
+    0x2171E64683023A08ULL, 0x5B9B63EB9CEFF80CULL, 0x506AACF489889342ULL, 0x1881AFC9A3A701D6ULL,
+    0x6503080440750644ULL, 0xDFD395339CDBF4A7ULL, 0xEF927DBCF00C20F2ULL, 0x7B32F7D1E03680ECULL,
+    0xB9FD7620E7316243ULL, 0x05A7E8A57DB91B77ULL, 0xB5889C6E15630A75ULL, 0x4A750A09CE9573F7ULL,
+    0xCF464CEC899A2F8AULL, 0xF538639CE705B824ULL, 0x3C79A0FF5580EF7FULL, 0xEDE6C87F8477609DULL,
+    0x799E81F05BC93F31ULL, 0x86536B8CF3428A8CULL, 0x97D7374C60087B73ULL, 0xA246637CFF328532ULL,
+    0x043FCAE60CC0EBA0ULL, 0x920E449535DD359EULL, 0x70EB093B15B290CCULL, 0x73A1921916591CBDULL,
+    0x56436C9FE1A1AA8DULL, 0xEFAC4B70633B8F81ULL, 0xBB215798D45DF7AFULL, 0x45F20042F24F1768ULL,
+    0x930F80F4E8EB7462ULL, 0xFF6712FFCFD75EA1ULL, 0xAE623FD67468AA70ULL, 0xDD2C5BC84BC8D8FCULL,
+    0x7EED120D54CF2DD9ULL, 0x22FE545401165F1CULL, 0xC91800E98FB99929ULL, 0x808BD68E6AC10365ULL,
+    0xDEC468145B7605F6ULL, 0x1BEDE3A3AEF53302ULL, 0x43539603D6C55602ULL, 0xAA969B5C691CCB7AULL,
+    0xA87832D392EFEE56ULL, 0x65942C7B3C7E11AEULL, 0xDED2D633CAD004F6ULL, 0x21F08570F420E565ULL,
+    0xB415938D7DA94E3CULL, 0x91B859E59ECB6350ULL, 0x10CFF333E0ED804AULL, 0x28AED140BE0BB7DDULL,
+    0xC5CC1D89724FA456ULL, 0x5648F680F11A2741ULL, 0x2D255069F0B7DAB3ULL, 0x9BC5A38EF729ABD4ULL,
+    0xEF2F054308F6A2BCULL, 0xAF2042F5CC5C2858ULL, 0x480412BAB7F5BE2AULL, 0xAEF3AF4A563DFE43ULL,
+    0x19AFE59AE451497FULL, 0x52593803DFF1E840ULL, 0xF4F076E65F2CE6F0ULL, 0x11379625747D5AF3ULL,
+    0xBCE5D2248682C115ULL, 0x9DA4243DE836994FULL, 0x066F70B33FE09017ULL, 0x4DC4DE189B671A1CULL,
+    0x51039AB7712457C3ULL, 0xC07A3F80C31FB4B4ULL, 0xB46EE9C5E64A6E7CULL, 0xB3819A42ABE61C87ULL,
+    0x21A007933A522A20ULL, 0x2DF16F761598AA4FULL, 0x763C4A1371B368FDULL, 0xF793C46702E086A0ULL,
+    0xD7288E012AEB8D31ULL, 0xDE336A2A4BC1C44BULL, 0x0BF692B38D079F23ULL, 0x2C604A7A177326B3ULL,
+    0x4850E73E03EB6064ULL, 0xCFC447F1E53C8E1BULL, 0xB05CA3F564268D99ULL, 0x9AE182C8BC9474E8ULL,
+    0xA4FC4BD4FC5558CAULL, 0xE755178D58FC4E76ULL, 0x69B97DB1A4C03DFEULL, 0xF9B5B7C4ACC67C96ULL,
+    0xFC6A82D64B8655FBULL, 0x9C684CB6C4D24417ULL, 0x8EC97D2917456ED0ULL, 0x6703DF9D2924E97EULL,
+    0xC547F57E42A7444EULL, 0x78E37644E7CAD29EULL, 0xFE9A44E9362F05FAULL, 0x08BD35CC38336615ULL,
+    0x9315E5EB3A129ACEULL, 0x94061B871E04DF75ULL, 0xDF1D9F9D784BA010ULL, 0x3BBA57B68871B59DULL,
+    0xD2B7ADEEDED1F73FULL, 0xF7A255D83BC373F8ULL, 0xD7F4F2448C0CEB81ULL, 0xD95BE88CD210FFA7ULL,
+    0x336F52F8FF4728E7ULL, 0xA74049DAC312AC71ULL, 0xA2F61BB6E437FDB5ULL, 0x4F2A5CB07F6A35B3ULL,
+    0x87D380BDA5BF7859ULL, 0x16B9F7E06C453A21ULL, 0x7BA2484C8A0FD54EULL, 0xF3A678CAD9A2E38CULL,
+    0x39B0BF7DDE437BA2ULL, 0xFCAF55C1BF8A4424ULL, 0x18FCF680573FA594ULL, 0x4C0563B89F495AC3ULL,
+    0x40E087931A00930DULL, 0x8CFFA9412EB642C1ULL, 0x68CA39053261169FULL, 0x7A1EE967D27579E2ULL,
+    0x9D1D60E5076F5B6FULL, 0x3810E399B6F65BA2ULL, 0x32095B6D4AB5F9B1ULL, 0x35CAB62109DD038AULL,
+    0xA90B24499FCFAFB1ULL, 0x77A225A07CC2C6BDULL, 0x513E5E634C70E331ULL, 0x4361C0CA3F692F12ULL,
+    0xD941ACA44B20A45BULL, 0x528F7C8602C5807BULL, 0x52AB92BEB9613989ULL, 0x9D1DFA2EFC557F73ULL,
+    0x722FF175F572C348ULL, 0x1D1260A51107FE97ULL, 0x7A249A57EC0C9BA2ULL, 0x04208FE9E8F7F2D6ULL,
+    0x5A110C6058B920A0ULL, 0x0CD9A497658A5698ULL, 0x56FD23C8F9715A4CULL, 0x284C847B9D887AAEULL,
+    0x04FEABFBBDB619CBULL, 0x742E1E651C60BA83ULL, 0x9A9632E65904AD3CULL, 0x881B82A13B51B9E2ULL,
+    0x506E6744CD974924ULL, 0xB0183DB56FFC6A79ULL, 0x0ED9B915C66ED37EULL, 0x5E11E86D5873D484ULL,
+    0xF678647E3519AC6EULL, 0x1B85D488D0F20CC5ULL, 0xDAB9FE6525D89021ULL, 0x0D151D86ADB73615ULL,
+    0xA865A54EDCC0F019ULL, 0x93C42566AEF98FFBULL, 0x99E7AFEABE000731ULL, 0x48CBFF086DDF285AULL,
+    0x7F9B6AF1EBF78BAFULL, 0x58627E1A149BBA21ULL, 0x2CD16E2ABD791E33ULL, 0xD363EFF5F0977996ULL,
+    0x0CE2A38C344A6EEDULL, 0x1A804AADB9CFA741ULL, 0x907F30421D78C5DEULL, 0x501F65EDB3034D07ULL,
+    0x37624AE5A48FA6E9ULL, 0x957BAF61700CFF4EULL, 0x3A6C27934E31188AULL, 0xD49503536ABCA345ULL,
+    0x088E049589C432E0ULL, 0xF943AEE7FEBF21B8ULL, 0x6C3B8E3E336139D3ULL, 0x364F6FFA464EE52EULL,
+    0xD60F6DCEDC314222ULL, 0x56963B0DCA418FC0ULL, 0x16F50EDF91E513AFULL, 0xEF1955914B609F93ULL,
+    0x565601C0364E3228ULL, 0xECB53939887E8175ULL, 0xBAC7A9A18531294BULL, 0xB344C470397BBA52ULL,
+    0x65D34954DAF3CEBDULL, 0xB4B81B3FA97511E2ULL, 0xB422061193D6F6A7ULL, 0x071582401C38434DULL,
+    0x7A13F18BBEDC4FF5ULL, 0xBC4097B116C524D2ULL, 0x59B97885E2F2EA28ULL, 0x99170A5DC3115544ULL,
+    0x6F423357E7C6A9F9ULL, 0x325928EE6E6F8794ULL, 0xD0E4366228B03343ULL, 0x565C31F7DE89EA27ULL,
+    0x30F5611484119414ULL, 0xD873DB391292ED4FULL, 0x7BD94E1D8E17DEBCULL, 0xC7D9F16864A76E94ULL,
+    0x947AE053EE56E63CULL, 0xC8C93882F9475F5FULL, 0x3A9BF55BA91F81CAULL, 0xD9A11FBB3D9808E4ULL,
+    0x0FD22063EDC29FCAULL, 0xB3F256D8ACA0B0B9ULL, 0xB03031A8B4516E84ULL, 0x35DD37D5871448AFULL,
+    0xE9F6082B05542E4EULL, 0xEBFAFA33D7254B59ULL, 0x9255ABB50D532280ULL, 0xB9AB4CE57F2D34F3ULL,
+    0x693501D628297551ULL, 0xC62C58F97DD949BFULL, 0xCD454F8F19C5126AULL, 0xBBE83F4ECC2BDECBULL,
+    0xDC842B7E2819E230ULL, 0xBA89142E007503B8ULL, 0xA3BC941D0A5061CBULL, 0xE9F6760E32CD8021ULL,
+    0x09C7E552BC76492FULL, 0x852F54934DA55CC9ULL, 0x8107FCCF064FCF56ULL, 0x098954D51FFF6580ULL,
+    0x23B70EDB1955C4BFULL, 0xC330DE426430F69DULL, 0x4715ED43E8A45C0AULL, 0xA8D7E4DAB780A08DULL,
+    0x0572B974F03CE0BBULL, 0xB57D2E985E1419C7ULL, 0xE8D9ECBE2CF3D73FULL, 0x2FE4B17170E59750ULL,
+    0x11317BA87905E790ULL, 0x7FBF21EC8A1F45ECULL, 0x1725CABFCB045B00ULL, 0x964E915CD5E2B207ULL,
+    0x3E2B8BCBF016D66DULL, 0xBE7444E39328A0ACULL, 0xF85B2B4FBCDE44B7ULL, 0x49353FEA39BA63B1ULL,
+    0x1DD01AAFCD53486AULL, 0x1FCA8A92FD719F85ULL, 0xFC7C95D827357AFAULL, 0x18A6A990C8B35EBDULL,
+    0xCCCB7005C6B9C28DULL, 0x3BDBB92C43B17F26ULL, 0xAA70B5B4F89695A2ULL, 0xE94C39A54A98307FULL,
+    0xB7A0B174CFF6F36EULL, 0xD4DBA84729AF48ADULL, 0x2E18BC1AD9704A68ULL, 0x2DE0966DAF2F8B1CULL,
+    0xB9C11D5B1E43A07EULL, 0x64972D68DEE33360ULL, 0x94628D38D0C20584ULL, 0xDBC0D2B6AB90A559ULL,
+    0xD2733C4335C6A72FULL, 0x7E75D99D94A70F4DULL, 0x6CED1983376FA72BULL, 0x97FCAACBF030BC24ULL,
+    0x7B77497B32503B12ULL, 0x8547EDDFB81CCB94ULL, 0x79999CDFF70902CBULL, 0xCFFE1939438E9B24ULL,
+    0x829626E3892D95D7ULL, 0x92FAE24291F2B3F1ULL, 0x63E22C147B9C3403ULL, 0xC678B6D860284A1CULL,
+    0x5873888850659AE7ULL, 0x0981DCD296A8736DULL, 0x9F65789A6509A440ULL, 0x9FF38FED72E9052FULL,
+    0xE479EE5B9930578CULL, 0xE7F28ECD2D49EECDULL, 0x56C074A581EA17FEULL, 0x5544F7D774B14AEFULL,
+    0x7B3F0195FC6F290FULL, 0x12153635B2C0CF57ULL, 0x7F5126DBBA5E0CA7ULL, 0x7A76956C3EAFB413ULL,
+    0x3D5774A11D31AB39ULL, 0x8A1B083821F40CB4ULL, 0x7B4A38E32537DF62ULL, 0x950113646D1D6E03ULL,
+    0x4DA8979A0041E8A9ULL, 0x3BC36E078F7515D7ULL, 0x5D0A12F27AD310D1ULL, 0x7F9D1A2E1EBE1327ULL,
+    0xDA3A361B1C5157B1ULL, 0xDCDD7D20903D0C25ULL, 0x36833336D068F707ULL, 0xCE68341F79893389ULL,
+    0xAB9090168DD05F34ULL, 0x43954B3252DC25E5ULL, 0xB438C2B67F98E5E9ULL, 0x10DCD78E3851A492ULL,
+    0xDBC27AB5447822BFULL, 0x9B3CDB65F82CA382ULL, 0xB67B7896167B4C84ULL, 0xBFCED1B0048EAC50ULL,
+    0xA9119B60369FFEBDULL, 0x1FFF7AC80904BF45ULL, 0xAC12FB171817EEE7ULL, 0xAF08DA9177DDA93DULL,
+    0x1B0CAB936E65C744ULL, 0xB559EB1D04E5E932ULL, 0xC37B45B3F8D6F2BAULL, 0xC3A9DC228CAAC9E9ULL,
+    0xF3B8B6675A6507FFULL, 0x9FC477DE4ED681DAULL, 0x67378D8ECCEF96CBULL, 0x6DD856D94D259236ULL,
+    0xA319CE15B0B4DB31ULL, 0x073973751F12DD5EULL, 0x8A8E849EB32781A5ULL, 0xE1925C71285279F5ULL,
+    0x74C04BF1790C0EFEULL, 0x4DDA48153C94938AULL, 0x9D266D6A1CC0542CULL, 0x7440FB816508C4FEULL,
+    0x13328503DF48229FULL, 0xD6BF7BAEE43CAC40ULL, 0x4838D65F6EF6748FULL, 0x1E152328F3318DEAULL,
+    0x8F8419A348F296BFULL, 0x72C8834A5957B511ULL, 0xD7A023A73260B45CULL, 0x94EBC8ABCFB56DAEULL,
+    0x9FC10D0F989993E0ULL, 0xDE68A2355B93CAE6ULL, 0xA44CFE79AE538BBEULL, 0x9D1D84FCCE371425ULL,
+    0x51D2B1AB2DDFB636ULL, 0x2FD7E4B9E72CD38CULL, 0x65CA5B96B7552210ULL, 0xDD69A0D8AB3B546DULL,
+    0x604D51B25FBF70E2ULL, 0x73AA8A564FB7AC9EULL, 0x1A8C1E992B941148ULL, 0xAAC40A2703D9BEA0ULL,
+    0x764DBEAE7FA4F3A6ULL, 0x1E99B96E70A9BE8BULL, 0x2C5E9DEB57EF4743ULL, 0x3A938FEE32D29981ULL,
+    0x26E6DB8FFDF5ADFEULL, 0x469356C504EC9F9DULL, 0xC8763C5B08D1908CULL, 0x3F6C6AF859D80055ULL,
+    0x7F7CC39420A3A545ULL, 0x9BFB227EBDF4C5CEULL, 0x89039D79D6FC5C5CULL, 0x8FE88B57305E2AB6ULL,
+    0xA09E8C8C35AB96DEULL, 0xFA7E393983325753ULL, 0xD6B6D0ECC617C699ULL, 0xDFEA21EA9E7557E3ULL,
+    0xB67C1FA481680AF8ULL, 0xCA1E3785A9E724E5ULL, 0x1CFC8BED0D681639ULL, 0xD18D8549D140CAEAULL,
+    0x4ED0FE7E9DC91335ULL, 0xE4DBF0634473F5D2ULL, 0x1761F93A44D5AEFEULL, 0x53898E4C3910DA55ULL,
+    0x734DE8181F6EC39AULL, 0x2680B122BAA28D97ULL, 0x298AF231C85BAFABULL, 0x7983EED3740847D5ULL,
+    0x66C1A2A1A60CD889ULL, 0x9E17E49642A3E4C1ULL, 0xEDB454E7BADC0805ULL, 0x50B704CAB602C329ULL,
+    0x4CC317FB9CDDD023ULL, 0x66B4835D9EAFEA22ULL, 0x219B97E26FFC81BDULL, 0x261E4E4C0A333A9DULL,
+    0x1FE2CCA76517DB90ULL, 0xD7504DFA8816EDBBULL, 0xB9571FA04DC089C8ULL, 0x1DDC0325259B27DEULL,
+    0xCF3F4688801EB9AAULL, 0xF4F5D05C10CAB243ULL, 0x38B6525C21A42B0EULL, 0x36F60E2BA4FA6800ULL,
+    0xEB3593803173E0CEULL, 0x9C4CD6257C5A3603ULL, 0xAF0C317D32ADAA8AULL, 0x258E5A80C7204C4BULL,
+    0x8B889D624D44885DULL, 0xF4D14597E660F855ULL, 0xD4347F66EC8941C3ULL, 0xE699ED85B0DFB40DULL,
+    0x2472F6207C2D0484ULL, 0xC2A1E7B5B459AEB5ULL, 0xAB4F6451CC1D45ECULL, 0x63767572AE3D6174ULL,
+    0xA59E0BD101731A28ULL, 0x116D0016CB948F09ULL, 0x2CF9C8CA052F6E9FULL, 0x0B090A7560A968E3ULL,
+    0xABEEDDB2DDE06FF1ULL, 0x58EFC10B06A2068DULL, 0xC6E57A78FBD986E0ULL, 0x2EAB8CA63CE802D7ULL,
+    0x14A195640116F336ULL, 0x7C0828DD624EC390ULL, 0xD74BBE77E6116AC7ULL, 0x804456AF10F5FB53ULL,
+    0xEBE9EA2ADF4321C7ULL, 0x03219A39EE587A30ULL, 0x49787FEF17AF9924ULL, 0xA1E9300CD8520548ULL,
+    0x5B45E522E4B1B4EFULL, 0xB49C3B3995091A36ULL, 0xD4490AD526F14431ULL, 0x12A8F216AF9418C2ULL,
+    0x001F837CC7350524ULL, 0x1877B51E57A764D5ULL, 0xA2853B80F17F58EEULL, 0x993E1DE72D36D310ULL,
+    0xB3598080CE64A656ULL, 0x252F59CF0D9F04BBULL, 0xD23C8E176D113600ULL, 0x1BDA0492E7E4586EULL,
+    0x21E0BD5026C619BFULL, 0x3B097ADAF088F94EULL, 0x8D14DEDB30BE846EULL, 0xF95CFFA23AF5F6F4ULL,
+    0x3871700761B3F743ULL, 0xCA672B91E9E4FA16ULL, 0x64C8E531BFF53B55ULL, 0x241260ED4AD1E87DULL,
+    0x106C09B972D2E822ULL, 0x7FBA195410E5CA30ULL, 0x7884D9BC6CB569D8ULL, 0x0647DFEDCD894A29ULL,
+    0x63573FF03E224774ULL, 0x4FC8E9560F91B123ULL, 0x1DB956E450275779ULL, 0xB8D91274B9E9D4FBULL,
+    0xA2EBEE47E2FBFCE1ULL, 0xD9F1F30CCD97FB09ULL, 0xEFED53D75FD64E6BULL, 0x2E6D02C36017F67FULL,
+    0xA9AA4D20DB084E9BULL, 0xB64BE8D8B25396C1ULL, 0x70CB6AF7C2D5BCF0ULL, 0x98F076A4F7A2322EULL,
+    0xBF84470805E69B5FULL, 0x94C3251F06F90CF3ULL, 0x3E003E616A6591E9ULL, 0xB925A6CD0421AFF3ULL,
+    0x61BDD1307C66E300ULL, 0xBF8D5108E27E0D48ULL, 0x240AB57A8B888B20ULL, 0xFC87614BAF287E07ULL,
+    0xEF02CDD06FFDB432ULL, 0xA1082C0466DF6C0AULL, 0x8215E577001332C8ULL, 0xD39BB9C3A48DB6CFULL,
+    0x2738259634305C14ULL, 0x61CF4F94C97DF93DULL, 0x1B6BACA2AE4E125BULL, 0x758F450C88572E0BULL,
+    0x959F587D507A8359ULL, 0xB063E962E045F54DULL, 0x60E8ED72C0DFF5D1ULL, 0x7B64978555326F9FULL,
+    0xFD080D236DA814BAULL, 0x8C90FD9B083F4558ULL, 0x106F72FE81E2C590ULL, 0x7976033A39F7D952ULL,
+    0xA4EC0132764CA04BULL, 0x733EA705FAE4FA77ULL, 0xB4D8F77BC3E56167ULL, 0x9E21F4F903B33FD9ULL,
+    0x9D765E419FB69F6DULL, 0xD30C088BA61EA5EFULL, 0x5D94337FBFAF7F5BULL, 0x1A4E4822EB4D7A59ULL,
+    0x6FFE73E81B637FB3ULL, 0xDDF957BC36D8B9CAULL, 0x64D0E29EEA8838B3ULL, 0x08DD9BDFD96B9F63ULL,
+    0x087E79E5A57D1D13ULL, 0xE328E230E3E2B3FBULL, 0x1C2559E30F0946BEULL, 0x720BF5F26F4D2EAAULL,
+    0xB0774D261CC609DBULL, 0x443F64EC5A371195ULL, 0x4112CF68649A260EULL, 0xD813F2FAB7F5C5CAULL,
+    0x660D3257380841EEULL, 0x59AC2C7873F910A3ULL, 0xE846963877671A17ULL, 0x93B633ABFA3469F8ULL,
+    0xC0C0F5A60EF4CDCFULL, 0xCAF21ECD4377B28CULL, 0x57277707199B8175ULL, 0x506C11B9D90E8B1DULL,
+    0xD83CC2687A19255FULL, 0x4A29C6465A314CD1ULL, 0xED2DF21216235097ULL, 0xB5635C95FF7296E2ULL,
+    0x22AF003AB672E811ULL, 0x52E762596BF68235ULL, 0x9AEBA33AC6ECC6B0ULL, 0x944F6DE09134DFB6ULL,
+    0x6C47BEC883A7DE39ULL, 0x6AD047C430A12104ULL, 0xA5B1CFDBA0AB4067ULL, 0x7C45D833AFF07862ULL,
+    0x5092EF950A16DA0BULL, 0x9338E69C052B8E7BULL, 0x455A4B4CFE30E3F5ULL, 0x6B02E63195AD0CF8ULL,
+    0x6B17B224BAD6BF27ULL, 0xD1E0CCD25BB9C169ULL, 0xDE0C89A556B9AE70ULL, 0x50065E535A213CF6ULL,
+    0x9C1169FA2777B874ULL, 0x78EDEFD694AF1EEDULL, 0x6DC93D9526A50E68ULL, 0xEE97F453F06791EDULL,
+    0x32AB0EDB696703D3ULL, 0x3A6853C7E70757A7ULL, 0x31865CED6120F37DULL, 0x67FEF95D92607890ULL,
+    0x1F2B1D1F15F6DC9CULL, 0xB69E38A8965C6B65ULL, 0xAA9119FF184CCCF4ULL, 0xF43C732873F24C13ULL,
+    0xFB4A3D794A9A80D2ULL, 0x3550C2321FD6109CULL, 0x371F77E76BB8417EULL, 0x6BFA9AAE5EC05779ULL,
+    0xCD04F3FF001A4778ULL, 0xE3273522064480CAULL, 0x9F91508BFFCFC14AULL, 0x049A7F41061A9E60ULL,
+    0xFCB6BE43A9F2FE9BULL, 0x08DE8A1C7797DA9BULL, 0x8F9887E6078735A1ULL, 0xB5B4071DBFC73A66ULL,
+    0x230E343DFBA08D33ULL, 0x43ED7F5A0FAE657DULL, 0x3A88A0FBBCB05C63ULL, 0x21874B8B4D2DBC4FULL,
+    0x1BDEA12E35F6A8C9ULL, 0x53C065C6C8E63528ULL, 0xE34A1D250E7A8D6BULL, 0xD6B04D3B7651DD7EULL,
+    0x5E90277E7CB39E2DULL, 0x2C046F22062DC67DULL, 0xB10BB459132D0A26ULL, 0x3FA9DDFB67E2F199ULL,
+    0x0E09B88E1914F7AFULL, 0x10E8B35AF3EEAB37ULL, 0x9EEDECA8E272B933ULL, 0xD4C718BC4AE8AE5FULL,
+    0x81536D601170FC20ULL, 0x91B534F885818A06ULL, 0xEC8177F83F900978ULL, 0x190E714FADA5156EULL,
+    0xB592BF39B0364963ULL, 0x89C350C893AE7DC1ULL, 0xAC042E70F8B383F2ULL, 0xB49B52E587A1EE60ULL,
+    0xFB152FE3FF26DA89ULL, 0x3E666E6F69AE2C15ULL, 0x3B544EBE544C19F9ULL, 0xE805A1E290CF2456ULL,
+    0x24B33C9D7ED25117ULL, 0xE74733427B72F0C1ULL, 0x0A804D18B7097475ULL, 0x57E3306D881EDB4FULL,
+    0x4AE7D6A36EB5DBCBULL, 0x2D8D5432157064C8ULL, 0xD1E649DE1E7F268BULL, 0x8A328A1CEDFE552CULL,
+    0x07A3AEC79624C7DAULL, 0x84547DDC3E203C94ULL, 0x990A98FD5071D263ULL, 0x1A4FF12616EEFC89ULL,
+    0xF6F7FD1431714200ULL, 0x30C05B1BA332F41CULL, 0x8D2636B81555A786ULL, 0x46C9FEB55D120902ULL,
+    0xCCEC0A73B49C9921ULL, 0x4E9D2827355FC492ULL, 0x19EBB029435DCB0FULL, 0x4659D2B743848A2CULL,
+    0x963EF2C96B33BE31ULL, 0x74F85198B05A2E7DULL, 0x5A0F544DD2B1FB18ULL, 0x03727073C2E134B1ULL,
+    0xC7F6AA2DE59AEA61ULL, 0x352787BAA0D7C22FULL, 0x9853EAB63B5E0B35ULL, 0xABBDCDD7ED5C0860ULL,
+    0xCF05DAF5AC8D77B0ULL, 0x49CAD48CEBF4A71EULL, 0x7A4C10EC2158C4A6ULL, 0xD9E92AA246BF719EULL,
+    0x13AE978D09FE5557ULL, 0x730499AF921549FFULL, 0x4E4B705B92903BA4ULL, 0xFF577222C14F0A3AULL,
+    0x55B6344CF97AAFAEULL, 0xB862225B055B6960ULL, 0xCAC09AFBDDD2CDB4ULL, 0xDAF8E9829FE96B5FULL,
+    0xB5FDFC5D3132C498ULL, 0x310CB380DB6F7503ULL, 0xE87FBB46217A360EULL, 0x2102AE466EBB1148ULL,
+    0xF8549E1A3AA5E00DULL, 0x07A69AFDCC42261AULL, 0xC4C118BFE78FEAAEULL, 0xF9F4892ED96BD438ULL,
+    0x1AF3DBE25D8F45DAULL, 0xF5B4B0B0D2DEEEB4ULL, 0x962ACEEFA82E1C84ULL, 0x046E3ECAAF453CE9ULL,
+    0xF05D129681949A4CULL, 0x964781CE734B3C84ULL, 0x9C2ED44081CE5FBDULL, 0x522E23F3925E319EULL,
+    0x177E00F9FC32F791ULL, 0x2BC60A63A6F3B3F2ULL, 0x222BBFAE61725606ULL, 0x486289DDCC3D6780ULL,
+    0x7DC7785B8EFDFC80ULL, 0x8AF38731C02BA980ULL, 0x1FAB64EA29A2DDF7ULL, 0xE4D9429322CD065AULL,
+    0x9DA058C67844F20CULL, 0x24C0E332B70019B0ULL, 0x233003B5A6CFE6ADULL, 0xD586BD01C5C217F6ULL,
+    0x5E5637885F29BC2BULL, 0x7EBA726D8C94094BULL, 0x0A56A5F0BFE39272ULL, 0xD79476A84EE20D06ULL,
+    0x9E4C1269BAA4BF37ULL, 0x17EFEE45B0DEE640ULL, 0x1D95B0A5FCF90BC6ULL, 0x93CBE0B699C2585DULL,
+    0x65FA4F227A2B6D79ULL, 0xD5F9E858292504D5ULL, 0xC2B5A03F71471A6FULL, 0x59300222B4561E00ULL,
+    0xCE2F8642CA0712DCULL, 0x7CA9723FBB2E8988ULL, 0x2785338347F2BA08ULL, 0xC61BB3A141E50E8CULL,
+    0x150F361DAB9DEC26ULL, 0x9F6A419D382595F4ULL, 0x64A53DC924FE7AC9ULL, 0x142DE49FFF7A7C3DULL,
+    0x0C335248857FA9E7ULL, 0x0A9C32D5EAE45305ULL, 0xE6C42178C4BBB92EULL, 0x71F1CE2490D20B07ULL,
+    0xF1BCC3D275AFE51AULL, 0xE728E8C83C334074ULL, 0x96FBF83A12884624ULL, 0x81A1549FD6573DA5ULL,
+    0x5FA7867CAF35E149ULL, 0x56986E2EF3ED091BULL, 0x917F1DD5F8886C61ULL, 0xD20D8C88C8FFE65FULL,
+    0x31D71DCE64B2C310ULL, 0xF165B587DF898190ULL, 0xA57E6339DD2CF3A0ULL, 0x1EF6E6DBB1961EC9ULL,
+    0x70CC73D90BC26E24ULL, 0xE21A6B35DF0C3AD7ULL, 0x003A93D8B2806962ULL, 0x1C99DED33CB890A1ULL,
+    0xCF3145DE0ADD4289ULL, 0xD0E4427A5514FB72ULL, 0x77C621CC9FB3A483ULL, 0x67A34DAC4356550BULL,
+    0xF8D626AAAF278509ULL
+};
+
+// offsets of non piece keys in the Polyglot random table
+#define POLYGLOT_CASTLE 768
+#define POLYGLOT_ENPASSANT 772
+#define POLYGLOT_TURN 780
+
+// book move selection
+enum { BOOK_WEIGHTED, BOOK_UNIFORM, BOOK_BEST };
+
+// mapped book file (NULL if no book is loaded)
+unsigned char *book_data = NULL;
+
+// size of the mapped file in bytes
+size_t book_size = 0;
+
+// number of 16 byte entries
+size_t book_entries = 0;
+
+// move selection mode
+int book_mode = BOOK_WEIGHTED;
+
+// random state for picking book moves (per thread, seeded on first use)
+THREAD_LOCAL U64 book_random_state = 0;
+
+// Polyglot key of the current position
+U64 polyglot_key()
+{
+    U64 key = 0ULL;
+
+    // piece keys (Polyglot kinds alternate black/white: bp, wp, bn, wn, ...)
+    for (int piece = P; piece <= k; piece++)
+    {
+        U64 bitboard = bitboards[piece];
+
+        int kind = 2 * (piece % 6) + (piece < p);
+
+        while (bitboard)
+        {
+            int square = get_ls1b_index(bitboard);
+
+            // Polyglot counts rows from rank 1
+            key ^= polyglot_random[64 * kind + 8 * (7 - square / 8) + square % 8];
+
+            pop_bit(bitboard, square);
+        }
+    }
+
+    // castling keys (same bit order as castling rights)
+    for (int right = 0; right < 4; right++)
+    {
+        if (castle & (1 << right))
+            key ^= polyglot_random[POLYGLOT_CASTLE + right];
+    }
+
+    // en passant file only counts if a pawn can actually capture
+    if (enpassant != no_sq)
+    {
+        U64 capturers = (side == white) ? pawn_attacks[black][enpassant] & bitboards[P]
+                                        : pawn_attacks[white][enpassant] & bitboards[p];
+
+        if (capturers)
+            key ^= polyglot_random[POLYGLOT_ENPASSANT + enpassant % 8];
+    }
+
+    // Polyglot keys white to move
+    if (side == white)
+        key ^= polyglot_random[POLYGLOT_TURN];
+
+    return key;
+}
+
+// read big endian number from the book
+static inline U64 book_read(unsigned char *bytes, int count)
+{
+    U64 value = 0ULL;
+
+    for (int index = 0; index < count; index++)
+        value = (value << 8) | bytes[index];
+
+    return value;
+}
+
+// unmap current book
+void close_book()
+{
+    if (book_data == NULL)
+        return;
+
+#ifdef __MINGW32__
+    free(book_data);
+#else
+    munmap(book_data, book_size);
+#endif
+
+    book_data = NULL;
+    book_size = 0;
+    book_entries = 0;
+}
+
+// map book file into memory, returns 0 on failure
+int open_book(char *file_name)
+{
+    close_book();
+
+#ifdef __MINGW32__
+    // no mmap: read the whole book instead
+    FILE *file = fopen(file_name, "rb");
+
+    if (file == NULL)
+        return 0;
+
+    fseek(file, 0, SEEK_END);
+    book_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    book_data = malloc(book_size ? book_size : 1);
+
+    if (fread(book_data, 1, book_size, file) != book_size)
+    {
+        fclose(file);
+        close_book();
+        return 0;
+    }
+
+    fclose(file);
+#else
+    int file = open(file_name, O_RDONLY);
+
+    if (file < 0)
+        return 0;
+
+    struct stat file_stat;
+
+    if (fstat(file, &file_stat) < 0 || file_stat.st_size < 16)
+    {
+        close(file);
+        return 0;
+    }
+
+    book_size = file_stat.st_size;
+    book_data = mmap(NULL, book_size, PROT_READ, MAP_SHARED, file, 0);
+
+    // mapping stays valid after close
+    close(file);
+
+    if (book_data == MAP_FAILED)
+    {
+        book_data = NULL;
+        book_size = 0;
+        return 0;
+    }
+#endif
+
+    book_entries = book_size / 16;
+
+    return 1;
+}
+
+// xorshift64 for book move picking
+static inline U64 book_random()
+{
+    // different seed for every thread
+    if (book_random_state == 0)
+        book_random_state = (get_time_ns() ^ ((U64)(size_t)&book_random_state * 0x9E3779B97F4A7C15ULL)) | 1;
+
+    book_random_state ^= book_random_state << 13;
+    book_random_state ^= book_random_state >> 7;
+    book_random_state ^= book_random_state << 17;
+
+    return book_random_state;
+}
+
+// convert Polyglot move to a legal move in the current position (0 if none)
+int book_move_to_move(int book_move)
+{
+    int source_square = (7 - ((book_move >> 9) & 7)) * 8 + ((book_move >> 6) & 7);
+    int target_square = (7 - ((book_move >> 3) & 7)) * 8 + (book_move & 7);
+    int promoted = (book_move >> 12) & 7;
+
+    // Polyglot castling is king takes own rook
+    if (get_bit(bitboards[K] | bitboards[k], source_square) && (source_square == e1 || source_square == e8))
+    {
+        if (target_square == h1 || target_square == h8) target_square -= 1;
+        if (target_square == a1 || target_square == a8) target_square += 2;
+    }
+
+    moves move_list[1];
+
+    generate_moves(move_list);
+
+    for (int count = 0; count < move_list->count; count++)
+    {
+        int move = move_list->moves[count];
+
+        if (get_move_source(move) != source_square || get_move_dest(move) != target_square)
+            continue;
+
+        // Polyglot promotion pieces are knight 1 to queen 4, same as piece % 6
+        if ((get_move_promoted(move) ? get_move_promoted(move) % 6 : 0) != promoted)
+            continue;
+
+        copy_board();
+
+        int legal = make_move(move, all_moves);
+
+        take_back();
+
+        if (legal)
+            return move;
+    }
+
+    return 0;
+}
+
+// pick a book move for the current position (0 if out of book)
+int probe_book()
+{
+    if (book_data == NULL)
+        return 0;
+
+    U64 key = polyglot_key();
+
+    // binary search first entry with the position key
+    size_t low = 0, high = book_entries;
+
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+
+        if (book_read(book_data + middle * 16, 8) < key)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    // collect moves
+    int book_moves[256];
+    int weights[256];
+    int count = 0;
+    U64 total_weight = 0;
+
+    for (size_t entry = low; entry < book_entries && count < 256; entry++)
+    {
+        unsigned char *bytes = book_data + entry * 16;
+
+        if (book_read(bytes, 8) != key)
+            break;
+
+        int weight = book_read(bytes + 10, 2);
+
+        // zero weight entries are never played
+        if (weight == 0)
+            continue;
+
+        int move = book_move_to_move(book_read(bytes + 8, 2));
+
+        if (move == 0)
+            continue;
+
+        book_moves[count] = move;
+        weights[count] = weight;
+        total_weight += weight;
+        count++;
+    }
+
+    if (count == 0)
+        return 0;
+
+    // heaviest entry
+    if (book_mode == BOOK_BEST)
+    {
+        int best = 0;
+
+        for (int index = 1; index < count; index++)
+        {
+            if (weights[index] > weights[best])
+                best = index;
+        }
+
+        return book_moves[best];
+    }
+
+    // any entry
+    if (book_mode == BOOK_UNIFORM)
+        return book_moves[book_random() % count];
+
+    // entry chosen with probability proportional to its weight
+    U64 pick = book_random() % total_weight;
+
+    for (int index = 0; index < count; index++)
+    {
+        if (pick < (U64)weights[index])
+            return book_moves[index];
+
+        pick -= weights[index];
+    }
+
+    return book_moves[count - 1];
+}
+
+
+/*
+    Book builder: PGN games -> Polyglot book
+
+    The reading thread cuts the PGN stream into batches of whole games and
+    hands them to worker threads through a bounded queue. Every worker replays
+    its games on its own (thread local) board and collects one record per
+    position and move with win / draw / loss counts from the mover's side.
+    Records are sorted and merged in place when a worker's share of the memory
+    budget fills up; if that doesn't free enough room they're spilled to a
+    sorted temporary run. Once BOOK_MAX_RUNS runs exist they are merged into
+    one, which keeps the number of open files bounded. At the end all runs
+    are merged into the book (k-way merge over a binary heap of run heads),
+    moves weighted 2 * wins + draws like Polyglot's make-book. The memory
+    budget covers the PGN batches in flight as well.
+*/
+
+// default book depth in plies
+#define BOOK_PLIES 30
+
+// default memory budget for position records (MB)
+#define BOOK_MEMORY_MB 256
+
+// PGN text per batch handed to a worker
+#define BOOK_BATCH_SIZE (1 << 20)
+
+// batches waiting for workers (2 per worker are used)
+#define BOOK_QUEUE_SIZE (2 * MAX_THREADS)
+
+// temporary runs kept before they are merged into one
+#define BOOK_MAX_RUNS 64
+
+// position / move statistics
+typedef struct {
+    U64 key;
+    unsigned short move;
+    unsigned int wins;
+    unsigned int draws;
+    unsigned int losses;
+} book_record;
+
+// batch of complete games
+typedef struct {
+    char *text;
+    size_t length;
+} book_batch;
+
+// shared state of the builder
+typedef struct {
+    // batch queue
+    book_batch queue[BOOK_QUEUE_SIZE];
+    int head, tail, queued, queue_limit;
+    int done;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+
+    // sorted runs spilled to disk
+    FILE *runs[BOOK_MAX_RUNS];
+    U64 run_records[BOOK_MAX_RUNS];
+    int run_count;
+
+    // settings
+    int max_plies;
+    size_t records_per_worker;
+
+    // totals
+    U64 games;
+    U64 skipped;
+    U64 positions;
+    int collapses;              // intermediate merges of all runs
+} book_builder;
+
+// order records by key, then move
+int compare_book_records(const void *first, const void *second)
+{
+    const book_record *a = first, *b = second;
+
+    if (a->key != b->key) return (a->key < b->key) ? -1 : 1;
+
+    return (int)a->move - (int)b->move;
+}
+
+// sort records and merge duplicates, returns new count
+size_t compact_book_records(book_record *records, size_t count)
+{
+    if (count == 0)
+        return 0;
+
+    qsort(records, count, sizeof(book_record), compare_book_records);
+
+    size_t last = 0;
+
+    for (size_t index = 1; index < count; index++)
+    {
+        if (records[index].key == records[last].key && records[index].move == records[last].move)
+        {
+            records[last].wins += records[index].wins;
+            records[last].draws += records[index].draws;
+            records[last].losses += records[index].losses;
+        }
+        else
+            records[++last] = records[index];
+    }
+
+    return last + 1;
+}
+
+// k-way merge of sorted runs: binary min heap of runs ordered by their head record
+typedef struct {
+    FILE **runs;
+    U64 *left;                  // records not read yet, including the head
+    book_record *heads;
+    int *heap;
+    int size;
+} book_merge;
+
+// restore heap order below a heap slot
+static void book_heap_down(book_merge *merge, int slot)
+{
+    while (1)
+    {
+        int smallest = slot;
+        int child = 2 * slot + 1;
+
+        for (int last = child + 2; child < last && child < merge->size; child++)
+        {
+            if (compare_book_records(&merge->heads[merge->heap[child]], &merge->heads[merge->heap[smallest]]) < 0)
+                smallest = child;
+        }
+
+        if (smallest == slot)
+            return;
+
+        int run = merge->heap[slot];
+
+        merge->heap[slot] = merge->heap[smallest];
+        merge->heap[smallest] = run;
+        slot = smallest;
+    }
+}
+
+// replace the smallest head by the next record of its run
+static void book_merge_advance(book_merge *merge)
+{
+    int run = merge->heap[0];
+
+    if (--merge->left[run] == 0 || fread(&merge->heads[run], sizeof(book_record), 1, merge->runs[run]) != 1)
+    {
+        merge->left[run] = 0;
+        merge->heap[0] = merge->heap[--merge->size];
+    }
+
+    book_heap_down(merge, 0);
+}
+
+// load the first record of every run, returns 0 if out of memory
+int book_merge_start(book_merge *merge, FILE **runs, U64 *left, int run_count)
+{
+    merge->runs = runs;
+    merge->left = left;
+    merge->heads = malloc((run_count ? run_count : 1) * sizeof(book_record));
+    merge->heap = malloc((run_count ? run_count : 1) * sizeof(int));
+    merge->size = 0;
+
+    if (merge->heads == NULL || merge->heap == NULL)
+        return 0;
+
+    for (int run = 0; run < run_count; run++)
+    {
+        if (left[run] && fread(&merge->heads[run], sizeof(book_record), 1, runs[run]) == 1)
+            merge->heap[merge->size++] = run;
+    }
+
+    for (int slot = merge->size / 2 - 1; slot >= 0; slot--)
+        book_heap_down(merge, slot);
+
+    return 1;
+}
+
+// next record in key / move order with equal records of all runs combined, 0 at the end
+int book_merge_next(book_merge *merge, book_record *record)
+{
+    if (merge->size == 0)
+        return 0;
+
+    *record = merge->heads[merge->heap[0]];
+    book_merge_advance(merge);
+
+    while (merge->size && compare_book_records(&merge->heads[merge->heap[0]], record) == 0)
+    {
+        book_record *same = &merge->heads[merge->heap[0]];
+
+        record->wins += same->wins;
+        record->draws += same->draws;
+        record->losses += same->losses;
+
+        book_merge_advance(merge);
+    }
+
+    return 1;
+}
+
+void book_merge_end(book_merge *merge)
+{
+    free(merge->heads);
+    free(merge->heap);
+}
+
+// merge all runs into a single one (builder lock held)
+void collapse_book_runs(book_builder *builder)
+{
+    FILE *run = tmpfile();
+
+    book_merge merge;
+    book_record record;
+    U64 count = 0;
+
+    if (run == NULL || !book_merge_start(&merge, builder->runs, builder->run_records, builder->run_count))
+    {
+        printf("makebook: could not merge temporary runs\n");
+        exit(1);
+    }
+
+    while (book_merge_next(&merge, &record))
+    {
+        if (fwrite(&record, sizeof(book_record), 1, run) != 1)
+        {
+            printf("makebook: could not write temporary run\n");
+            exit(1);
+        }
+
+        count++;
+    }
+
+    book_merge_end(&merge);
+
+    for (int index = 0; index < builder->run_count; index++)
+        fclose(builder->runs[index]);
+
+    rewind(run);
+
+    builder->runs[0] = run;
+    builder->run_records[0] = count;
+    builder->run_count = 1;
+    builder->collapses++;
+}
+
+// write sorted records as a temporary run
+void spill_book_records(book_builder *builder, book_record *records, size_t count)
+{
+    if (count == 0)
+        return;
+
+    FILE *run = tmpfile();
+
+    if (run == NULL || fwrite(records, sizeof(book_record), count, run) != count)
+    {
+        printf("makebook: could not write temporary run\n");
+        exit(1);
+    }
+
+    rewind(run);
+
+    pthread_mutex_lock(&builder->lock);
+
+    // all run slots taken: combine them first
+    if (builder->run_count == BOOK_MAX_RUNS)
+        collapse_book_runs(builder);
+
+    builder->runs[builder->run_count] = run;
+    builder->run_records[builder->run_count] = count;
+    builder->run_count++;
+
+    pthread_mutex_unlock(&builder->lock);
+}
+
+// engine move to Polyglot move (castling as king takes rook)
+int move_to_book_move(int move)
+{
+    int source_square = get_move_source(move);
+    int target_square = get_move_dest(move);
+
+    if (get_move_castling(move))
+        target_square += (target_square % 8 == 6) ? 1 : -2;
+
+    int promoted = get_move_promoted(move) ? get_move_promoted(move) % 6 : 0;
+
+    return (target_square % 8) | (7 - target_square / 8) << 3 |
+           (source_square % 8) << 6 | (7 - source_square / 8) << 9 | promoted << 12;
+}
+
+// parse SAN move (e.g. "Nbxd7+", "exd8=Q", "O-O-O") in the current position (0 if illegal)
+int parse_san(char *san)
+{
+    char token[16];
+    int length = 0;
+
+    // drop check, mate and annotation marks
+    while (san[length] && length < 15 && !strchr("+#!?", san[length]))
+    {
+        token[length] = san[length];
+        length++;
+    }
+
+    token[length] = '\0';
+
+    int piece_type = 0, promoted = 0, castling = 0;
+    int source_file = -1, source_rank = -1;
+    int target_square = -1;
+
+    if (strncmp(token, "O-O-O", 5) == 0 || strncmp(token, "0-0-0", 5) == 0)
+        castling = 2;
+
+    else if (strncmp(token, "O-O", 3) == 0 || strncmp(token, "0-0", 3) == 0)
+        castling = 1;
+
+    else
+    {
+        char *current = token;
+
+        // piece letter (pawn if none)
+        char *letter = strchr("PNBRQK", *current);
+
+        if (*current && letter)
+        {
+            piece_type = letter - "PNBRQK";
+            current++;
+        }
+
+        // promotion piece at the end ("e8=Q" or "e8Q")
+        if (length > 2 && strchr("NBRQ", token[length - 1]) && piece_type == 0)
+        {
+            promoted = strchr("PNBRQK", token[length - 1]) - "PNBRQK";
+            token[--length] = '\0';
+
+            if (token[length - 1] == '=')
+                token[--length] = '\0';
+        }
+
+        if (length - (current - token) < 2)
+            return 0;
+
+        // target square is the last two characters
+        char *target = token + length - 2;
+
+        if (target[0] < 'a' || target[0] > 'h' || target[1] < '1' || target[1] > '8')
+            return 0;
+
+        target_square = (8 - (target[1] - '0')) * 8 + (target[0] - 'a');
+
+        // disambiguation and capture mark
+        for (; current < target; current++)
+        {
+            if (*current >= 'a' && *current <= 'h') source_file = *current - 'a';
+            else if (*current >= '1' && *current <= '8') source_rank = 8 - (*current - '0');
+        }
+    }
+
+    moves move_list[1];
+
+    generate_moves(move_list);
+
+    for (int count = 0; count < move_list->count; count++)
+    {
+        int move = move_list->moves[count];
+
+        if (castling)
+        {
+            if (!get_move_castling(move) || (get_move_dest(move) % 8 == 6) != (castling == 1))
+                continue;
+        }
+        else
+        {
+            if (get_move_piece(move) % 6 != piece_type || get_move_dest(move) != target_square)
+                continue;
+
+            if ((get_move_promoted(move) ? get_move_promoted(move) % 6 : 0) != promoted)
+                continue;
+
+            if (source_file != -1 && get_move_source(move) % 8 != source_file)
+                continue;
+
+            if (source_rank != -1 && get_move_source(move) / 8 != source_rank)
+                continue;
+        }
+
+        copy_board();
+
+        int legal = make_move(move, all_moves);
+
+        take_back();
+
+        if (legal)
+            return move;
+    }
+
+    return 0;
+}
+
+// replay one game and record its positions, returns number of positions (-1 if the game is skipped)
+int record_book_game(book_builder *builder, char *game, book_record *records, size_t *count)
+{
+    // result from white's point of view: 1 win, 0 draw, -1 loss
+    int result;
+
+    char *tag = strstr(game, "[Result \"");
+
+    if (tag == NULL)
+        return -1;
+
+    tag += 9;
+
+    if (strncmp(tag, "1-0", 3) == 0) result = 1;
+    else if (strncmp(tag, "0-1", 3) == 0) result = -1;
+    else if (strncmp(tag, "1/2-1/2", 7) == 0) result = 0;
+    else return -1;
+
+    // only standard chess
+    if ((tag = strstr(game, "[Variant \"")) && strncmp(tag + 10, "Standard", 8) != 0)
+        return -1;
+
+    // games from a set up position
+    if ((tag = strstr(game, "[FEN \"")))
+    {
+        char fen[128];
+        int length = strcspn(tag + 6, "\"");
+
+        if (length > 127)
+            return -1;
+
+        memcpy(fen, tag + 6, length);
+        fen[length] = '\0';
+
+        parse_fen(fen);
+    }
+    else
+        parse_fen(start_position);
+
+    // skip tag section
+    char *current = game;
+
+    while (1)
+    {
+        while (isspace((unsigned char)*current)) current++;
+
+        if (*current != '[')
+            break;
+
+        current = strchr(current, '\n');
+
+        if (current == NULL)
+            return 0;
+    }
+
+    int plies = 0;
+
+    while (*current && plies < builder->max_plies)
+    {
+        // comments, variations and annotation glyphs
+        if (*current == '{')
+        {
+            current = strchr(current, '}');
+
+            if (current == NULL) break;
+
+            current++;
+            continue;
+        }
+
+        if (*current == ';')
+        {
+            current = strchr(current, '\n');
+
+            if (current == NULL) break;
+
+            continue;
+        }
+
+        if (*current == '(')
+        {
+            int nesting = 0;
+
+            do
+            {
+                if (*current == '(') nesting++;
+                if (*current == ')') nesting--;
+                current++;
+            }
+            while (*current && nesting);
+
+            continue;
+        }
+
+        if (*current == '$' || isspace((unsigned char)*current))
+        {
+            while (*current && !isspace((unsigned char)*current)) current++;
+            while (isspace((unsigned char)*current)) current++;
+            continue;
+        }
+
+        // cut next token
+        char token[32];
+        int length = 0;
+
+        while (*current && !isspace((unsigned char)*current) && !strchr("{(;", *current))
+        {
+            if (length < 31)
+                token[length++] = *current;
+
+            current++;
+        }
+
+        token[length] = '\0';
+
+        // move number ("12." or "12...")
+        char *san = token;
+
+        while (isdigit((unsigned char)*san)) san++;
+
+        // game termination marker ("0-0" is castling though)
+        if ((*san == '-' || *san == '/' || *san == '*') && strncmp(token, "0-0", 3) != 0)
+            break;
+
+        if (strncmp(token, "0-0", 3) == 0)
+            san = token;
+
+        while (*san == '.') san++;
+
+        if (*san == '\0')
+            continue;
+
+        int move = parse_san(san);
+
+        // stop at the first move we can't follow
+        if (move == 0)
+            break;
+
+        // worker buffer full: merge, spill if that didn't help
+        if (*count == builder->records_per_worker)
+        {
+            *count = compact_book_records(records, *count);
+
+            if (*count > builder->records_per_worker / 2)
+            {
+                spill_book_records(builder, records, *count);
+                *count = 0;
+            }
+        }
+
+        book_record *record = &records[(*count)++];
+
+        record->key = polyglot_key();
+        record->move = move_to_book_move(move);
+        record->wins = (side == white) ? (result == 1) : (result == -1);
+        record->draws = (result == 0);
+        record->losses = (side == white) ? (result == -1) : (result == 1);
+
+        make_move(move, all_moves);
+        plies++;
+    }
+
+    return plies;
+}
+
+// worker: take batches of games until the reader is done
+void *book_worker(void *arg)
+{
+    book_builder *builder = arg;
+
+    book_record *records = malloc(builder->records_per_worker * sizeof(book_record));
+    size_t count = 0;
+
+    U64 games = 0, skipped = 0, positions = 0;
+
+    while (1)
+    {
+        pthread_mutex_lock(&builder->lock);
+
+        while (builder->queued == 0 && !builder->done)
+            pthread_cond_wait(&builder->not_empty, &builder->lock);
+
+        if (builder->queued == 0)
+        {
+            pthread_mutex_unlock(&builder->lock);
+            break;
+        }
+
+        book_batch batch = builder->queue[builder->head];
+        builder->head = (builder->head + 1) % BOOK_QUEUE_SIZE;
+        builder->queued--;
+
+        pthread_cond_signal(&builder->not_full);
+        pthread_mutex_unlock(&builder->lock);
+
+        // games in a batch are separated by '\0'
+        for (char *game = batch.text; game < batch.text + batch.length; game += strlen(game) + 1)
+        {
+            int recorded = record_book_game(builder, game, records, &count);
+
+            if (recorded < 0)
+                skipped++;
+            else
+            {
+                games++;
+                positions += recorded;
+            }
+        }
+
+        free(batch.text);
+    }
+
+    count = compact_book_records(records, count);
+    spill_book_records(builder, records, count);
+
+    free(records);
+
+    pthread_mutex_lock(&builder->lock);
+    builder->games += games;
+    builder->skipped += skipped;
+    builder->positions += positions;
+    pthread_mutex_unlock(&builder->lock);
+
+    return NULL;
+}
+
+// hand a batch of games to the workers (blocks while the queue is full)
+void queue_book_batch(book_builder *builder, char *text, size_t length)
+{
+    pthread_mutex_lock(&builder->lock);
+
+    while (builder->queued == builder->queue_limit)
+        pthread_cond_wait(&builder->not_full, &builder->lock);
+
+    builder->queue[builder->tail].text = text;
+    builder->queue[builder->tail].length = length;
+    builder->tail = (builder->tail + 1) % BOOK_QUEUE_SIZE;
+    builder->queued++;
+
+    pthread_cond_signal(&builder->not_empty);
+    pthread_mutex_unlock(&builder->lock);
+}
+
+// write one position's moves, heaviest first, weights scaled to 16 bits
+U64 write_book_position(FILE *book, book_record *records, int count)
+{
+    U64 weights[256];
+    U64 max_weight = 0;
+
+    for (int index = 0; index < count; index++)
+    {
+        weights[index] = 2ULL * records[index].wins + records[index].draws;
+
+        if (weights[index] > max_weight)
+            max_weight = weights[index];
+    }
+
+    U64 written = 0;
+
+    for (int pass = 0; pass < count; pass++)
+    {
+        // pick heaviest remaining move
+        int best = -1;
+
+        for (int index = 0; index < count; index++)
+        {
+            if (weights[index] && (best == -1 || weights[index] > weights[best]))
+                best = index;
+        }
+
+        // moves that never scored are left out
+        if (best == -1)
+            break;
+
+        U64 weight = (max_weight > 65535) ? weights[best] * 65535 / max_weight : weights[best];
+
+        if (weight == 0)
+            weight = 1;
+
+        unsigned char entry[16];
+
+        for (int byte = 0; byte < 8; byte++)
+            entry[byte] = records[best].key >> (56 - 8 * byte);
+
+        entry[8] = records[best].move >> 8;
+        entry[9] = records[best].move;
+        entry[10] = weight >> 8;
+        entry[11] = weight;
+        memset(entry + 12, 0, 4);
+
+        fwrite(entry, 1, 16, book);
+
+        weights[best] = 0;
+        written++;
+    }
+
+    return written;
+}
+
+// merge sorted runs into the book, returns number of entries
+U64 merge_book_runs(book_builder *builder, FILE *book)
+{
+    book_merge merge;
+
+    if (!book_merge_start(&merge, builder->runs, builder->run_records, builder->run_count))
+    {
+        printf("makebook: out of memory while merging\n");
+        exit(1);
+    }
+
+    book_record position[256], record;
+    int moves_count = 0;
+
+    U64 entries = 0;
+
+    // records come in key / move order with equal moves combined
+    while (book_merge_next(&merge, &record))
+    {
+        // flush position when the key changes
+        if (moves_count && record.key != position[0].key)
+        {
+            entries += write_book_position(book, position, moves_count);
+            moves_count = 0;
+        }
+
+        if (moves_count < 256)
+            position[moves_count++] = record;
+    }
+
+    if (moves_count)
+        entries += write_book_position(book, position, moves_count);
+
+    book_merge_end(&merge);
+
+    for (int run = 0; run < builder->run_count; run++)
+        fclose(builder->runs[run]);
+
+    return entries;
+}
+
+// build Polyglot book from PGN file, returns 0 on success
+int make_book(char *pgn_file, char *book_file, int max_plies, int memory_mb)
+{
+    FILE *pgn = fopen(pgn_file, "r");
+
+    if (pgn == NULL)
+    {
+        printf("makebook: could not open %s\n", pgn_file);
+        return 1;
+    }
+
+    FILE *book = fopen(book_file, "wb");
+
+    if (book == NULL)
+    {
+        printf("makebook: could not create %s\n", book_file);
+        fclose(pgn);
+        return 1;
+    }
+
+    static book_builder builder;
+
+    memset(&builder, 0, sizeof(builder));
+    pthread_mutex_init(&builder.lock, NULL);
+    pthread_cond_init(&builder.not_empty, NULL);
+    pthread_cond_init(&builder.not_full, NULL);
+
+    builder.max_plies = max_plies;
+    builder.queue_limit = 2 * threads;
+
+    // budget left after the batches in flight: queued, one per worker and the one being filled
+    size_t batch_memory = (size_t)(builder.queue_limit + threads + 1) * BOOK_BATCH_SIZE;
+    size_t memory = (size_t)memory_mb << 20;
+
+    builder.records_per_worker = (memory > batch_memory) ? (memory - batch_memory) / sizeof(book_record) / threads : 0;
+
+    if (builder.records_per_worker < 1024)
+        builder.records_per_worker = 1024;
+
+    int start = get_time_ms();
+
+    pthread_t workers[MAX_THREADS];
+
+    for (int index = 0; index < threads; index++)
+        pthread_create(&workers[index], NULL, book_worker, &builder);
+
+    // cut the stream into batches of whole games
+    char line[8192];
+
+    char *batch = malloc(BOOK_BATCH_SIZE);
+    size_t length = 0, game_start = 0;
+
+    int in_moves = 0, dropping = 0;
+
+    while (fgets(line, sizeof(line), pgn))
+    {
+        size_t line_length = strlen(line);
+
+        // tag line after movetext starts the next game
+        if (line[0] == '[' && in_moves)
+        {
+            if (dropping)
+                length = game_start;
+            else
+                batch[length++] = '\0';
+
+            game_start = length;
+            in_moves = dropping = 0;
+
+            // batch full: hand it over
+            if (length > BOOK_BATCH_SIZE / 2)
+            {
+                queue_book_batch(&builder, batch, length);
+
+                batch = malloc(BOOK_BATCH_SIZE);
+                length = game_start = 0;
+            }
+        }
+
+        else if (line[0] != '[' && line[0] != '\n' && line[0] != '\r')
+            in_moves = 1;
+
+        if (dropping)
+            continue;
+
+        // drop games too long for a batch
+        if (length + line_length + 1 >= BOOK_BATCH_SIZE)
+        {
+            length = game_start;
+            dropping = 1;
+            continue;
+        }
+
+        memcpy(batch + length, line, line_length);
+        length += line_length;
+    }
+
+    // last game
+    if (dropping)
+        length = game_start;
+    else if (in_moves)
+        batch[length++] = '\0';
+
+    if (length)
+        queue_book_batch(&builder, batch, length);
+    else
+        free(batch);
+
+    fclose(pgn);
+
+    // let workers drain the queue
+    pthread_mutex_lock(&builder.lock);
+    builder.done = 1;
+    pthread_cond_broadcast(&builder.not_empty);
+    pthread_mutex_unlock(&builder.lock);
+
+    for (int index = 0; index < threads; index++)
+        pthread_join(workers[index], NULL);
+
+    U64 entries = merge_book_runs(&builder, book);
+
+    fclose(book);
+
+    int time = get_time_ms() - start;
+
+    printf("Games      : %llu (%llu skipped)\n", builder.games, builder.skipped);
+    printf("Positions  : %llu\n", builder.positions);
+    printf("Entries    : %llu\n", entries);
+    printf("Runs       : %d (%d intermediate merges)\n", builder.run_count, builder.collapses);
+    printf("Time (ms)  : %d\n", time);
+    printf("Games/s    : %llu\n", time ? builder.games * 1000 / time : builder.games);
+
+    return 0;
+}
+
+
+/********************************************
+*
+*                      UCI
+*                 forked from BBC
+*
+************************************************/
+
+// parse user/GUI move string input (e.g. "e7e8q")
+int parse_move(char *move_string)
+{
+    // create move list instance
+    moves move_list[1];
+    
+    // generate moves
+    generate_moves(move_list);
+    // print_move_list(move_list);
+    
+    // parse source square
+    int source_square = (move_string[0] - 'a') + (8 - (move_string[1] - '0')) * 8;
+    
+    // parse target square
+    int target_square = (move_string[2] - 'a') + (8 - (move_string[3] - '0')) * 8;
+    
+    // loop over the moves within a move list
+    for (int move_count = 0; move_count < move_list->count; move_count++)
+    {
+        // init move
+        int move = move_list->moves[move_count];
+        
+        // make sure source & target squares are available within the generated move
+        if (source_square == get_move_source(move) && target_square == get_move_dest(move))
+        {
+            // init promoted piece
+            int promoted_piece = get_move_promoted(move);
+            
+            // promoted piece is available
+            if (promoted_piece)
+            {
+                // promoted to queen
+                if ((promoted_piece == Q || promoted_piece == q) && move_string[4] == 'q')
+                    // return legal move
+                    return move;
+                
+                // promoted to rook
+                else if ((promoted_piece == R || promoted_piece == r) && move_string[4] == 'r')
+                    // return legal move
+                    return move;
+                
+                // promoted to bishop
+                else if ((promoted_piece == B || promoted_piece == b) && move_string[4] == 'b')
+                    // return legal move
+                    return move;
+                
+                // promoted to knight
+                else if ((promoted_piece == N || promoted_piece == n) && move_string[4] == 'n')
+                    // return legal move
+                    return move;
+                
+                // continue the loop on possible wrong promotions (e.g. "e7e8f")
+                continue;
+            }
+            
+            // return legal move
+            return move;
+        }
+    }
+    
+    // return illegal move
+    return 0;
+}
+
+/*
+    Example UCI commands to init position on chess board
+    
+    // init start position
+    position startpos
+    
+    // init start position and make the moves on chess board
+    position startpos moves e2e4 e7e5
+    
+    // init position from FEN string
+    position fen r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1 
+    
+    // init position from fen string and make moves on chess board
+    position fen r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1 moves e2a6 e8g8
+*/
+
+// make moves from a UCI move list on the chess board, returns number of moves made
+int make_move_list(char *current_char)
+{
+    int move_count = 0;
+
+    // skip separator left over from a shared move list prefix
+    while (*current_char == ' ') current_char++;
+
+    // loop over moves within a move string
+    while(*current_char)
+    {
+        // parse next move
+        int move = parse_move(current_char);
+        // printf("\nParsed Move: ");
+        // print_move(move);
+        
+        // if no more moves
+        if (move == 0)
+            // break out of the loop
+            break;
+        
+        // make move on the chess board
+        make_move(move, all_moves);
+
+        // remember the last moves for warm starting the next search
+        warm_start_moves[0] = warm_start_moves[1];
+        warm_start_moves[1] = move;
+
+        move_count++;
+        
+        // move current character mointer to the end of current move
+        while (*current_char && *current_char != ' ') current_char++;
+        
+        // go to the next move
+        if (*current_char) current_char++;
+    }
+
+    return move_count;
+}
+
+// parse UCI "position" command
+void parse_position(char *command)
+{
+    // work on a copy without the line ending
+    char buffer[3000];
+
+    strncpy(buffer, command, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+    buffer[strcspn(buffer, "\r\n")] = '\0';
+
+    // shift pointer to the right where next token begins
+    command = buffer + 9;
+    
+    // init pointer to the current character in the command string
+    char *current_char = command;
+
+    // split command into position base and move list
+    char *move_list = strstr(command, "moves");
+
+    int base_length = move_list ? move_list - command : (int)strlen(command);
+
+    while (base_length && command[base_length - 1] == ' ')
+        base_length--;
+
+    move_list = move_list ? move_list + 6 : "";
+
+    if ((int)strlen(move_list) > (int)sizeof(session_moves) - 1 || base_length > (int)sizeof(session_base) - 1)
+        reset_session();
+
+    int session_length = strlen(session_moves);
+
+    // same game with more moves: continue from the previous board and make the new moves only
+    if (session_base[0] && (int)strlen(session_base) == base_length && strncmp(command, session_base, base_length) == 0
+        && strncmp(move_list, session_moves, session_length) == 0
+        && (session_length == 0 || move_list[session_length] == ' ' || move_list[session_length] == '\0'))
+    {
+        load_board_state(&session_board);
+
+        int new_moves = make_move_list(move_list + session_length);
+
+        // warm start only when the game moved on by our move and/or the reply
+        warm_start_plies = (new_moves <= 2) ? new_moves : 0;
+
+        // with a single new move the last two recorded moves are (old, new), keep the new one first
+        if (new_moves == 1)
+            warm_start_moves[0] = warm_start_moves[1];
+    }
+
+    else
+    {
+        // parse UCI "startpos" command
+        if (strncmp(command, "startpos", 8) == 0)
+            // init chess board with start position
+            parse_fen(start_position);
+        
+        // parse UCI "fen" command 
+        else
+        {
+            // make sure "fen" command is available within command string
+            current_char = strstr(command, "fen");
+            
+            // if no "fen" command is available within command string
+            if (current_char == NULL)
+                // init chess board with start position
+                parse_fen(start_position);
+                
+            // found "fen" substring
+            else
+            {
+                // shift pointer to the right where next token begins
+                current_char += 4;
+                
+                // init chess board with position from FEN string
+                parse_fen(current_char);
+            }
+        }
+        
+        // parse moves after position
+        make_move_list(move_list);
+
+        // unrelated position, search starts cold
+        warm_start_plies = 0;
+    }
+
+    // remember this position for the next command
+    memcpy(session_base, command, base_length);
+    session_base[base_length] = '\0';
+    strcpy(session_moves, move_list);
+    store_board_state(&session_board);
+    
+    // print board
+    //print_board();
+}
+
+// set up the search clock from "go" time parameters (ucitime, inc, movestogo, movetime)
+void start_clock()
+{
+    // if move time is available (only use for first move for lichess compatibility)
+    if(movetime != -1)
+    {
+        // set time equal to move time
+        ucitime = movetime;
+
+        // set moves to go to 1
+        movestogo = 1;
+    }
+
+    // reset movetime
+    movetime = -1;
+
+    // init start time
+    starttime = get_time_ms();
+
+    // if time control is available
+    if(ucitime != -1)
+    {
+        // flag we're playing with time control
+        timeset = 1;
+
+        // set up timing
+        ucitime /= movestogo;
+        ucitime -= 150; // ping overhead
+        stoptime = starttime + ucitime + inc;
+        movestogo--;
+
+        if (movestogo == 0)
+        {
+            movestogo = 15;
+        }
+
+        if(first_move == 1)
+        {
+            movestogo = 120;
+            first_move = 0;
+        }
+    }
+}
+
+// parse UCI command "go"
+void parse_go(char *command)
+{
+    // init parameters
+    int depth = -1;
+
+    // init argument
+    char *argument = NULL;
+
+    // match UCI "perft" command (movegen test, no search)
+    if ((argument = strstr(command,"perft")))
+    {
+        // parse perft depth and count nodes under every root move
+        perft_test(atoi(argument + 6));
+        return;
+    }
+
+    // play from the opening book unless analysing
+    if (book_data && !strstr(command, "infinite") && !strstr(command, "searchmoves"))
+    {
+        int book_move = probe_book();
+
+        if (book_move)
+        {
+            pv_line line = { .score = 0, .length = 1, .moves = { book_move } };
+
+            if (bestmove_hook)
+                bestmove_hook(book_move, &line);
+
+            else
+            {
+                printf("info string book move\n");
+                print_bestmove(book_move);
+            }
+
+            return;
+        }
+    }
+
+    // time control comes with every "go" command, nothing carries over from the last one
+    ucitime = -1;
+    inc = 0;
+    timeset = 0;
+    node_limit = 0;
+
+    // infinite search
+    if ((argument = strstr(command,"infinite"))) {}
+
+    // match UCI "binc" command
+    if ((argument = strstr(command,"binc")) && side == black)
+        // parse black time increment
+        inc = atoi(argument + 5);
+
+    // match UCI "winc" command
+    if ((argument = strstr(command,"winc")) && side == white)
+        // parse white time increment
+        inc = atoi(argument + 5);
+
+    // match UCI "wtime" command
+    if ((argument = strstr(command,"wtime")) && side == white)
+        // parse white time limit
+        ucitime = atoi(argument + 6);
+
+    // match UCI "btime" command
+    if ((argument = strstr(command,"btime")) && side == black)
+        // parse black time limit
+        ucitime = atoi(argument + 6);
+
+    // match UCI "movestogo" command
+    if ((argument = strstr(command,"movestogo")))
+        // parse number of moves to go
+        movestogo = atoi(argument + 10);
+
+    // match UCI "movetime" command
+    if ((argument = strstr(command,"movetime")))
+        // parse amount of time allowed to spend to make a move
+        movetime = atoi(argument + 9);
+
+    // match UCI "nodes" command
+    if ((argument = strstr(command,"nodes")))
+        // parse node budget
+        node_limit = atol(argument + 6);
+
+    // match UCI "depth" command
+    if ((argument = strstr(command,"depth")))
+        // parse search depth
+        depth = atoi(argument + 6);
+
+    // match UCI "searchmoves" command (restrict root to the listed moves)
+    if ((argument = strstr(command,"searchmoves")))
+    {
+        argument += 11;
+
+        search_move_count = 0;
+
+        while (*argument == ' ')
+        {
+            argument++;
+
+            // parse next move
+            int move = parse_move(argument);
+
+            if (move == 0)
+                break;
+
+            search_moves[search_move_count++] = move;
+
+            // move to the end of current move
+            while (*argument && *argument != ' ' && *argument != '\n') argument++;
+        }
+    }
+
+    // set up time control and search position
+    start_clock();
+
+    // if depth is not available
+    if(depth == -1)
+        // set depth to 64 plies (takes ages to complete...)
+        depth = 64;
+
+    // print debug info
+    // printf("time:%d start:%d stop:%d depth:%d timeset:%d\n",
+    // ucitime, starttime, stoptime, depth, timeset);
+
+    // search position
+    // print_board();
+    search_position(depth);
+}
+
+/*
+    Example UCI commands to set engine options
+
+    setoption name Threads value 4
+    setoption name MultiPV value 3
+    setoption name PerftHash value 64
+    setoption name BookFile value books/gm2001.bin
+    setoption name BookMode value best
+    setoption name TablebasePath value tables
+    setoption name EvalFile value eval.params
+    setoption name EvalParam value pawn_score 8 30
+*/
+
+// parse UCI "setoption" command
+void parse_setoption(char *command)
+{
+    // init argument
+    char *argument = NULL;
+
+    // match "Threads" option
+    if ((argument = strstr(command, "name Threads value ")))
+    {
+        threads = atoi(argument + 19);
+
+        // clamp to supported range
+        if (threads < 1) threads = 1;
+        if (threads > MAX_THREADS) threads = MAX_THREADS;
+    }
+
+    // match "MultiPV" option
+    else if ((argument = strstr(command, "name MultiPV value ")))
+    {
+        multipv = atoi(argument + 19);
+
+        // clamp to supported range
+        if (multipv < 1) multipv = 1;
+        if (multipv > MAX_MULTIPV) multipv = MAX_MULTIPV;
+    }
+
+    // match "PerftHash" option
+    else if ((argument = strstr(command, "name PerftHash value ")))
+        init_perft_table(atoi(argument + 21));
+
+    // match "BookFile" option
+    else if ((argument = strstr(command, "name BookFile value ")))
+    {
+        // strip line ending
+        argument[strcspn(argument, "\r\n")] = '\0';
+
+        // empty value unloads the book
+        if (argument[20] == '\0' || strcmp(argument + 20, "<empty>") == 0)
+            close_book();
+
+        else if (!open_book(argument + 20))
+            printf("info string could not open book %s\n", argument + 20);
+    }
+
+    // match "BookMode" option
+    else if ((argument = strstr(command, "name BookMode value ")))
+    {
+        if (strncmp(argument + 20, "uniform", 7) == 0) book_mode = BOOK_UNIFORM;
+        else if (strncmp(argument + 20, "best", 4) == 0) book_mode = BOOK_BEST;
+        else book_mode = BOOK_WEIGHTED;
+    }
+
+    // match "TablebasePath" option
+    else if ((argument = strstr(command, "name TablebasePath value ")))
+    {
+        // strip line ending
+        argument[strcspn(argument, "\r\n")] = '\0';
+
+        // empty value unloads the tables
+        if (argument[25] == '\0' || strcmp(argument + 25, "<empty>") == 0)
+            tb_clear();
+
+        else
+        {
+            int count = tb_load_path(argument + 25);
+
+            printf("info string %d tablebases loaded, up to %d pieces\n", count, tb_pieces);
+        }
+    }
+
+    // match "EvalFile" option
+    else if ((argument = strstr(command, "name EvalFile value ")))
+    {
+        // strip line ending
+        argument[strcspn(argument, "\r\n")] = '\0';
+
+#ifdef CONSTANT_EVAL
+        printf("info string evaluation parameters are fixed in this build\n");
+#else
+        int count = load_eval_params(argument + 20);
+
+        if (count)
+            printf("info string %d evaluation parameters loaded\n", count);
+        else
+            printf("info string could not load evaluation parameters from %s\n", argument + 20);
+#endif
+    }
+
+    // match "EvalParam" option
+    else if ((argument = strstr(command, "name EvalParam value ")))
+    {
+        // strip line ending
+        argument[strcspn(argument, "\r\n")] = '\0';
+
+#ifdef CONSTANT_EVAL
+        printf("info string evaluation parameters are fixed in this build\n");
+#else
+        if (!set_eval_param(argument + 21))
+            printf("info string unknown evaluation parameter %s\n", argument + 21);
+#endif
+    }
+
+#ifdef SEARCH_TRACE
+    // match "TraceFile" option
+    else if ((argument = strstr(command, "name TraceFile value ")))
+    {
+        // strip line ending
+        argument[strcspn(argument, "\r\n")] = '\0';
+
+        set_trace_file(argument + 21);
+    }
+#endif
+}
+
+// main UCI loop
+void uci_loop()
+{
+    // reset STDIN & STDOUT buffers
+    setbuf(stdin, NULL);
+    setbuf(stdout, NULL);
+    
+    // define user / GUI input buffer
+    char input[3000];
+    
+    // print engine info
+    
+    // main loop
+    while (1)
+    {
+        // reset user /GUI input
+        memset(input, 0, sizeof(input));
+        
+        // make sure output reaches the GUI
+        fflush(stdout);
+        
+        // get user / GUI input
+        if (!fgets(input, 3000, stdin))
+            // continue the loop
+            continue;
+        
+        // make sure input is available
+        if (input[0] == '\n')
+            // continue the loop
+            continue;
+        
+        // parse UCI "isready" command
+        if (strncmp(input, "isready", 7) == 0)
+        {
+            printf("readyok\n");
+            continue;
+        }
+        
+        // parse UCI "position" command
+        else if (strncmp(input, "position", 8) == 0)
+            // call parse position function
+            parse_position(input);
+        
+        // parse UCI "ucinewgame" command
+        else if (strncmp(input, "ucinewgame", 10) == 0)
+        {
+            // new game, nothing to carry over from the previous one
+            reset_session();
+
+            // call parse position function
+            parse_position("position startpos");
+        }
+        
+        // parse UCI "go" command
+        else if (strncmp(input, "go", 2) == 0)
+            // call parse go function
+            parse_go(input);
+        
+        // parse "stats" command (dump search statistics of the last search)
+        else if (strncmp(input, "stats", 5) == 0)
+        {
+#ifdef SEARCH_STATS
+            dump_search_stats();
+#else
+            printf("info string search stats not compiled in (build with -DSEARCH_STATS)\n");
+#endif
+        }
+
+        // parse "bench" command (optional depth argument)
+        else if (strncmp(input, "bench", 5) == 0)
+            bench(atoi(input + 5));
+
+        // parse UCI "setoption" command
+        else if (strncmp(input, "setoption", 9) == 0)
+            // call parse setoption function
+            parse_setoption(input);
+
+        // parse UCI "quit" command
+        else if (strncmp(input, "quit", 4) == 0)
+            // quit from the chess engine program execution
+            break;
+        
+        // parse UCI "uci" command
+        else if (strncmp(input, "uci", 3) == 0)
+        {
+            // print engine info
+            printf("id name Jabberook-v1.0\n");
+            printf("id author Kiran\n");
+            printf("option name Threads type spin default 1 min 1 max %d\n", MAX_THREADS);
+            printf("option name MultiPV type spin default 1 min 1 max %d\n", MAX_MULTIPV);
+            printf("option name PerftHash type spin default %d min 0 max 4096\n", PERFT_HASH_MB);
+            printf("option name BookFile type string default <empty>\n");
+            printf("option name BookMode type combo default weighted var weighted var uniform var best\n");
+            printf("option name TablebasePath type string default <empty>\n");
+            printf("option name EvalFile type string default <empty>\n");
+            printf("option name EvalParam type string default <empty>\n");
+#ifdef SEARCH_TRACE
+            printf("option name TraceFile type string default <empty>\n");
+#endif
+            printf("uciok\n");
+        }
+    }
+}
+
+
+/****************************************************************
+ * 
+ * 
+ * 
+ *                      INITIALIZATIONS                                
+ * 
+ * 
+ *
+ * **************************************************************/
+
+void init_all()
+{
+    init_leapers_attacks();
+
+    init_sliders_attacks(bishop);
+    init_sliders_attacks(rook);
+
+    init_random_keys();
+
+    init_kpk_bitbase();
+
+    init_tablebases();
+
+    init_perft_table(PERFT_HASH_MB);
+
+    //init_magic_numbers();
+}
+
+/****************************************************************
+ * 
+ * 
+ * 
+ *                      GAME SERVER
+ * 
+ * 
+ *
+ * **************************************************************/
+
+/*
+    Game contexts
+
+    Board and search state are thread local, everything a game keeps between
+    two commands (position session, warm start data, move ordering tables,
+    clock and MultiPV) lives in a game context that is loaded into the
+    current thread for a command and stored back afterwards. Several games
+    can share one thread this way (server games, library instances).
+*/
+
+typedef struct {
+    char session_base[256];
+    char session_moves[3000];
+    board_state session_board;
+    int warm_start_plies;
+    int warm_start_moves[2];
+    int killer_moves[2][MAX_PLY];
+    int history_moves[12][64];
+    int pv_table[MAX_PLY][MAX_PLY];
+    int pv_length[MAX_PLY];
+    int movestogo, first_move;
+    int multipv;
+} game_context;
+
+// load game into the current thread
+void load_game_context(const game_context *game)
+{
+    memcpy(session_base, game->session_base, sizeof(session_base));
+    memcpy(session_moves, game->session_moves, sizeof(session_moves));
+    session_board = game->session_board;
+    warm_start_plies = game->warm_start_plies;
+    memcpy(warm_start_moves, game->warm_start_moves, sizeof(warm_start_moves));
+    memcpy(killer_moves, game->killer_moves, sizeof(killer_moves));
+    memcpy(history_moves, game->history_moves, sizeof(history_moves));
+    memcpy(pv_table, game->pv_table, sizeof(pv_table));
+    memcpy(pv_length, game->pv_length, sizeof(pv_length));
+    movestogo = game->movestogo;
+    first_move = game->first_move;
+    multipv = game->multipv;
+
+    load_board_state(&session_board);
+}
+
+// store game state of the current thread
+void store_game_context(game_context *game)
+{
+    memcpy(game->session_base, session_base, sizeof(session_base));
+    memcpy(game->session_moves, session_moves, sizeof(session_moves));
+    game->session_board = session_board;
+    game->warm_start_plies = warm_start_plies;
+    memcpy(game->warm_start_moves, warm_start_moves, sizeof(warm_start_moves));
+    memcpy(game->killer_moves, killer_moves, sizeof(killer_moves));
+    memcpy(game->history_moves, history_moves, sizeof(history_moves));
+    memcpy(game->pv_table, pv_table, sizeof(pv_table));
+    memcpy(game->pv_length, pv_length, sizeof(pv_length));
+    game->movestogo = movestogo;
+    game->first_move = first_move;
+    game->multipv = multipv;
+}
+
+// new game at the start position
+void init_game_context(game_context *game)
+{
+    memset(game, 0, sizeof(game_context));
+
+    game->movestogo = 30;
+    game->first_move = 1;
+    game->multipv = 1;
+
+    load_game_context(game);
+
+    reset_session();
+    parse_position("position startpos");
+
+    store_game_context(game);
+}
+
+/*
+    Server mode ("Jabberook server [threads] [socket path]")
+
+    One process serves many games. Every input line starts with a game id
+    followed by a UCI command, output lines carry the same id:
+
+    g1 position startpos moves e2e4         g1 info score cp -25 depth 1 ...
+    g1 go wtime 60000 btime 60000           g1 bestmove e7e5
+    g2 position fen <fen>
+    g2 go movetime 1000
+    g1 stop
+    g1 quit                                 (forget game g1)
+    quit                                    (shut the server down)
+
+    Supported game commands: position, go, stop, ucinewgame, isready,
+    setoption, quit. MultiPV is a per game option, other options are shared
+    and only change once no game is searching.
+
+    Input is never held up by a search: game commands (position, go,
+    ucinewgame, MultiPV) are queued on their game and run in order by a
+    worker, a "go" once the game's previous search is over. Shared options
+    are queued on the server and set as soon as no game is running, games
+    don't start new work meanwhile.
+
+    Searches of all games are run by a pool of worker threads, read only
+    tables (attacks, bitbases, tablebases, book) are shared, the book move
+    picker keeps its random state per thread. Input comes from stdin or,
+    with a socket path, from any number of local socket connections (games
+    belong to the connection that created them).
+*/
+
+// max number of games served at once
+#define SERVER_MAX_GAMES 256
+
+// input / output of one client
+typedef struct {
+    FILE *input;
+    FILE *output;
+    int games;                      // game objects not freed yet
+} server_connection;
+
+// command waiting to be run
+typedef struct server_pending {
+    struct server_pending *next;
+    int stops;                      // stop requests of the game when it was queued
+    char text[];
+} server_pending;
+
+typedef struct server_game {
+    char id[32];
+    game_context context;
+    server_connection *connection;
+    server_pending *pending;        // game commands not run yet (FIFO)
+    server_pending *pending_tail;
+    volatile int stop;              // stop request for the running search
+    int stops;                      // number of stop requests so far
+    int busy;                       // commands queued or running
+    int removed;                    // "quit" received, freed once idle
+    struct server_game *next_job;   // work queue link
+} server_game;
+
+// games served right now
+server_game *server_games[SERVER_MAX_GAMES];
+
+// games with commands waiting for a worker (FIFO)
+server_game *server_queue_head = NULL, *server_queue_tail = NULL;
+
+// shared options waiting until no game is running
+server_pending *server_options = NULL, *server_options_tail = NULL;
+
+// server shuts down
+int server_quit = 0;
+
+// number of games a worker runs commands of
+int server_busy_games = 0;
+
+// guards the game table, the queues and the busy flags
+pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// signalled when work is queued / a game object is freed
+pthread_cond_t server_work = PTHREAD_COND_INITIALIZER;
+pthread_cond_t server_idle = PTHREAD_COND_INITIALIZER;
+
+// keeps output lines of different games apart
+pthread_mutex_t server_output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// game whose commands run on this thread
+THREAD_LOCAL server_game *server_current = NULL;
+
+// write one "<id> <text>" line to the client of a game
+void server_reply(server_game *game, const char *text)
+{
+    pthread_mutex_lock(&server_output_lock);
+
+    fprintf(game->connection->output, "%s %s\n", game->id, text);
+    fflush(game->connection->output);
+
+    pthread_mutex_unlock(&server_output_lock);
+}
+
+// search info hook
+static void server_info(int depth, int line, int time)
+{
+    char info[INFO_LINE_SIZE];
+
+    format_info_line(info, depth, line, time);
+    server_reply(server_current, info);
+}
+
+// search bestmove hook
+static void server_bestmove(int move, pv_line *line)
+{
+    char reply[16] = "bestmove ";
+
+    (void)line;
+
+    move_to_string(move, reply + 9);
+    server_reply(server_current, reply);
+}
+
+// search currmove hook
+static void server_currmove(int move, int number)
+{
+    char reply[64] = "info currmove ";
+
+    move_to_string(move, reply + 14);
+    sprintf(reply + strlen(reply), " currmovenumber %d", number);
+    server_reply(server_current, reply);
+}
+
+// search "info string" hook (stats, profile and trace lines)
+static void server_string(const char *text)
+{
+    server_reply(server_current, text);
+}
+
+// append command to a list (server lock held), returns 0 if out of memory
+static int server_append(server_pending **head, server_pending **tail, const char *text, int stops)
+{
+    server_pending *entry = malloc(sizeof(server_pending) + strlen(text) + 1);
+
+    if (entry == NULL)
+        return 0;
+
+    entry->next = NULL;
+    entry->stops = stops;
+    strcpy(entry->text, text);
+
+    if (*tail)
+        (*tail)->next = entry;
+    else
+        *head = entry;
+
+    *tail = entry;
+
+    return 1;
+}
+
+// put game into the work queue (server lock held)
+static void server_schedule(server_game *game)
+{
+    game->busy = 1;
+    game->next_job = NULL;
+
+    if (server_queue_tail)
+        server_queue_tail->next_job = game;
+    else
+        server_queue_head = game;
+
+    server_queue_tail = game;
+
+    pthread_cond_signal(&server_work);
+}
+
+// set shared options once no game is running (server lock held)
+static void server_apply_options()
+{
+    if (server_busy_games || server_options == NULL)
+        return;
+
+    while (server_options)
+    {
+        server_pending *entry = server_options;
+
+        server_options = entry->next;
+        parse_setoption(entry->text);
+        free(entry);
+    }
+
+    server_options_tail = NULL;
+
+    // queued games may run again
+    pthread_cond_broadcast(&server_work);
+}
+
+// free game object and its queued commands (server lock held)
+static void server_free_game(server_game *game)
+{
+    while (game->pending)
+    {
+        server_pending *entry = game->pending;
+
+        game->pending = entry->next;
+        free(entry);
+    }
+
+    game->connection->games--;
+    free(game);
+
+    pthread_cond_broadcast(&server_idle);
+}
+
+// run one game command on the current thread (game context loaded)
+static void server_run(char *command)
+{
+    if (strncmp(command, "go", 2) == 0)
+        parse_go(command);
+
+    else if (strncmp(command, "position", 8) == 0)
+        parse_position(command);
+
+    else if (strncmp(command, "ucinewgame", 10) == 0)
+        init_game_context(&server_current->context);
+
+    else if (strncmp(command, "setoption", 9) == 0)
+        parse_setoption(command);
+}
+
+// worker thread: run queued commands of any game, one search at a time
+void *server_worker(void *argument)
+{
+    (void)argument;
+
+    // search output goes to the game's client, no stdin polling
+    poll_input = 0;
+    info_hook = server_info;
+    currmove_hook = server_currmove;
+    string_hook = server_string;
+    bestmove_hook = server_bestmove;
+
+    pthread_mutex_lock(&server_lock);
+
+    while (1)
+    {
+        // pending shared options hold back new work
+        while ((server_queue_head == NULL || server_options) && !server_quit)
+            pthread_cond_wait(&server_work, &server_lock);
+
+        if (server_quit)
+            break;
+
+        server_game *game = server_queue_head;
+
+        server_queue_head = game->next_job;
+
+        if (server_queue_head == NULL)
+            server_queue_tail = NULL;
+
+        server_busy_games++;
+
+        // commands up to and including the next search
+        while (game->pending && !game->removed)
+        {
+            server_pending *entry = game->pending;
+
+            game->pending = entry->next;
+
+            if (game->pending == NULL)
+                game->pending_tail = NULL;
+
+            int search = strncmp(entry->text, "go", 2) == 0;
+
+            // "stop" sent before the search started still stops it
+            if (search)
+                game->stop = (entry->stops != game->stops);
+
+            pthread_mutex_unlock(&server_lock);
+
+            server_current = game;
+            stop_signal = &game->stop;
+
+            load_game_context(&game->context);
+            server_run(entry->text);
+            store_game_context(&game->context);
+
+            free(entry);
+
+            pthread_mutex_lock(&server_lock);
+
+            if (search)
+                break;
+        }
+
+        server_busy_games--;
+
+        if (game->removed)
+            server_free_game(game);
+
+        // back to the end of the queue after a search
+        else if (game->pending)
+            server_schedule(game);
+
+        else
+            game->busy = 0;
+
+        server_apply_options();
+    }
+
+    pthread_mutex_unlock(&server_lock);
+
+    return NULL;
+}
+
+// find game by id, create it if asked to (server lock held)
+static server_game *server_find_game(server_connection *connection, char *id, int create)
+{
+    int free_slot = -1;
+
+    for (int index = 0; index < SERVER_MAX_GAMES; index++)
+    {
+        if (server_games[index] == NULL)
+        {
+            if (free_slot < 0)
+                free_slot = index;
+        }
+
+        else if (server_games[index]->connection == connection && strcmp(server_games[index]->id, id) == 0)
+            return server_games[index];
+    }
+
+    if (!create || free_slot < 0)
+        return NULL;
+
+    server_game *game = calloc(1, sizeof(server_game));
+
+    if (game == NULL)
+        return NULL;
+
+    strcpy(game->id, id);
+    game->connection = connection;
+    connection->games++;
+
+    init_game_context(&game->context);
+
+    server_games[free_slot] = game;
+
+    return game;
+}
+
+// stop search of a game and forget it, freed by its worker if busy (server lock held)
+static void server_remove_game(server_game *game)
+{
+    for (int index = 0; index < SERVER_MAX_GAMES; index++)
+    {
+        if (server_games[index] == game)
+            server_games[index] = NULL;
+    }
+
+    game->stop = 1;
+    game->removed = 1;
+
+    if (!game->busy)
+        server_free_game(game);
+}
+
+// handle one input line without waiting for searches, returns 0 once the server should shut down
+int server_command(server_connection *connection, char *line)
+{
+    line[strcspn(line, "\r\n")] = '\0';
+
+    // commands without a game id
+    if (strcmp(line, "quit") == 0)
+        return 0;
+
+    if (strcmp(line, "isready") == 0)
+    {
+        pthread_mutex_lock(&server_output_lock);
+        fprintf(connection->output, "readyok\n");
+        fflush(connection->output);
+        pthread_mutex_unlock(&server_output_lock);
+
+        return 1;
+    }
+
+    // split "<id> <command>"
+    char *command = strchr(line, ' ');
+
+    if (command == NULL || command - line >= 32)
+        return 1;
+
+    *command++ = '\0';
+
+    while (*command == ' ')
+        command++;
+
+    pthread_mutex_lock(&server_lock);
+
+    server_game *game = server_find_game(connection, line, strcmp(command, "quit") != 0);
+
+    if (game == NULL)
+    {
+        pthread_mutex_unlock(&server_lock);
+
+        // unknown game quits or the game table is full
+        if (strcmp(command, "quit") != 0)
+        {
+            pthread_mutex_lock(&server_output_lock);
+            fprintf(connection->output, "%s info string no free game slot\n", line);
+            fflush(connection->output);
+            pthread_mutex_unlock(&server_output_lock);
+        }
+
+        return 1;
+    }
+
+    // stop running search (and a search queued before the stop)
+    if (strncmp(command, "stop", 4) == 0)
+    {
+        game->stop = 1;
+        game->stops++;
+    }
+
+    else if (strncmp(command, "isready", 7) == 0)
+        server_reply(game, "readyok");
+
+    else if (strncmp(command, "quit", 4) == 0)
+        server_remove_game(game);
+
+    else if (strncmp(command, "go", 2) == 0 && strstr(command, "perft"))
+        server_reply(game, "info string perft is not available in server mode");
+
+    // shared options change tables every search reads: set once no game is running
+    else if (strncmp(command, "setoption", 9) == 0 && !strstr(command, "name MultiPV value "))
+    {
+        if (server_append(&server_options, &server_options_tail, command, 0))
+            server_apply_options();
+    }
+
+    // game commands run in order by a worker once the game's previous search is done
+    else if (strncmp(command, "go", 2) == 0 || strncmp(command, "position", 8) == 0 ||
+             strncmp(command, "ucinewgame", 10) == 0 || strncmp(command, "setoption", 9) == 0)
+    {
+        if (!server_append(&game->pending, &game->pending_tail, command, game->stops))
+            server_reply(game, "info string out of memory");
+
+        else if (!game->busy)
+            server_schedule(game);
+    }
+
+    pthread_mutex_unlock(&server_lock);
+
+    return 1;
+}
+
+// read commands of one client until it disconnects, returns 0 on "quit"
+int server_read(server_connection *connection)
+{
+    char input[3000];
+
+    int running = 1;
+
+    while (running && fgets(input, sizeof(input), connection->input))
+        running = server_command(connection, input);
+
+    // client is gone: stop and forget its games, wait until no worker writes to it
+    pthread_mutex_lock(&server_lock);
+
+    for (int index = 0; index < SERVER_MAX_GAMES; index++)
+    {
+        if (server_games[index] && server_games[index]->connection == connection)
+            server_remove_game(server_games[index]);
+    }
+
+    while (connection->games)
+        pthread_cond_wait(&server_idle, &server_lock);
+
+    pthread_mutex_unlock(&server_lock);
+
+    return running;
+}
+
+#ifndef __MINGW32__
+
+// listening socket in socket mode
+int server_socket = -1;
+
+// serve one socket client
+void *server_client(void *argument)
+{
+    server_connection *connection = argument;
+
+    int running = server_read(connection);
+
+    fclose(connection->input);
+    fclose(connection->output);
+    free(connection);
+
+    // "quit" from any client ends the server
+    if (!running)
+        shutdown(server_socket, SHUT_RDWR);
+
+    return NULL;
+}
+
+// accept clients on a local socket until one sends "quit"
+int server_listen(char *path)
+{
+    struct sockaddr_un address;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        printf("socket path too long: %s\n", path);
+        return 1;
+    }
+
+    strcpy(address.sun_path, path);
+
+    server_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    unlink(path);
+
+    if (server_socket < 0 || bind(server_socket, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(server_socket, 16) < 0)
+    {
+        printf("could not listen on %s\n", path);
+        return 1;
+    }
+
+    while (1)
+    {
+        int client = accept(server_socket, NULL, NULL);
+
+        if (client < 0)
+            break;
+
+        server_connection *connection = malloc(sizeof(server_connection));
+
+        connection->input = fdopen(client, "r");
+        connection->output = fdopen(dup(client), "w");
+        connection->games = 0;
+
+        pthread_t thread;
+
+        pthread_create(&thread, NULL, server_client, connection);
+        pthread_detach(thread);
+    }
+
+    close(server_socket);
+    unlink(path);
+
+    return 0;
+}
+
+#endif
+
+// serve games from stdin or a local socket with a pool of search threads
+int server(char *socket_path)
+{
+    pthread_t workers[MAX_THREADS];
+
+    for (int index = 0; index < threads; index++)
+        pthread_create(&workers[index], NULL, server_worker, NULL);
+
+    int result = 0;
+
+    if (socket_path)
+    {
+#ifdef __MINGW32__
+        printf("socket mode is not available on Windows\n");
+        result = 1;
+#else
+        result = server_listen(socket_path);
+#endif
+    }
+
+    else
+    {
+        server_connection connection = { stdin, stdout, 0 };
+
+        server_read(&connection);
+    }
+
+    // stop everything still searching and let the workers finish
+    pthread_mutex_lock(&server_lock);
+
+    for (int index = 0; index < SERVER_MAX_GAMES; index++)
+    {
+        if (server_games[index])
+            server_games[index]->stop = 1;
+    }
+
+    server_quit = 1;
+
+    pthread_cond_broadcast(&server_work);
+    pthread_mutex_unlock(&server_lock);
+
+    for (int index = 0; index < threads; index++)
+        pthread_join(workers[index], NULL);
+
+    return result;
+}
+
+
+/****************************************************************
+ * 
+ * 
+ * 
+ *                      LIBRARY INTERFACE
+ * 
+ * 
+ *
+ * **************************************************************/
+
+#ifdef JABBEROOK_LIBRARY
+
+/*
+    C API of libjabberook.so (declared in jabberook.h)
+
+    Every instance owns a game context that is loaded into the calling
+    thread for the duration of a call, so instances searched from different
+    threads run in parallel. Shared options (book, tablebases) should only
+    change while no instance is searching.
+*/
+
+#include "jabberook.h"
+
+// only the API is exported (build with -fvisibility=hidden)
+#define JABBEROOK_API __attribute__((visibility("default")))
+
+struct jabberook_engine {
+    game_context context;
+
+    // stop request for the running search
+    volatile int stop;
+
+    // search output
+    jabberook_info_callback info;
+    jabberook_bestmove_callback bestmove;
+    void *user_data;
+    char best_move[6];
+    int score;
+};
+
+// attack tables and bitbases are built once
+pthread_once_t library_init_once = PTHREAD_ONCE_INIT;
+
+// instance searching on this thread
+THREAD_LOCAL jabberook_engine *library_engine = NULL;
+
+// search info hook: pass a best line to the instance callback
+static void library_info(int depth, int line, int time)
+{
+    jabberook_engine *engine = library_engine;
+
+    if (engine->info == NULL)
+        return;
+
+    char pv[6 * MAX_PLY];
+
+    line_to_string(&pv_lines[line], pv);
+
+    engine->info(engine->user_data, depth, seldepth, line + 1, pv_lines[line].score, nodes, time, pv);
 }
 
-// parse UCI command "go"
-void parse_go(char *command)
+// search bestmove hook: keep result and pass it to the instance callback
+static void library_bestmove(int move, pv_line *line)
 {
-    // init parameters
-    int depth = -1;
+    jabberook_engine *engine = library_engine;
 
-    // init argument
-    char *argument = NULL;
+    move_to_string(move, engine->best_move);
+    engine->score = line->score;
 
-    // infinite search
-    if ((argument = strstr(command,"infinite"))) {}
+    if (engine->bestmove == NULL)
+        return;
 
-    // match UCI "binc" command
-    if ((argument = strstr(command,"binc")) && side == black)
-        // parse black time increment
-        inc = atoi(argument + 5);
+    char pv[6 * MAX_PLY];
 
-    // match UCI "winc" command
-    if ((argument = strstr(command,"winc")) && side == white)
-        // parse white time increment
-        inc = atoi(argument + 5);
+    line_to_string(line, pv);
 
-    // match UCI "wtime" command
-    if ((argument = strstr(command,"wtime")) && side == white)
-        // parse white time limit
-        ucitime = atoi(argument + 6);
+    engine->bestmove(engine->user_data, engine->best_move, engine->score, pv);
+}
 
-    // match UCI "btime" command
-    if ((argument = strstr(command,"btime")) && side == black)
-        // parse black time limit
-        ucitime = atoi(argument + 6);
+JABBEROOK_API jabberook_engine *jabberook_create(void)
+{
+    pthread_once(&library_init_once, init_all);
 
-    // match UCI "movestogo" command
-    if ((argument = strstr(command,"movestogo")))
-        // parse number of moves to go
-        movestogo = atoi(argument + 10);
+    jabberook_engine *engine = calloc(1, sizeof(jabberook_engine));
 
-    // match UCI "movetime" command
-    if ((argument = strstr(command,"movetime")))
-        // parse amount of time allowed to spend to make a move
-        movetime = atoi(argument + 9);
+    if (engine == NULL)
+        return NULL;
 
-    // match UCI "depth" command
-    if ((argument = strstr(command,"depth")))
-        // parse search depth
-        depth = atoi(argument + 6);
+    init_game_context(&engine->context);
 
-    // if move time is available (only use for first move for lichess compatibility)
-    if(movetime != -1)
-    {
-        // set time equal to move time
-        ucitime = movetime;
+    return engine;
+}
 
-        // set moves to go to 1
-        movestogo = 1;
-    }
+JABBEROOK_API void jabberook_destroy(jabberook_engine *engine)
+{
+    free(engine);
+}
 
-    // reset movetime
-    movetime = -1;
+JABBEROOK_API void jabberook_new_game(jabberook_engine *engine)
+{
+    init_game_context(&engine->context);
+}
 
-    // init start time
-    starttime = get_time_ms();
+JABBEROOK_API int jabberook_set_position(jabberook_engine *engine, const char *fen, const char *moves)
+{
+    char command[3000];
 
-    // init search depth
-    depth = depth;
+    int length = (fen && *fen) ? snprintf(command, sizeof(command), "position fen %s", fen)
+                               : snprintf(command, sizeof(command), "position startpos");
 
-    // if time control is available
-    if(ucitime != -1)
-    {
-        // flag we're playing with time control
-        timeset = 1;
+    if (moves && *moves && length < (int)sizeof(command))
+        length += snprintf(command + length, sizeof(command) - length, " moves %s", moves);
 
-        // set up timing
-        ucitime /= movestogo;
-        ucitime -= 150; // ping overhead
-        stoptime = starttime + ucitime + inc;
-        movestogo--;
+    // parse_position works on at most 3000 characters
+    if (length >= (int)sizeof(command))
+        return 0;
 
-        if (movestogo == 0)
-        {
-            movestogo = 15;
-        }
+    load_game_context(&engine->context);
+    parse_position(command);
+    store_game_context(&engine->context);
 
-        if(first_move == 1)
-        {
-            movestogo = 120;
-            first_move = 0;
-        }
-    }
+    return 1;
+}
 
-    // if depth is not available
-    if(depth == -1)
-        // set depth to 64 plies (takes ages to complete...)
-        depth = 64;
+JABBEROOK_API void jabberook_set_option(jabberook_engine *engine, const char *name, const char *value)
+{
+    char command[3000];
 
-    // print debug info
-    // printf("time:%d start:%d stop:%d depth:%d timeset:%d\n",
-    // ucitime, starttime, stoptime, depth, timeset);
+    snprintf(command, sizeof(command), "setoption name %s value %s", name, value ? value : "");
 
-    // search position
-    // print_board();
-    search_position(depth);
+    load_game_context(&engine->context);
+    parse_setoption(command);
+    store_game_context(&engine->context);
 }
 
-// main UCI loop
-void uci_loop()
+JABBEROOK_API void jabberook_set_callbacks(jabberook_engine *engine, jabberook_info_callback info,
+                                           jabberook_bestmove_callback bestmove, void *user_data)
 {
-    // reset STDIN & STDOUT buffers
-    setbuf(stdin, NULL);
-    setbuf(stdout, NULL);
-    
-    // define user / GUI input buffer
-    char input[3000];
-    
-    // print engine info
-    
-    // main loop
-    while (1)
-    {
-        // reset user /GUI input
-        memset(input, 0, sizeof(input));
-        
-        // make sure output reaches the GUI
-        fflush(stdout);
-        
-        // get user / GUI input
-        if (!fgets(input, 3000, stdin))
-            // continue the loop
-            continue;
-        
-        // make sure input is available
-        if (input[0] == '\n')
-            // continue the loop
-            continue;
-        
-        // parse UCI "isready" command
-        if (strncmp(input, "isready", 7) == 0)
-        {
-            printf("readyok\n");
-            continue;
-        }
-        
-        // parse UCI "position" command
-        else if (strncmp(input, "position", 8) == 0)
-            // call parse position function
-            parse_position(input);
-        
-        // parse UCI "ucinewgame" command
-        else if (strncmp(input, "ucinewgame", 10) == 0)
-            // call parse position function
-            parse_position("position startpos");
-        
-        // parse UCI "go" command
-        else if (strncmp(input, "go", 2) == 0)
-            // call parse go function
-            parse_go(input);
-        
-        // parse UCI "quit" command
-        else if (strncmp(input, "quit", 4) == 0)
-            // quit from the chess engine program execution
-            break;
-        
-        // parse UCI "uci" command
-        else if (strncmp(input, "uci", 3) == 0)
-        {
-            // print engine info
-            printf("id name Jabberook-v1.0\n");
-            printf("id author Kiran\n");
-            printf("uciok\n");
-        }
-    }
+    engine->info = info;
+    engine->bestmove = bestmove;
+    engine->user_data = user_data;
 }
 
+JABBEROOK_API int jabberook_search(jabberook_engine *engine, const jabberook_limits *limits, char *best_move, int *score)
+{
+    jabberook_limits none = { 0 };
 
-/****************************************************************
- * 
- * 
- * 
- *                      INITIALIZATIONS                                
- * 
- * 
- *
- * **************************************************************/
+    if (limits == NULL)
+        limits = &none;
 
-void init_all()
-{
-    init_leapers_attacks();
+    // same limits as UCI "go"
+    char command[2048] = "go";
+    int length = 2;
 
-    init_sliders_attacks(bishop);
-    init_sliders_attacks(rook);
+    if (limits->depth) length += sprintf(command + length, " depth %d", limits->depth);
+    if (limits->movetime) length += sprintf(command + length, " movetime %d", limits->movetime);
+    if (limits->wtime) length += sprintf(command + length, " wtime %d", limits->wtime);
+    if (limits->btime) length += sprintf(command + length, " btime %d", limits->btime);
+    if (limits->winc) length += sprintf(command + length, " winc %d", limits->winc);
+    if (limits->binc) length += sprintf(command + length, " binc %d", limits->binc);
+    if (limits->movestogo) length += sprintf(command + length, " movestogo %d", limits->movestogo);
+    if (limits->nodes) length += sprintf(command + length, " nodes %lld", limits->nodes);
 
-    //init_magic_numbers();
+    // no limits: search until jabberook_stop (and no book move)
+    if (length == 2)
+        length = sprintf(command, "go infinite");
+
+    // root moves last, parse_go reads them up to the end of the command
+    if (limits->searchmoves && *limits->searchmoves)
+        snprintf(command + length, sizeof(command) - length, " searchmoves %s", limits->searchmoves);
+
+    load_game_context(&engine->context);
+
+    library_engine = engine;
+    engine->stop = 0;
+    stop_signal = &engine->stop;
+
+    // no UCI input in the library
+    poll_input = 0;
+
+    info_hook = library_info;
+    bestmove_hook = library_bestmove;
+
+    parse_go(command);
+
+    info_hook = NULL;
+    bestmove_hook = NULL;
+    stop_signal = NULL;
+    library_engine = NULL;
+
+    store_game_context(&engine->context);
+
+    if (best_move)
+        strcpy(best_move, engine->best_move);
+
+    if (score)
+        *score = engine->score;
+
+    return strcmp(engine->best_move, "0000") != 0;
+}
+
+JABBEROOK_API void jabberook_stop(jabberook_engine *engine)
+{
+    // flag is polled by the running search
+    engine->stop = 1;
 }
 
+#endif
+
+
 /****************************************************************
  * 
  * 
@@ -3024,13 +10361,147 @@ void init_all()
 
 
 
-int main() 
+/*
+    Command line modes
+
+    Jabberook                                            UCI mode
+    Jabberook perftsuite <file.epd> [max depth] [threads]  movegen regression suite
+    Jabberook bench [depth]                              search signature and speed
+    Jabberook microbench [csv|json]                      hot path primitive timings
+    Jabberook tracedump <file> [max ply] [root moves...]  decode search trace
+    Jabberook makebook <file.pgn> <book.bin> [max plies] [threads] [memory MB]
+                                                         build Polyglot book from games
+    Jabberook tbgen <dir> [threads] [tables...]          generate DTM tablebases (e.g. KQvKR)
+    Jabberook server [threads] [socket path]             serve many games by id (stdin or local socket)
+    Jabberook analyze <in.epd> <out.epd> [depth] [threads] [movetime ms]
+                                                         search every position of a file
+    Jabberook datagen <out.bin> <games> [threads] [nodes] [depth] [random plies]
+                                                         self-play training positions (packed)
+    Jabberook dataconvert <in.bin> <out.txt|->           packed positions to "fen | score | result"
+    Jabberook tune <data> [threads] [iterations] [params|-]
+                                                         Texel tuning of evaluation parameters
+*/
+
+#ifndef JABBEROOK_LIBRARY
+
+int main(int argc, char *argv[]) 
 {
     
     init_all();
     
     int debug = 0;
 
+    // perft regression suite
+    if (argc > 2 && strcmp(argv[1], "perftsuite") == 0)
+    {
+        int max_depth = (argc > 3) ? atoi(argv[3]) : MAX_PLY;
+
+        if (argc > 4)
+            threads = atoi(argv[4]);
+
+        if (threads < 1) threads = 1;
+        if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+        return perft_suite(argv[2], max_depth) ? 1 : 0;
+    }
+
+    // fixed depth search benchmark
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        bench((argc > 2) ? atoi(argv[2]) : BENCH_DEPTH);
+        return 0;
+    }
+
+    // search trace decoder
+    if (argc > 2 && strcmp(argv[1], "tracedump") == 0)
+        return trace_dump(argv[2], (argc > 3) ? atoi(argv[3]) : MAX_PLY, argv + 4, (argc > 4) ? argc - 4 : 0);
+
+    // PGN to Polyglot book builder
+    if (argc > 3 && strcmp(argv[1], "makebook") == 0)
+    {
+        if (argc > 5)
+            threads = atoi(argv[5]);
+
+        if (threads < 1) threads = 1;
+        if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+        return make_book(argv[2], argv[3], (argc > 4) ? atoi(argv[4]) : BOOK_PLIES,
+                         (argc > 6) ? atoi(argv[6]) : BOOK_MEMORY_MB);
+    }
+
+    // tablebase generator
+    if (argc > 2 && strcmp(argv[1], "tbgen") == 0)
+    {
+        if (argc > 3)
+            threads = atoi(argv[3]);
+
+        if (threads < 1) threads = 1;
+        if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+        return tb_generate_all(argv[2], argv + 4, (argc > 4) ? argc - 4 : 0);
+    }
+
+    // batch analysis of an EPD / FEN file
+    if (argc > 3 && strcmp(argv[1], "analyze") == 0)
+    {
+        if (argc > 5)
+            threads = atoi(argv[5]);
+
+        if (threads < 1) threads = 1;
+        if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+        return analyze_file(argv[2], argv[3], (argc > 4) ? atoi(argv[4]) : ANALYSIS_DEPTH,
+                            (argc > 6) ? atoi(argv[6]) : 0);
+    }
+
+    // self-play training data
+    if (argc > 3 && strcmp(argv[1], "datagen") == 0)
+    {
+        if (argc > 4)
+            threads = atoi(argv[4]);
+
+        if (threads < 1) threads = 1;
+        if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+        return datagen(argv[2], strtoull(argv[3], NULL, 10), (argc > 5) ? atol(argv[5]) : DATAGEN_NODES,
+                       (argc > 6) ? atoi(argv[6]) : 0, (argc > 7) ? atoi(argv[7]) : DATAGEN_RANDOM_PLIES);
+    }
+
+    // packed training data to text
+    if (argc > 3 && strcmp(argv[1], "dataconvert") == 0)
+        return dataconvert(argv[2], argv[3]);
+
+    // evaluation tuning
+    if (argc > 2 && strcmp(argv[1], "tune") == 0)
+    {
+        if (argc > 3)
+            threads = atoi(argv[3]);
+
+        if (threads < 1) threads = 1;
+        if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+        return tune(argv[2], (argc > 4) ? atoi(argv[4]) : TUNE_ITERATIONS, (argc > 5) ? argv[5] : "-");
+    }
+
+    // multi game server
+    if (argc > 1 && strcmp(argv[1], "server") == 0)
+    {
+        if (argc > 2)
+            threads = atoi(argv[2]);
+
+        if (threads < 1) threads = 1;
+        if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+        return server((argc > 3) ? argv[3] : NULL);
+    }
+
+    // primitive micro benchmarks
+    if (argc > 1 && strcmp(argv[1], "microbench") == 0)
+    {
+        micro_bench((argc > 2) ? argv[2] : "csv");
+        return 0;
+    }
+
     if(debug)
     {
     }
@@ -3038,4 +10509,6 @@ int main()
         uci_loop();
 
 	return 0;
-}
\ No newline at end of file
+}
+
+#endif
@@ -0,0 +1,91 @@
+/***********************************************************************************
+ *
+ *
+ *
+ *                          JABBEROOK LIBRARY API
+ *
+ *
+ *
+ * *********************************************************************************/
+
+/*
+    C interface of libjabberook.so ("make lib")
+
+    Every engine instance keeps its own game (position, move ordering data
+    used to warm start the next search, clock state and MultiPV). Different
+    instances may be used from different threads at the same time, one
+    instance from one thread at a time. Shared options (BookFile,
+    TablebasePath, EvalFile, EvalParam) should only be set while no
+    instance is searching.
+
+    jabberook_engine *engine = jabberook_create();
+
+    jabberook_set_position(engine, NULL, "e2e4 e7e5");
+
+    jabberook_limits limits = { .wtime = 60000, .btime = 60000 };
+    char move[6];
+    int score;
+
+    jabberook_search(engine, &limits, move, &score);
+
+    jabberook_destroy(engine);
+*/
+
+#ifndef JABBEROOK_H
+#define JABBEROOK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// engine instance
+typedef struct jabberook_engine jabberook_engine;
+
+// search limits, 0 = not set (all 0 searches until jabberook_stop)
+typedef struct {
+    int depth;              // max depth in plies
+    int movetime;           // time for this move in ms
+    int wtime, btime;       // clocks in ms
+    int winc, binc;         // increments in ms
+    int movestogo;          // moves to the next time control
+    long long nodes;        // max nodes
+    const char *searchmoves;    // root moves to consider ("e2e4 d2d4", NULL = all)
+} jabberook_limits;
+
+// called after every completed iteration for each best line (multipv counts from 1)
+typedef void (*jabberook_info_callback)(void *user_data, int depth, int seldepth, int multipv, int score,
+                                        long long nodes, int time, const char *pv);
+
+// called once when the search is done ("0000" if there is no legal move)
+typedef void (*jabberook_bestmove_callback)(void *user_data, const char *move, int score, const char *pv);
+
+// new instance at the start position (NULL if out of memory)
+jabberook_engine *jabberook_create(void);
+
+// free instance
+void jabberook_destroy(jabberook_engine *engine);
+
+// forget the previous game
+void jabberook_new_game(jabberook_engine *engine);
+
+// set position from FEN (NULL or "" = start position) and UCI moves ("e2e4 e7e5", may be NULL), 0 if too long
+int jabberook_set_position(jabberook_engine *engine, const char *fen, const char *moves);
+
+// set UCI option (MultiPV, BookFile, BookMode, TablebasePath, EvalFile, ...)
+void jabberook_set_option(jabberook_engine *engine, const char *name, const char *value);
+
+// set search output callbacks (NULL = not called)
+void jabberook_set_callbacks(jabberook_engine *engine, jabberook_info_callback info,
+                             jabberook_bestmove_callback bestmove, void *user_data);
+
+// search current position, best move (6 bytes) and score may be NULL, returns 0 if there is no legal move
+int jabberook_search(jabberook_engine *engine, const jabberook_limits *limits, char *best_move, int *score);
+
+// stop a running search of the instance (safe from another thread)
+void jabberook_stop(jabberook_engine *engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif